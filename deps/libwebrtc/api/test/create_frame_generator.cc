@@ -16,6 +16,7 @@
 #include "rtc_base/checks.h"
 #include "test/frame_generator.h"
 #include "test/testsupport/ivf_video_frame_generator.h"
+#include "test/testsupport/lz4_video_frame_generator.h"
 
 namespace webrtc {
 namespace test {
@@ -52,6 +53,13 @@ std::unique_ptr<FrameGeneratorInterface> CreateFromIvfFileFrameGenerator(
   return std::make_unique<IvfVideoFrameGenerator>(std::move(filename));
 }
 
+std::unique_ptr<FrameGeneratorInterface> CreateFromLz4FileFrameGenerator(
+    std::string filename,
+    absl::optional<size_t> prefetch_frames) {
+  return std::make_unique<Lz4VideoFrameGenerator>(filename,
+                                                  prefetch_frames.value_or(8));
+}
+
 std::unique_ptr<FrameGeneratorInterface>
 CreateScrollingInputFromYuvFilesFrameGenerator(
     Clock* clock,
@@ -75,9 +83,13 @@ CreateScrollingInputFromYuvFilesFrameGenerator(
       scroll_time_ms, pause_time_ms);
 }
 
-std::unique_ptr<FrameGeneratorInterface>
-CreateSlideFrameGenerator(int width, int height, int frame_repeat_count) {
-  return std::make_unique<SlideGenerator>(width, height, frame_repeat_count);
+std::unique_ptr<FrameGeneratorInterface> CreateSlideFrameGenerator(
+    int width,
+    int height,
+    int frame_repeat_count,
+    absl::optional<int> render_threads) {
+  return std::make_unique<SlideGenerator>(width, height, frame_repeat_count,
+                                          render_threads.value_or(1));
 }
 
 }  // namespace test
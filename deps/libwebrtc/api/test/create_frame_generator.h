@@ -41,10 +41,19 @@ std::unique_ptr<FrameGeneratorInterface> CreateFromYuvFileFrameGenerator(
     size_t height,
     int frame_repeat_count);
 
-// Creates a frame generator that repeatedly plays an ivf file.
+// Creates a frame generator that repeatedly plays an ivf file. Frames are
+// decoded ahead of time on a background thread.
 std::unique_ptr<FrameGeneratorInterface> CreateFromIvfFileFrameGenerator(
     std::string filename);
 
+// Creates a frame generator that repeatedly plays a LZ4 frame file (see
+// test/testsupport/lz4_frame_file.h). Frames are decompressed on a background
+// thread which keeps |prefetch_frames| frames ready.
+// |prefetch_frames| has the default value 8.
+std::unique_ptr<FrameGeneratorInterface> CreateFromLz4FileFrameGenerator(
+    std::string filename,
+    absl::optional<size_t> prefetch_frames);
+
 // Creates a frame generator which takes a set of yuv files (wrapping a
 // frame generator created by CreateFromYuvFile() above), but outputs frames
 // that have been cropped to specified resolution: source_width/source_height
@@ -67,8 +76,14 @@ CreateScrollingInputFromYuvFilesFrameGenerator(
 // Creates a frame generator that produces randomly generated slides. It fills
 // the frames with randomly sized and colored squares.
 // |frame_repeat_count| determines how many times each slide is shown.
-std::unique_ptr<FrameGeneratorInterface>
-CreateSlideFrameGenerator(int width, int height, int frame_repeat_count);
+// Slides are rendered in horizontal bands on |render_threads| threads, the
+// calling one included, which keeps high resolutions within the frame
+// interval. |render_threads| has the default value 1.
+std::unique_ptr<FrameGeneratorInterface> CreateSlideFrameGenerator(
+    int width,
+    int height,
+    int frame_repeat_count,
+    absl::optional<int> render_threads);
 
 }  // namespace test
 }  // namespace webrtc
@@ -0,0 +1,273 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "pc/test/audio_level_meter.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define AUDIO_LEVEL_METER_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define AUDIO_LEVEL_METER_NEON
+#endif
+
+namespace webrtc {
+namespace {
+
+constexpr float kSilenceDb = -100.f;
+constexpr double kFullScale = 32768.0;
+
+// Gauges hold integers, so levels are stored in thousandths of a dB.
+int64_t ToMillidB(float db) {
+  return static_cast<int64_t>(lrintf(db * 1000.f));
+}
+
+float FromMillidB(int64_t millidb) {
+  return static_cast<float>(millidb) / 1000.f;
+}
+
+float ToDbfs(double amplitude) {
+  if (amplitude <= 0.0)
+    return kSilenceDb;
+  return std::max(kSilenceDb,
+                  static_cast<float>(20.0 * log10(amplitude / kFullScale)));
+}
+
+}  // namespace
+
+constexpr size_t AudioLevelMeter::kMaxLoudnessChannels;
+constexpr size_t AudioLevelMeter::kShortTermFrames;
+
+void Int16SumOfSquaresAndPeak(const int16_t* samples,
+                              size_t size,
+                              uint64_t* sum_of_squares,
+                              int* peak) {
+  size_t i = 0;
+  uint64_t sum = 0;
+  int max = 0;
+  int min = 0;
+#if defined(AUDIO_LEVEL_METER_SSE2)
+  // _mm_madd_epi16 adds pairs of squares into 32 bits, which only overflows
+  // the signed range for two samples of -32768; the sums are widened as
+  // unsigned.
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sum64 = zero;
+  __m128i max16 = zero;
+  __m128i min16 = zero;
+  for (; i + 8 <= size; i += 8) {
+    const __m128i x =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+    const __m128i squares = _mm_madd_epi16(x, x);
+    sum64 = _mm_add_epi64(sum64, _mm_unpacklo_epi32(squares, zero));
+    sum64 = _mm_add_epi64(sum64, _mm_unpackhi_epi32(squares, zero));
+    max16 = _mm_max_epi16(max16, x);
+    min16 = _mm_min_epi16(min16, x);
+  }
+  uint64_t sums[2];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(sums), sum64);
+  sum = sums[0] + sums[1];
+  int16_t maxs[8];
+  int16_t mins[8];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(maxs), max16);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(mins), min16);
+  for (int k = 0; k < 8; ++k) {
+    max = std::max<int>(max, maxs[k]);
+    min = std::min<int>(min, mins[k]);
+  }
+#elif defined(AUDIO_LEVEL_METER_NEON)
+  int64x2_t sum64 = vdupq_n_s64(0);
+  int16x8_t max16 = vdupq_n_s16(0);
+  int16x8_t min16 = vdupq_n_s16(0);
+  for (; i + 8 <= size; i += 8) {
+    const int16x8_t x = vld1q_s16(samples + i);
+    // Squares fit in 31 bits, pairs of them are widened to 64.
+    sum64 = vpadalq_s32(sum64, vmull_s16(vget_low_s16(x), vget_low_s16(x)));
+    sum64 =
+        vpadalq_s32(sum64, vmull_s16(vget_high_s16(x), vget_high_s16(x)));
+    max16 = vmaxq_s16(max16, x);
+    min16 = vminq_s16(min16, x);
+  }
+  sum = static_cast<uint64_t>(vgetq_lane_s64(sum64, 0) +
+                              vgetq_lane_s64(sum64, 1));
+  int16_t maxs[8];
+  int16_t mins[8];
+  vst1q_s16(maxs, max16);
+  vst1q_s16(mins, min16);
+  for (int k = 0; k < 8; ++k) {
+    max = std::max<int>(max, maxs[k]);
+    min = std::min<int>(min, mins[k]);
+  }
+#endif
+  for (; i < size; ++i) {
+    const int x = samples[i];
+    sum += static_cast<uint64_t>(x * x);
+    max = std::max(max, x);
+    min = std::min(min, x);
+  }
+  *sum_of_squares = sum;
+  *peak = std::max(max, -min);
+}
+
+AudioLevelMeter::AudioLevelMeter(test::MetricsRegistry* registry,
+                                 const std::string& prefix,
+                                 float audible_threshold_dbfs)
+    : audible_threshold_dbfs_(audible_threshold_dbfs),
+      sample_rate_hz_(0),
+      shelf_(),
+      high_pass_(),
+      frame_energies_(),
+      frame_index_(0),
+      num_frame_energies_(0),
+      energy_sum_(0.0),
+      rms_millidbfs_(registry->GetGauge(prefix + "rms_millidbfs")),
+      peak_millidbfs_(registry->GetGauge(prefix + "peak_millidbfs")),
+      short_term_millilufs_(
+          registry->GetGauge(prefix + "short_term_millilufs")),
+      frames_(registry->GetCounter(prefix + "level_frames_total")),
+      audible_frames_(registry->GetCounter(prefix + "audible_frames_total")) {
+  rms_millidbfs_->Set(ToMillidB(kSilenceDb));
+  peak_millidbfs_->Set(ToMillidB(kSilenceDb));
+  short_term_millilufs_->Set(ToMillidB(kSilenceDb));
+}
+
+AudioLevelMeter::~AudioLevelMeter() = default;
+
+void AudioLevelMeter::Process(const int16_t* data,
+                              size_t samples_per_channel,
+                              size_t num_channels,
+                              int sample_rate_hz) {
+  const size_t size = samples_per_channel * num_channels;
+  if (size == 0)
+    return;
+
+  uint64_t sum_of_squares;
+  int peak;
+  Int16SumOfSquaresAndPeak(data, size, &sum_of_squares, &peak);
+  const float rms_dbfs = ToDbfs(sqrt(static_cast<double>(sum_of_squares) /
+                                     static_cast<double>(size)));
+  rms_millidbfs_->Set(ToMillidB(rms_dbfs));
+  peak_millidbfs_->Set(ToMillidB(ToDbfs(peak)));
+  frames_->Add();
+  if (rms_dbfs > audible_threshold_dbfs_)
+    audible_frames_->Add();
+
+  if (sample_rate_hz != sample_rate_hz_)
+    SetSampleRate(sample_rate_hz);
+  double energy = 0.0;
+  const size_t channels = std::min(num_channels, kMaxLoudnessChannels);
+  for (size_t channel = 0; channel < channels; ++channel) {
+    energy +=
+        KWeightedMeanSquare(data, samples_per_channel, num_channels, channel);
+  }
+
+  // Sliding 3 s window. The sum is recomputed on every wrap so that rounding
+  // errors don't accumulate.
+  energy_sum_ += energy - frame_energies_[frame_index_];
+  frame_energies_[frame_index_] = energy;
+  frame_index_ = (frame_index_ + 1) % kShortTermFrames;
+  if (frame_index_ == 0) {
+    energy_sum_ = 0.0;
+    for (double frame_energy : frame_energies_)
+      energy_sum_ += frame_energy;
+  }
+  num_frame_energies_ = std::min(num_frame_energies_ + 1, kShortTermFrames);
+  float lufs = kSilenceDb;
+  if (num_frame_energies_ == kShortTermFrames && energy_sum_ > 0.0) {
+    const double mean_energy = energy_sum_ / kShortTermFrames;
+    lufs = std::max(kSilenceDb,
+                    static_cast<float>(-0.691 + 10.0 * log10(mean_energy)));
+  }
+  short_term_millilufs_->Set(ToMillidB(lufs));
+}
+
+AudioLevelMeter::Levels AudioLevelMeter::GetLevels() const {
+  Levels levels;
+  levels.rms_dbfs = FromMillidB(rms_millidbfs_->value());
+  levels.peak_dbfs = FromMillidB(peak_millidbfs_->value());
+  levels.short_term_lufs = FromMillidB(short_term_millilufs_->value());
+  levels.frames = frames_->value();
+  levels.audible_frames = audible_frames_->value();
+  return levels;
+}
+
+// K-weighting filter coefficients for any sample rate, from the analog
+// prototypes of the BS.1770 filters (as derived for libebur128).
+void AudioLevelMeter::SetSampleRate(int sample_rate_hz) {
+  sample_rate_hz_ = sample_rate_hz;
+  const double pi = 3.14159265358979323846;
+
+  double f0 = 1681.974450955533;
+  const double gain_db = 3.999843853973347;
+  double q = 0.7071752369554196;
+  double k = tan(pi * f0 / sample_rate_hz);
+  const double vh = pow(10.0, gain_db / 20.0);
+  const double vb = pow(vh, 0.4996667741545416);
+  double a0 = 1.0 + k / q + k * k;
+  shelf_.b0 = (vh + vb * k / q + k * k) / a0;
+  shelf_.b1 = 2.0 * (k * k - vh) / a0;
+  shelf_.b2 = (vh - vb * k / q + k * k) / a0;
+  shelf_.a1 = 2.0 * (k * k - 1.0) / a0;
+  shelf_.a2 = (1.0 - k / q + k * k) / a0;
+
+  f0 = 38.13547087602444;
+  q = 0.5003270373238773;
+  k = tan(pi * f0 / sample_rate_hz);
+  a0 = 1.0 + k / q + k * k;
+  high_pass_.b0 = 1.0;
+  high_pass_.b1 = -2.0;
+  high_pass_.b2 = 1.0;
+  high_pass_.a1 = 2.0 * (k * k - 1.0) / a0;
+  high_pass_.a2 = (1.0 - k / q + k * k) / a0;
+
+  shelf_states_.fill(BiquadState());
+  high_pass_states_.fill(BiquadState());
+  frame_energies_.fill(0.0);
+  frame_index_ = 0;
+  num_frame_energies_ = 0;
+  energy_sum_ = 0.0;
+}
+
+double AudioLevelMeter::KWeightedMeanSquare(const int16_t* data,
+                                            size_t samples_per_channel,
+                                            size_t num_channels,
+                                            size_t channel) {
+  // Transposed direct form II. The recursion is sequential, so this part is
+  // not vectorized; it runs once per sample and channel.
+  const Biquad s = shelf_;
+  const Biquad h = high_pass_;
+  BiquadState shelf_state = shelf_states_[channel];
+  BiquadState high_pass_state = high_pass_states_[channel];
+  double sum = 0.0;
+  for (size_t i = 0; i < samples_per_channel; ++i) {
+    const double x = data[i * num_channels + channel] / kFullScale;
+    const double y = s.b0 * x + shelf_state.z1;
+    shelf_state.z1 = s.b1 * x - s.a1 * y + shelf_state.z2;
+    shelf_state.z2 = s.b2 * x - s.a2 * y;
+    const double z = h.b0 * y + high_pass_state.z1;
+    high_pass_state.z1 = h.b1 * y - h.a1 * z + high_pass_state.z2;
+    high_pass_state.z2 = h.b2 * y - h.a2 * z;
+    sum += z * z;
+  }
+  // Flush the decaying tail of the filters before it turns into denormals.
+  if (fabs(high_pass_state.z1) < 1e-20 && fabs(shelf_state.z1) < 1e-20) {
+    shelf_state = BiquadState();
+    high_pass_state = BiquadState();
+  }
+  shelf_states_[channel] = shelf_state;
+  high_pass_states_[channel] = high_pass_state;
+  return sum / samples_per_channel;
+}
+
+}  // namespace webrtc
@@ -0,0 +1,113 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef PC_TEST_AUDIO_LEVEL_METER_H_
+#define PC_TEST_AUDIO_LEVEL_METER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <string>
+
+#include "test/metrics_registry.h"
+
+namespace webrtc {
+
+// Sum of squares and peak magnitude of |size| int16 samples, with SSE2 or
+// NEON where available. The peak of -32768 is 32768.
+void Int16SumOfSquaresAndPeak(const int16_t* samples,
+                              size_t size,
+                              uint64_t* sum_of_squares,
+                              int* peak);
+
+// Meters the level of a stream of 10 ms audio frames: RMS and peak of the
+// last frame, and short-term loudness (ITU-R BS.1770 K-weighting over the
+// last 3 seconds, as in EBU R128). Frames louder than a threshold count as
+// audible, which tells a live stream from one that only gets comfort noise
+// or silence.
+//
+// Process() is called on one thread, typically the audio thread. The results
+// are metrics of a test::MetricsRegistry, named with a prefix:
+//   <prefix>level_frames_total, <prefix>audible_frames_total: counters.
+//   <prefix>rms_millidbfs, <prefix>peak_millidbfs,
+//   <prefix>short_term_millilufs: gauges, in thousandths of a dB.
+// GetLevels() may be called on any thread.
+class AudioLevelMeter {
+ public:
+  struct Levels {
+    // Of the last frame, in dBFS; -100 for digital silence.
+    float rms_dbfs = -100.f;
+    float peak_dbfs = -100.f;
+    // In LUFS over the last 3 seconds; -100 until then or for silence.
+    float short_term_lufs = -100.f;
+    uint64_t frames = 0;
+    uint64_t audible_frames = 0;
+  };
+
+  // Frames with an RMS above |audible_threshold_dbfs| count as audible.
+  // Comfort noise is typically below -60 dBFS.
+  AudioLevelMeter(test::MetricsRegistry* registry,
+                  const std::string& prefix,
+                  float audible_threshold_dbfs = -50.f);
+  ~AudioLevelMeter();
+
+  // Up to 2 channels are K-weighted; further channels only count for RMS and
+  // peak.
+  void Process(const int16_t* data,
+               size_t samples_per_channel,
+               size_t num_channels,
+               int sample_rate_hz);
+
+  Levels GetLevels() const;
+
+ private:
+  static constexpr size_t kMaxLoudnessChannels = 2;
+  // 3 s of 10 ms frames.
+  static constexpr size_t kShortTermFrames = 300;
+
+  struct Biquad {
+    double b0, b1, b2, a1, a2;
+  };
+  struct BiquadState {
+    double z1 = 0.0;
+    double z2 = 0.0;
+  };
+
+  void SetSampleRate(int sample_rate_hz);
+  // Mean square of the K-weighted |channel|, updating its filter states.
+  double KWeightedMeanSquare(const int16_t* data,
+                             size_t samples_per_channel,
+                             size_t num_channels,
+                             size_t channel);
+
+  const float audible_threshold_dbfs_;
+
+  // Only used by Process().
+  int sample_rate_hz_;
+  Biquad shelf_;
+  Biquad high_pass_;
+  std::array<BiquadState, kMaxLoudnessChannels> shelf_states_;
+  std::array<BiquadState, kMaxLoudnessChannels> high_pass_states_;
+  std::array<double, kShortTermFrames> frame_energies_;
+  size_t frame_index_;
+  size_t num_frame_energies_;
+  double energy_sum_;
+
+  test::MetricsRegistry::Gauge* const rms_millidbfs_;
+  test::MetricsRegistry::Gauge* const peak_millidbfs_;
+  test::MetricsRegistry::Gauge* const short_term_millilufs_;
+  test::MetricsRegistry::Counter* const frames_;
+  test::MetricsRegistry::Counter* const audible_frames_;
+};
+
+}  // namespace webrtc
+
+#endif  // PC_TEST_AUDIO_LEVEL_METER_H_
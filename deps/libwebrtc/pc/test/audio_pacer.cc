@@ -0,0 +1,197 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "pc/test/audio_pacer.h"
+
+#include <algorithm>
+
+#if defined(WEBRTC_POSIX) && !defined(WEBRTC_MAC)
+#include <errno.h>
+#include <time.h>
+#endif
+
+#include "rtc_base/checks.h"
+#include "rtc_base/time_utils.h"
+#include "system_wrappers/include/cpu_info.h"
+
+namespace webrtc {
+namespace {
+
+constexpr int64_t kSlotNs = rtc::kNumNanosecsPerMillisec;
+
+}  // namespace
+
+constexpr int AudioPacer::kTickPeriodMs;
+constexpr int AudioPacer::kSlots;
+
+// static
+AudioPacer* AudioPacer::Shared() {
+  static AudioPacer* const pacer =
+      new AudioPacer(std::max(1, CpuInfo::DetectNumberOfCores() / 2));
+  return pacer;
+}
+
+AudioPacer::AudioPacer(int max_threads)
+    : max_shards_(std::max(max_threads, 1)) {
+  RTC_DCHECK_GE(max_threads, 1);
+}
+
+AudioPacer::~AudioPacer() {
+  RTC_DCHECK(registrations_.empty());
+}
+
+void AudioPacer::Register(Client* client, int phase_ms) {
+  RTC_DCHECK_LT(phase_ms, kSlots);
+  rtc::CritScope cs(&crit_);
+  if (registrations_.find(client) != registrations_.end())
+    return;
+  Shard* shard = nullptr;
+  if (!shards_.empty()) {
+    shard = std::min_element(shards_.begin(), shards_.end(),
+                             [](const std::unique_ptr<Shard>& a,
+                                const std::unique_ptr<Shard>& b) {
+                               return a->size() < b->size();
+                             })
+                ->get();
+  }
+  if (!shard || (shard->size() > 0 && shards_.size() < max_shards_)) {
+    shards_.push_back(std::make_unique<Shard>());
+    shard = shards_.back().get();
+  }
+  const int slot = phase_ms >= 0 ? phase_ms : shard->LeastLoadedSlot();
+  shard->Add(client, slot);
+  registrations_[client] = Registration{shard, slot};
+}
+
+void AudioPacer::Unregister(Client* client) {
+  Shard* shard;
+  {
+    rtc::CritScope cs(&crit_);
+    auto it = registrations_.find(client);
+    if (it == registrations_.end())
+      return;
+    shard = it->second.shard;
+    shard->Remove(client, it->second.slot);
+    registrations_.erase(it);
+  }
+  shard->WaitForTick();
+}
+
+AudioPacer::Shard::Shard()
+    : size_(0),
+      quit_(false),
+      thread_(&Shard::Run, this, "AudioPacer", rtc::kNormalPriority) {
+  thread_.Start();
+}
+
+AudioPacer::Shard::~Shard() {
+  quit_ = true;
+  wake_.Set();
+  thread_.Stop();
+}
+
+int AudioPacer::Shard::size() const {
+  rtc::CritScope cs(&crit_);
+  return size_;
+}
+
+int AudioPacer::Shard::LeastLoadedSlot() const {
+  rtc::CritScope cs(&crit_);
+  return static_cast<int>(
+      std::min_element(slots_.begin(), slots_.end(),
+                       [](const std::vector<Client*>& a,
+                          const std::vector<Client*>& b) {
+                         return a.size() < b.size();
+                       }) -
+      slots_.begin());
+}
+
+void AudioPacer::Shard::Add(Client* client, int slot) {
+  rtc::CritScope cs(&crit_);
+  slots_[slot].push_back(client);
+  if (size_++ == 0)
+    wake_.Set();
+}
+
+void AudioPacer::Shard::Remove(Client* client, int slot) {
+  rtc::CritScope cs(&crit_);
+  std::vector<Client*>& clients = slots_[slot];
+  auto it = std::find(clients.begin(), clients.end(), client);
+  RTC_DCHECK(it != clients.end());
+  clients.erase(it);
+  --size_;
+}
+
+void AudioPacer::Shard::WaitForTick() {
+  rtc::CritScope tick(&tick_crit_);
+}
+
+// static
+void AudioPacer::Shard::Run(void* obj) {
+  static_cast<Shard*>(obj)->Loop();
+}
+
+void AudioPacer::Shard::Loop() {
+  int64_t time_ns = rtc::TimeNanos();
+  while (!quit_) {
+    const int64_t deadline_ns = NextDeadlineNs(time_ns);
+    if (deadline_ns < 0) {
+      wake_.Wait(rtc::Event::kForever);
+      time_ns = rtc::TimeNanos();
+      continue;
+    }
+    SleepUntil(deadline_ns);
+    {
+      rtc::CritScope tick(&tick_crit_);
+      {
+        rtc::CritScope cs(&crit_);
+        ticking_ = slots_[(deadline_ns / kSlotNs) % kSlots];
+      }
+      for (Client* client : ticking_)
+        client->OnPacerTick();
+    }
+    // If the ticks overran by more than a period, the slots missed before
+    // that are skipped instead of being ticked in a burst.
+    time_ns = std::max(deadline_ns + 1,
+                       rtc::TimeNanos() - kTickPeriodMs * kSlotNs);
+  }
+}
+
+int64_t AudioPacer::Shard::NextDeadlineNs(int64_t time_ns) const {
+  rtc::CritScope cs(&crit_);
+  const int64_t first_slot = (time_ns + kSlotNs - 1) / kSlotNs;
+  for (int64_t slot = first_slot; slot < first_slot + kSlots; ++slot) {
+    if (!slots_[slot % kSlots].empty())
+      return slot * kSlotNs;
+  }
+  return -1;
+}
+
+void AudioPacer::Shard::SleepUntil(int64_t deadline_ns) {
+#if defined(WEBRTC_POSIX) && !defined(WEBRTC_MAC)
+  // rtc::TimeNanos() reads CLOCK_MONOTONIC here, so the deadline can be
+  // passed on as is.
+  timespec deadline;
+  deadline.tv_sec = deadline_ns / rtc::kNumNanosecsPerSec;
+  deadline.tv_nsec = deadline_ns % rtc::kNumNanosecsPerSec;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) ==
+         EINTR) {
+  }
+#else
+  int64_t remaining_ns;
+  while (!quit_ && (remaining_ns = deadline_ns - rtc::TimeNanos()) > 0) {
+    wake_.Wait(static_cast<int>((remaining_ns + rtc::kNumNanosecsPerMillisec -
+                                 1) /
+                                rtc::kNumNanosecsPerMillisec));
+  }
+#endif
+}
+
+}  // namespace webrtc
@@ -0,0 +1,118 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef PC_TEST_AUDIO_PACER_H_
+#define PC_TEST_AUDIO_PACER_H_
+
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "rtc_base/critical_section.h"
+#include "rtc_base/event.h"
+#include "rtc_base/platform_thread.h"
+#include "rtc_base/thread_annotations.h"
+
+namespace webrtc {
+
+// Calls registered clients every 10 ms from a small set of threads,
+// so that many fake audio devices do not need a thread each. Each thread
+// sleeps until absolute deadlines on the monotonic clock, which keeps the
+// ticks free of drift and of the jitter of relative sleeps.
+//
+// The period is split into 1 ms slots. A thread only wakes up for slots that
+// have clients, so the wakeups scale with the number of threads, not with the
+// number of clients.
+class AudioPacer {
+ public:
+  class Client {
+   public:
+    // Called every kTickPeriodMs on a pacer thread.
+    virtual void OnPacerTick() = 0;
+
+   protected:
+    virtual ~Client() = default;
+  };
+
+  static constexpr int kTickPeriodMs = 10;
+
+  // The process wide pacer, with up to a thread per two cores. Never
+  // destroyed.
+  static AudioPacer* Shared();
+
+  // Runs up to |max_threads| threads at normal priority. A thread is started
+  // when a client registers and all the running ones have clients already.
+  explicit AudioPacer(int max_threads);
+  ~AudioPacer();
+
+  // Starts ticking |client| |phase_ms| (0-9) after multiples of the period on
+  // the rtc::TimeMillis() clock, or in the least loaded slot if |phase_ms| is
+  // negative. Does nothing if |client| is registered already.
+  void Register(Client* client, int phase_ms);
+  // Once this returns, |client| is not ticked anymore. May be called from
+  // the client's own OnPacerTick().
+  void Unregister(Client* client);
+
+ private:
+  static constexpr int kSlots = kTickPeriodMs;
+
+  class Shard {
+   public:
+    Shard();
+    ~Shard();
+
+    // Number of clients, for balancing the shards.
+    int size() const;
+    int LeastLoadedSlot() const;
+    void Add(Client* client, int slot);
+    void Remove(Client* client, int slot);
+    // Returns once a tick running on another thread is done.
+    void WaitForTick();
+
+   private:
+    static void Run(void* obj);
+    void Loop();
+    // Returns the deadline of the first slot with clients at or after
+    // |time_ns|, or -1 if there are no clients.
+    int64_t NextDeadlineNs(int64_t time_ns) const;
+    void SleepUntil(int64_t deadline_ns);
+
+    // Held while clients are ticked. It is never taken with the pacer's
+    // |crit_| held, so clients can unregister from their ticks.
+    rtc::CriticalSection tick_crit_;
+    // The clients of the slot being ticked.
+    std::vector<Client*> ticking_ RTC_GUARDED_BY(tick_crit_);
+    rtc::CriticalSection crit_;
+    std::array<std::vector<Client*>, kSlots> slots_ RTC_GUARDED_BY(crit_);
+    int size_ RTC_GUARDED_BY(crit_);
+    std::atomic<bool> quit_;
+    // Wakes the thread when the first client is added, or to quit.
+    rtc::Event wake_;
+    rtc::PlatformThread thread_;
+  };
+
+  struct Registration {
+    Shard* shard;
+    int slot;
+  };
+
+  const size_t max_shards_;
+  rtc::CriticalSection crit_;
+  std::vector<std::unique_ptr<Shard>> shards_ RTC_GUARDED_BY(crit_);
+  std::map<Client*, Registration> registrations_ RTC_GUARDED_BY(crit_);
+};
+
+}  // namespace webrtc
+
+#endif  // PC_TEST_AUDIO_PACER_H_
@@ -13,9 +13,7 @@
 #include <string.h>
 
 #include "rtc_base/checks.h"
-#include "rtc_base/location.h"
 #include "rtc_base/ref_counted_object.h"
-#include "rtc_base/thread.h"
 #include "rtc_base/time_utils.h"
 
 // Audio sample value that is high enough that it doesn't occur naturally when
@@ -27,17 +25,15 @@ static const int kHighSampleValue = 10000;
 // Constants here are derived by running VoE using a real ADM.
 // The constants correspond to 10ms of mono audio at 44kHz.
 static const int kTimePerFrameMs = 10;
+static_assert(kTimePerFrameMs == webrtc::AudioPacer::kTickPeriodMs,
+              "Frames are processed on every pacer tick");
 static const uint8_t kNumberOfChannels = 1;
 static const int kSamplesPerSecond = 44000;
+static const int kPlayoutSamplesPerSecond = 48000;
 static const int kTotalDelayMs = 0;
 static const int kClockDriftMs = 0;
 static const uint32_t kMaxVolume = 14392;
 
-enum {
-  MSG_START_PROCESS,
-  MSG_RUN_PROCESS,
-};
-
 FakeAudioCaptureModule::FakeAudioCaptureModule()
     : audio_callback_(nullptr),
       recording_(false),
@@ -45,19 +41,25 @@ FakeAudioCaptureModule::FakeAudioCaptureModule()
       play_is_initialized_(false),
       rec_is_initialized_(false),
       current_mic_level_(kMaxVolume),
-      started_(false),
-      next_frame_time_(0),
-      frames_received_(0) {}
+      process_phase_ms_(-1),
+      frames_received_(0),
+      recorded_frames_(nullptr),
+      played_frames_(nullptr),
+      tick_duration_us_(nullptr) {}
 
 FakeAudioCaptureModule::~FakeAudioCaptureModule() {
-  if (process_thread_) {
-    process_thread_->Stop();
-  }
+  webrtc::AudioPacer::Shared()->Unregister(this);
 }
 
 rtc::scoped_refptr<FakeAudioCaptureModule> FakeAudioCaptureModule::Create() {
+  return Create(nullptr);
+}
+
+rtc::scoped_refptr<FakeAudioCaptureModule> FakeAudioCaptureModule::Create(
+    std::unique_ptr<webrtc::FakeAudioSource> source) {
   rtc::scoped_refptr<FakeAudioCaptureModule> capture_module(
       new rtc::RefCountedObject<FakeAudioCaptureModule>());
+  capture_module->source_ = std::move(source);
   if (!capture_module->Initialize()) {
     return nullptr;
   }
@@ -69,6 +71,21 @@ int FakeAudioCaptureModule::frames_received() const {
   return frames_received_;
 }
 
+void FakeAudioCaptureModule::SetProcessPhase(double phase) {
+  RTC_CHECK(phase >= 0 && phase < 1);
+  rtc::CritScope cs(&crit_);
+  process_phase_ms_ = static_cast<int>(phase * kTimePerFrameMs);
+}
+
+void FakeAudioCaptureModule::SetMetricsRegistry(
+    webrtc::test::MetricsRegistry* registry) {
+  rtc::CritScope cs(&crit_);
+  recorded_frames_ = registry->GetCounter("adm_recorded_frames_total");
+  played_frames_ = registry->GetCounter("adm_played_frames_total");
+  tick_duration_us_ = registry->GetHistogram(
+      "adm_tick_duration_us", {100, 250, 500, 1000, 2000, 5000, 10000});
+}
+
 int32_t FakeAudioCaptureModule::ActiveAudioLayer(
     AudioLayer* /*audio_layer*/) const {
   RTC_NOTREACHED();
@@ -362,13 +379,15 @@ int32_t FakeAudioCaptureModule::StereoPlayout(bool* /*enabled*/) const {
 
 int32_t FakeAudioCaptureModule::StereoRecordingIsAvailable(
     bool* available) const {
-  // Keep thing simple. No stereo recording.
-  *available = false;
+  // Keep thing simple. Stereo only if the source is.
+  *available = source_ && source_->num_channels() == 2;
   return 0;
 }
 
 int32_t FakeAudioCaptureModule::SetStereoRecording(bool enable) {
-  if (!enable) {
+  bool available = false;
+  StereoRecordingIsAvailable(&available);
+  if (enable == available) {
     return 0;
   }
   return -1;
@@ -385,21 +404,6 @@ int32_t FakeAudioCaptureModule::PlayoutDelay(uint16_t* delay_ms) const {
   return 0;
 }
 
-void FakeAudioCaptureModule::OnMessage(rtc::Message* msg) {
-  switch (msg->message_id) {
-    case MSG_START_PROCESS:
-      StartProcessP();
-      break;
-    case MSG_RUN_PROCESS:
-      ProcessFrameP();
-      break;
-    default:
-      // All existing messages should be caught. Getting here should never
-      // happen.
-      RTC_NOTREACHED();
-  }
-}
-
 bool FakeAudioCaptureModule::Initialize() {
   // Set the send buffer samples high enough that it would not occur on the
   // remote side unless a packet containing a sample of that magnitude has been
@@ -439,56 +443,36 @@ bool FakeAudioCaptureModule::ShouldStartProcessing() {
 
 void FakeAudioCaptureModule::UpdateProcessing(bool start) {
   if (start) {
-    if (!process_thread_) {
-      process_thread_ = rtc::Thread::Create();
-      process_thread_->Start();
+    int process_phase_ms;
+    {
+      rtc::CritScope cs(&crit_);
+      process_phase_ms = process_phase_ms_;
     }
-    process_thread_->Post(RTC_FROM_HERE, this, MSG_START_PROCESS);
+    webrtc::AudioPacer::Shared()->Register(this, process_phase_ms);
   } else {
-    if (process_thread_) {
-      process_thread_->Stop();
-      process_thread_.reset(nullptr);
-    }
-    started_ = false;
+    webrtc::AudioPacer::Shared()->Unregister(this);
   }
 }
 
-void FakeAudioCaptureModule::StartProcessP() {
-  RTC_CHECK(process_thread_->IsCurrent());
-  if (started_) {
-    // Already started.
-    return;
+void FakeAudioCaptureModule::OnPacerTick() {
+  rtc::CritScope cs(&crit_);
+  const int64_t start_us = tick_duration_us_ ? rtc::TimeMicros() : 0;
+  // Receive and send frames every kTimePerFrameMs.
+  if (playing_) {
+    ReceiveFrameP();
+    if (played_frames_)
+      played_frames_->Add();
   }
-  ProcessFrameP();
-}
-
-void FakeAudioCaptureModule::ProcessFrameP() {
-  RTC_CHECK(process_thread_->IsCurrent());
-  if (!started_) {
-    next_frame_time_ = rtc::TimeMillis();
-    started_ = true;
+  if (recording_) {
+    SendFrameP();
+    if (recorded_frames_)
+      recorded_frames_->Add();
   }
-
-  {
-    rtc::CritScope cs(&crit_);
-    // Receive and send frames every kTimePerFrameMs.
-    if (playing_) {
-      ReceiveFrameP();
-    }
-    if (recording_) {
-      SendFrameP();
-    }
-  }
-
-  next_frame_time_ += kTimePerFrameMs;
-  const int64_t current_time = rtc::TimeMillis();
-  const int64_t wait_time =
-      (next_frame_time_ > current_time) ? next_frame_time_ - current_time : 0;
-  process_thread_->PostDelayed(RTC_FROM_HERE, wait_time, this, MSG_RUN_PROCESS);
+  if (tick_duration_us_)
+    tick_duration_us_->Add(rtc::TimeMicros() - start_us);
 }
 
 void FakeAudioCaptureModule::ReceiveFrameP() {
-  RTC_CHECK(process_thread_->IsCurrent());
   {
     rtc::CritScope cs(&crit_callback_);
     if (!audio_callback_) {
@@ -499,12 +483,12 @@ void FakeAudioCaptureModule::ReceiveFrameP() {
     int64_t elapsed_time_ms = 0;
     int64_t ntp_time_ms = 0;
     if (audio_callback_->NeedMorePlayData(
-            kNumberSamples, kNumberBytesPerSample, kNumberOfChannels,
-            kSamplesPerSecond, rec_buffer_, nSamplesOut, &elapsed_time_ms,
-            &ntp_time_ms) != 0) {
+            kNumberPlayoutSamples, kNumberBytesPerSample, kNumberOfChannels,
+            kPlayoutSamplesPerSecond, rec_buffer_, nSamplesOut,
+            &elapsed_time_ms, &ntp_time_ms) != 0) {
       RTC_NOTREACHED();
     }
-    RTC_CHECK(nSamplesOut == kNumberSamples);
+    RTC_CHECK(nSamplesOut == kNumberPlayoutSamples);
   }
   // The SetBuffer() function ensures that after decoding, the audio buffer
   // should contain samples of similar magnitude (there is likely to be some
@@ -519,7 +503,6 @@ void FakeAudioCaptureModule::ReceiveFrameP() {
 }
 
 void FakeAudioCaptureModule::SendFrameP() {
-  RTC_CHECK(process_thread_->IsCurrent());
   rtc::CritScope cs(&crit_callback_);
   if (!audio_callback_) {
     return;
@@ -527,10 +510,21 @@ void FakeAudioCaptureModule::SendFrameP() {
   bool key_pressed = false;
   uint32_t current_mic_level = 0;
   MicrophoneVolume(&current_mic_level);
+  const void* audio_samples = send_buffer_;
+  size_t samples_per_channel = kNumberSamples;
+  size_t num_channels = kNumberOfChannels;
+  uint32_t samples_per_second = kSamplesPerSecond;
+  if (source_) {
+    audio_samples = source_->Next10MsFrame();
+    samples_per_channel = source_->samples_per_channel();
+    num_channels = source_->num_channels();
+    samples_per_second = source_->sample_rate_hz();
+  }
   if (audio_callback_->RecordedDataIsAvailable(
-          send_buffer_, kNumberSamples, kNumberBytesPerSample,
-          kNumberOfChannels, kSamplesPerSecond, kTotalDelayMs, kClockDriftMs,
-          current_mic_level, key_pressed, current_mic_level) != 0) {
+          audio_samples, samples_per_channel,
+          kNumberBytesPerSample * num_channels, num_channels,
+          samples_per_second, kTotalDelayMs, kClockDriftMs, current_mic_level,
+          key_pressed, current_mic_level) != 0) {
     RTC_NOTREACHED();
   }
   SetMicrophoneVolume(current_mic_level);
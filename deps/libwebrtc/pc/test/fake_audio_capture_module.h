@@ -15,40 +15,55 @@
 // therefore be used in the gtest testing framework.
 
 // Note P postfix of a function indicates that it should only be called by the
-// processing thread.
+// processing thread, which is a thread of the shared webrtc::AudioPacer.
 
 #ifndef PC_TEST_FAKE_AUDIO_CAPTURE_MODULE_H_
 #define PC_TEST_FAKE_AUDIO_CAPTURE_MODULE_H_
 
-#include <memory>
-
 #include "api/scoped_refptr.h"
 #include "modules/audio_device/include/audio_device.h"
+#include "pc/test/audio_pacer.h"
+#include "pc/test/fake_audio_source.h"
 #include "rtc_base/critical_section.h"
-#include "rtc_base/message_handler.h"
-
-namespace rtc {
-class Thread;
-}  // namespace rtc
+#include "test/metrics_registry.h"
 
 class FakeAudioCaptureModule : public webrtc::AudioDeviceModule,
-                               public rtc::MessageHandler {
+                               public webrtc::AudioPacer::Client {
  public:
   typedef uint16_t Sample;
 
   // The value for the following constants have been derived by running VoE
   // using a real ADM. The constants correspond to 10ms of mono audio at 44kHz.
   static const size_t kNumberSamples = 440;
+  // Playout is pulled as 10ms of mono audio at 48kHz, the rate Opus decodes
+  // at, so that received audio is mixed without resampling.
+  static const size_t kNumberPlayoutSamples = 480;
   static const size_t kNumberBytesPerSample = sizeof(Sample);
 
   // Creates a FakeAudioCaptureModule or returns NULL on failure.
   static rtc::scoped_refptr<FakeAudioCaptureModule> Create();
+  // Records audio from |source|, at its sample rate and channel count,
+  // instead of the constant high sample value.
+  static rtc::scoped_refptr<FakeAudioCaptureModule> Create(
+      std::unique_ptr<webrtc::FakeAudioSource> source);
 
   // Returns the number of frames that have been successfully pulled by the
   // instance. Note that correctly detecting success can only be done if the
   // pulled frame was generated/pushed from a FakeAudioCaptureModule.
   int frames_received() const;
 
+  // Processes frames |phase| (in [0, 1)) of a frame after multiples of 10 ms
+  // on the rtc::TimeMillis() clock, so that modules started together with
+  // different phases do not all run at once. Rounded to whole milliseconds.
+  // Takes effect when processing is (re)started. Without a phase, the pacer
+  // picks the least busy millisecond.
+  void SetProcessPhase(double phase);
+
+  // Counts the frames recorded and played out in |registry|, and the time
+  // the audio callbacks take on each tick. |registry| must outlive the
+  // module.
+  void SetMetricsRegistry(webrtc::test::MetricsRegistry* registry);
+
   int32_t ActiveAudioLayer(AudioLayer* audio_layer) const override;
 
   // Note: Calling this method from a callback may result in deadlock.
@@ -142,8 +157,8 @@ class FakeAudioCaptureModule : public webrtc::AudioDeviceModule,
 
   // End of functions inherited from webrtc::AudioDeviceModule.
 
-  // The following function is inherited from rtc::MessageHandler.
-  void OnMessage(rtc::Message* msg) override;
+  // The following function is inherited from webrtc::AudioPacer::Client.
+  void OnPacerTick() override;
 
  protected:
   // The constructor is protected because the class needs to be created as a
@@ -172,14 +187,10 @@ class FakeAudioCaptureModule : public webrtc::AudioDeviceModule,
   // enabled/started.
   bool ShouldStartProcessing();
 
-  // Starts or stops the pushing and pulling of audio frames.
+  // Starts or stops the pushing and pulling of audio frames, by registering
+  // with or unregistering from the pacer.
   void UpdateProcessing(bool start);
 
-  // Starts the periodic calling of ProcessFrame() in a thread safe way.
-  void StartProcessP();
-  // Periodcally called function that ensures that frames are pulled and pushed
-  // periodically if enabled/started.
-  void ProcessFrameP();
   // Pulls frames from the registered webrtc::AudioTransport.
   void ReceiveFrameP();
   // Pushes frames to the registered webrtc::AudioTransport.
@@ -188,6 +199,10 @@ class FakeAudioCaptureModule : public webrtc::AudioDeviceModule,
   // Callback for playout and recording.
   webrtc::AudioTransport* audio_callback_;
 
+  // If set, recorded audio is taken from here instead of send_buffer_. Only
+  // used on the processing thread after creation.
+  std::unique_ptr<webrtc::FakeAudioSource> source_;
+
   bool recording_;  // True when audio is being pushed from the instance.
   bool playing_;    // True when audio is being pulled by the instance.
 
@@ -199,16 +214,12 @@ class FakeAudioCaptureModule : public webrtc::AudioDeviceModule,
   // mic level so it just feeds back what it receives.
   uint32_t current_mic_level_;
 
-  // next_frame_time_ is updated in a non-drifting manner to indicate the next
-  // wall clock time the next frame should be generated and received. started_
-  // ensures that next_frame_time_ can be initialized properly on first call.
-  bool started_;
-  int64_t next_frame_time_;
-
-  std::unique_ptr<rtc::Thread> process_thread_;
+  // Offset of the processing times from multiples of 10 ms, or -1 to leave
+  // it to the pacer.
+  int process_phase_ms_;
 
   // Buffer for storing samples received from the webrtc::AudioTransport.
-  char rec_buffer_[kNumberSamples * kNumberBytesPerSample];
+  char rec_buffer_[kNumberPlayoutSamples * kNumberBytesPerSample];
   // Buffer for samples to send to the webrtc::AudioTransport.
   char send_buffer_[kNumberSamples * kNumberBytesPerSample];
 
@@ -217,10 +228,16 @@ class FakeAudioCaptureModule : public webrtc::AudioDeviceModule,
   // (e.g. by a jitter buffer).
   int frames_received_;
 
-  // Protects variables that are accessed from process_thread_ and
+  // Set with SetMetricsRegistry(), or null. Guarded by |crit_|, which the
+  // pacer ticks hold.
+  webrtc::test::MetricsRegistry::Counter* recorded_frames_;
+  webrtc::test::MetricsRegistry::Counter* played_frames_;
+  webrtc::test::MetricsRegistry::Histogram* tick_duration_us_;
+
+  // Protects variables that are accessed from the pacer thread and
   // the main thread.
   rtc::CriticalSection crit_;
-  // Protects |audio_callback_| that is accessed from process_thread_ and
+  // Protects |audio_callback_| that is accessed from the pacer thread and
   // the main thread.
   rtc::CriticalSection crit_callback_;
 };
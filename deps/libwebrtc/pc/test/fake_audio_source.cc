@@ -0,0 +1,528 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "pc/test/fake_audio_source.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(WEBRTC_POSIX)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <stdio.h>
+#endif
+
+#include "rtc_base/checks.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/numerics/safe_conversions.h"
+#include "rtc_base/random.h"
+
+namespace webrtc {
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+
+// Read-only view of a whole file, memory mapped where possible.
+class MappedFile {
+ public:
+  static std::unique_ptr<MappedFile> Open(const std::string& path) {
+    std::unique_ptr<MappedFile> file(new MappedFile());
+#if defined(WEBRTC_POSIX)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return nullptr;
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0) {
+      close(fd);
+      return nullptr;
+    }
+    void* data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd,
+                      /*offset=*/0);
+    // The mapping keeps the file open.
+    close(fd);
+    if (data == MAP_FAILED)
+      return nullptr;
+    file->data_ = static_cast<const uint8_t*>(data);
+    file->size_ = file_stat.st_size;
+#else
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f)
+      return nullptr;
+    uint8_t chunk[4096];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), f)) > 0)
+      file->contents_.insert(file->contents_.end(), chunk, chunk + read);
+    fclose(f);
+    if (file->contents_.empty())
+      return nullptr;
+    file->data_ = file->contents_.data();
+    file->size_ = file->contents_.size();
+#endif
+    return file;
+  }
+
+  ~MappedFile() {
+#if defined(WEBRTC_POSIX)
+    if (data_)
+      munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+  }
+
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  MappedFile() = default;
+
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+#if !defined(WEBRTC_POSIX)
+  std::vector<uint8_t> contents_;
+#endif
+};
+
+uint16_t ReadLittleEndian16(const uint8_t* data) {
+  return data[0] | data[1] << 8;
+}
+
+uint32_t ReadLittleEndian32(const uint8_t* data) {
+  return data[0] | data[1] << 8 | data[2] << 16 |
+         static_cast<uint32_t>(data[3]) << 24;
+}
+
+// Returns true for the formats all sources support, logging the others with
+// |what| as the prefix.
+bool IsSupportedFormat(const std::string& what,
+                       int sample_rate_hz,
+                       size_t num_channels) {
+  if (sample_rate_hz < 8000 || sample_rate_hz % 100 != 0 ||
+      num_channels == 0 || num_channels > 2) {
+    RTC_LOG(LS_ERROR) << what << ": unsupported format " << sample_rate_hz
+                      << " Hz, " << num_channels << " channels";
+    return false;
+  }
+  return true;
+}
+
+class FileAudioSource : public FakeAudioSource {
+ public:
+  // Plays the |num_samples| samples at |samples|, which point into |file|.
+  FileAudioSource(std::unique_ptr<MappedFile> file,
+                  const int16_t* samples,
+                  size_t num_samples,
+                  int sample_rate_hz,
+                  size_t num_channels)
+      : file_(std::move(file)),
+        samples_(samples),
+        sample_rate_hz_(sample_rate_hz),
+        num_channels_(num_channels),
+        frame_size_(samples_per_channel() * num_channels),
+        num_frames_(num_samples / frame_size_),
+        next_frame_(0) {
+    RTC_DCHECK_GT(num_frames_, 0);
+  }
+
+  int sample_rate_hz() const override { return sample_rate_hz_; }
+  size_t num_channels() const override { return num_channels_; }
+
+  const int16_t* Next10MsFrame() override {
+    const int16_t* frame = samples_ + next_frame_ * frame_size_;
+    if (++next_frame_ == num_frames_)
+      next_frame_ = 0;
+    return frame;
+  }
+
+ private:
+  const std::unique_ptr<MappedFile> file_;
+  const int16_t* const samples_;
+  const int sample_rate_hz_;
+  const size_t num_channels_;
+  const size_t frame_size_;
+  const size_t num_frames_;
+  size_t next_frame_;
+};
+
+// Checks the layout of |data_size| bytes of samples at |data| and creates a
+// source playing them.
+std::unique_ptr<FakeAudioSource> CreateFileAudioSource(
+    std::unique_ptr<MappedFile> file,
+    const std::string& path,
+    size_t data_offset,
+    size_t data_size,
+    int sample_rate_hz,
+    size_t num_channels) {
+  if (!IsSupportedFormat(path, sample_rate_hz, num_channels))
+    return nullptr;
+  // Samples must be aligned to be read in place.
+  if (data_offset % sizeof(int16_t) != 0) {
+    RTC_LOG(LS_ERROR) << path << ": samples are not 16 bit aligned";
+    return nullptr;
+  }
+  const size_t num_samples =
+      std::min(data_size, file->size() - data_offset) / sizeof(int16_t);
+  if (num_samples < sample_rate_hz / 100 * num_channels) {
+    RTC_LOG(LS_ERROR) << path << ": shorter than 10 ms";
+    return nullptr;
+  }
+  const int16_t* samples =
+      reinterpret_cast<const int16_t*>(file->data() + data_offset);
+  return std::make_unique<FileAudioSource>(std::move(file), samples,
+                                           num_samples, sample_rate_hz,
+                                           num_channels);
+}
+
+class ToneAudioSource : public FakeAudioSource {
+ public:
+  ToneAudioSource(int sample_rate_hz,
+                  size_t num_channels,
+                  double frequency_hz,
+                  int amplitude)
+      : sample_rate_hz_(sample_rate_hz),
+        num_channels_(num_channels),
+        phase_increment_(frequency_hz / sample_rate_hz),
+        amplitude_(amplitude),
+        phase_(0),
+        frame_(samples_per_channel() * num_channels) {}
+
+  int sample_rate_hz() const override { return sample_rate_hz_; }
+  size_t num_channels() const override { return num_channels_; }
+
+  const int16_t* Next10MsFrame() override {
+    for (size_t i = 0; i < frame_.size(); i += num_channels_) {
+      const int16_t sample = static_cast<int16_t>(
+          std::lround(amplitude_ * std::sin(2 * kPi * phase_)));
+      std::fill_n(&frame_[i], num_channels_, sample);
+      phase_ += phase_increment_;
+      if (phase_ >= 1)
+        phase_ -= 1;
+    }
+    return frame_.data();
+  }
+
+ private:
+  const int sample_rate_hz_;
+  const size_t num_channels_;
+  const double phase_increment_;
+  const double amplitude_;
+  double phase_;
+  std::vector<int16_t> frame_;
+};
+
+class SpeechLikeAudioSource : public FakeAudioSource {
+ public:
+  SpeechLikeAudioSource(int sample_rate_hz, size_t num_channels, uint32_t seed)
+      : sample_rate_hz_(sample_rate_hz),
+        num_channels_(num_channels),
+        random_(static_cast<uint64_t>(seed) + 1),
+        base_pitch_hz_(random_.Rand(100, 220)),
+        pitch_hz_(base_pitch_hz_),
+        target_pitch_hz_(base_pitch_hz_),
+        phase_(0),
+        talking_(false),
+        segment_frames_left_(0),
+        syllable_frames_(0),
+        syllable_frame_(0),
+        unvoiced_frames_(0),
+        voiced_amplitude_(0),
+        noise_amplitude_(kNoiseFloor),
+        pulse_(kPulseTableSize + 1),
+        frame_(samples_per_channel() * num_channels) {}
+
+  int sample_rate_hz() const override { return sample_rate_hz_; }
+  size_t num_channels() const override { return num_channels_; }
+
+  const int16_t* Next10MsFrame() override {
+    const double start_voiced_amplitude = voiced_amplitude_;
+    const double start_noise_amplitude = noise_amplitude_;
+    UpdateProsody();
+    // Amplitudes ramp over the frame, so steps don't click.
+    const size_t samples = samples_per_channel();
+    const double voiced_step =
+        (voiced_amplitude_ - start_voiced_amplitude) / samples;
+    const double noise_step =
+        (noise_amplitude_ - start_noise_amplitude) / samples;
+    const double phase_increment = pitch_hz_ / sample_rate_hz_;
+    for (size_t i = 0; i < samples; ++i) {
+      const double position = phase_ * kPulseTableSize;
+      const int index = static_cast<int>(position);
+      const double fraction = position - index;
+      const double pulse =
+          pulse_[index] + fraction * (pulse_[index + 1] - pulse_[index]);
+      const double noise = 2 * random_.Rand<float>() - 1;
+      const double sample =
+          (start_voiced_amplitude + voiced_step * i) * pulse +
+          (start_noise_amplitude + noise_step * i) * noise;
+      std::fill_n(&frame_[i * num_channels_], num_channels_,
+                  rtc::saturated_cast<int16_t>(sample));
+      phase_ += phase_increment;
+      if (phase_ >= 1)
+        phase_ -= 1;
+    }
+    return frame_.data();
+  }
+
+ private:
+  static constexpr int kPulseTableSize = 1024;
+  static constexpr double kPeakAmplitude = 12000;
+  // Background noise in pauses, roughly -60 dBFS.
+  static constexpr double kNoiseFloor = 30;
+
+  // Advances talkspurts, pauses and syllables by one 10 ms frame.
+  void UpdateProsody() {
+    if (segment_frames_left_-- <= 0) {
+      talking_ = !talking_;
+      // Talkspurts of 1-3 s and pauses of 0.3-1.5 s.
+      segment_frames_left_ =
+          talking_ ? random_.Rand(100, 300) : random_.Rand(30, 150);
+      syllable_frame_ = syllable_frames_ = 0;
+    }
+    if (!talking_) {
+      voiced_amplitude_ = 0;
+      noise_amplitude_ = kNoiseFloor;
+      return;
+    }
+    if (syllable_frame_ == syllable_frames_)
+      StartSyllable();
+    ++syllable_frame_;
+    if (syllable_frame_ <= unvoiced_frames_) {
+      // A fricative before the vowel.
+      voiced_amplitude_ = 0;
+      noise_amplitude_ = 0.15 * kPeakAmplitude;
+    } else {
+      const double position =
+          static_cast<double>(syllable_frame_ - unvoiced_frames_) /
+          (syllable_frames_ - unvoiced_frames_ + 1);
+      voiced_amplitude_ = kPeakAmplitude * std::sin(kPi * position);
+      noise_amplitude_ = kNoiseFloor;
+    }
+    // Pitch glides towards the syllable's target, with a slight vibrato.
+    pitch_hz_ += 0.1 * (target_pitch_hz_ - pitch_hz_);
+    pitch_hz_ *= 1 + 0.01 * std::sin(2 * kPi * syllable_frame_ / 20.0);
+  }
+
+  void StartSyllable() {
+    // 150-300 ms syllables.
+    syllable_frames_ = random_.Rand(15, 30);
+    syllable_frame_ = 0;
+    unvoiced_frames_ = random_.Rand(0, 3) == 0 ? random_.Rand(2, 5) : 0;
+    target_pitch_hz_ = base_pitch_hz_ * (0.85 + 0.3 * random_.Rand<float>());
+    BuildPulse(random_.Rand(300, 800), random_.Rand(900, 2300));
+  }
+
+  // Fills |pulse_| with one period of a glottal pulse filtered by formants at
+  // |f1_hz| and |f2_hz|: harmonics with a 1/k roll-off, boosted near the
+  // formants.
+  void BuildPulse(double f1_hz, double f2_hz) {
+    const double max_pitch_hz = 1.3 * base_pitch_hz_;
+    const int harmonics = std::max(
+        1, static_cast<int>(std::min(3800.0, 0.45 * sample_rate_hz_) /
+                            max_pitch_hz));
+    std::fill(pulse_.begin(), pulse_.end(), 0.f);
+    for (int k = 1; k <= harmonics; ++k) {
+      const double frequency_hz = k * base_pitch_hz_;
+      const double f1_distance = (frequency_hz - f1_hz) / 150;
+      const double f2_distance = (frequency_hz - f2_hz) / 200;
+      const double gain = (1 + 4 * std::exp(-f1_distance * f1_distance) +
+                           3 * std::exp(-f2_distance * f2_distance)) /
+                          k;
+      for (int i = 0; i < kPulseTableSize; ++i)
+        pulse_[i] += gain * std::sin(2 * kPi * k * i / kPulseTableSize);
+    }
+    float peak = 0;
+    for (int i = 0; i < kPulseTableSize; ++i)
+      peak = std::max(peak, std::abs(pulse_[i]));
+    for (int i = 0; i < kPulseTableSize; ++i)
+      pulse_[i] /= peak;
+    // The extra entry lets interpolation read past the end of the period.
+    pulse_[kPulseTableSize] = pulse_[0];
+  }
+
+  const int sample_rate_hz_;
+  const size_t num_channels_;
+  Random random_;
+  const double base_pitch_hz_;
+  double pitch_hz_;
+  double target_pitch_hz_;
+  double phase_;
+  bool talking_;
+  int segment_frames_left_;
+  int syllable_frames_;
+  int syllable_frame_;
+  int unvoiced_frames_;
+  double voiced_amplitude_;
+  double noise_amplitude_;
+  std::vector<float> pulse_;
+  std::vector<int16_t> frame_;
+};
+
+constexpr int SpeechLikeAudioSource::kPulseTableSize;
+constexpr double SpeechLikeAudioSource::kPeakAmplitude;
+constexpr double SpeechLikeAudioSource::kNoiseFloor;
+
+}  // namespace
+
+std::unique_ptr<FakeAudioSource> CreateWavFileAudioSource(
+    const std::string& path) {
+  std::unique_ptr<MappedFile> file = MappedFile::Open(path);
+  if (!file) {
+    RTC_LOG(LS_ERROR) << "Could not open " << path;
+    return nullptr;
+  }
+  const uint8_t* data = file->data();
+  const size_t size = file->size();
+  if (size < 12 || memcmp(data, "RIFF", 4) != 0 ||
+      memcmp(data + 8, "WAVE", 4) != 0) {
+    RTC_LOG(LS_ERROR) << path << ": not a WAV file";
+    return nullptr;
+  }
+  int sample_rate_hz = 0;
+  size_t num_channels = 0;
+  bool found_format = false;
+  size_t offset = 12;
+  while (offset + 8 <= size) {
+    const uint8_t* chunk = data + offset;
+    const size_t chunk_size = ReadLittleEndian32(chunk + 4);
+    if (memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16 &&
+        offset + 8 + chunk_size <= size) {
+      const uint16_t format_tag = ReadLittleEndian16(chunk + 8);
+      constexpr uint16_t kWaveFormatPcm = 1;
+      constexpr uint16_t kWaveFormatExtensible = 0xFFFE;
+      // The extensible format holds the actual tag in its sub format GUID.
+      const bool pcm = format_tag == kWaveFormatPcm ||
+                       (format_tag == kWaveFormatExtensible &&
+                        chunk_size >= 40 &&
+                        ReadLittleEndian16(chunk + 32) == kWaveFormatPcm);
+      const uint16_t bits_per_sample = ReadLittleEndian16(chunk + 22);
+      if (!pcm || bits_per_sample != 16) {
+        RTC_LOG(LS_ERROR) << path << ": only 16 bit PCM is supported";
+        return nullptr;
+      }
+      num_channels = ReadLittleEndian16(chunk + 10);
+      sample_rate_hz = ReadLittleEndian32(chunk + 12);
+      found_format = true;
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      if (!found_format)
+        break;
+      return CreateFileAudioSource(std::move(file), path, offset + 8,
+                                   chunk_size, sample_rate_hz, num_channels);
+    }
+    // Chunks are padded to an even size.
+    offset += 8 + chunk_size + (chunk_size & 1);
+  }
+  RTC_LOG(LS_ERROR) << path << ": no format or data chunk";
+  return nullptr;
+}
+
+std::unique_ptr<FakeAudioSource> CreateRawFileAudioSource(
+    const std::string& path,
+    int sample_rate_hz,
+    size_t num_channels) {
+  std::unique_ptr<MappedFile> file = MappedFile::Open(path);
+  if (!file) {
+    RTC_LOG(LS_ERROR) << "Could not open " << path;
+    return nullptr;
+  }
+  const size_t size = file->size();
+  return CreateFileAudioSource(std::move(file), path, /*data_offset=*/0, size,
+                               sample_rate_hz, num_channels);
+}
+
+std::unique_ptr<FakeAudioSource> CreateToneAudioSource(int sample_rate_hz,
+                                                       size_t num_channels,
+                                                       double frequency_hz,
+                                                       int amplitude) {
+  if (!IsSupportedFormat("tone", sample_rate_hz, num_channels))
+    return nullptr;
+  return std::make_unique<ToneAudioSource>(sample_rate_hz, num_channels,
+                                           frequency_hz, amplitude);
+}
+
+std::unique_ptr<FakeAudioSource> CreateSpeechLikeAudioSource(
+    int sample_rate_hz,
+    size_t num_channels,
+    uint32_t seed) {
+  if (!IsSupportedFormat("speech", sample_rate_hz, num_channels))
+    return nullptr;
+  return std::make_unique<SpeechLikeAudioSource>(sample_rate_hz, num_channels,
+                                                 seed);
+}
+
+std::unique_ptr<PushAudioSource> PushAudioSource::Create(int sample_rate_hz,
+                                                         size_t num_channels,
+                                                         int max_buffer_ms) {
+  if (!IsSupportedFormat("push", sample_rate_hz, num_channels))
+    return nullptr;
+  return std::unique_ptr<PushAudioSource>(
+      new PushAudioSource(sample_rate_hz, num_channels, max_buffer_ms));
+}
+
+PushAudioSource::PushAudioSource(int sample_rate_hz,
+                                 size_t num_channels,
+                                 int max_buffer_ms)
+    : sample_rate_hz_(sample_rate_hz),
+      num_channels_(num_channels),
+      buffer_(std::max<size_t>(max_buffer_ms / 10, 1) *
+              samples_per_channel() * num_channels),
+      read_pos_(0),
+      buffered_(0),
+      frame_(samples_per_channel() * num_channels) {}
+
+PushAudioSource::~PushAudioSource() = default;
+
+void PushAudioSource::Push(const int16_t* data, size_t samples_per_channel) {
+  size_t num_samples = samples_per_channel * num_channels_;
+  rtc::CritScope cs(&crit_);
+  const size_t capacity = buffer_.size();
+  // Only the newest |capacity| samples can be kept.
+  if (num_samples > capacity) {
+    data += num_samples - capacity;
+    num_samples = capacity;
+  }
+  const size_t overflow =
+      std::max(buffered_ + num_samples, capacity) - capacity;
+  read_pos_ = (read_pos_ + overflow) % capacity;
+  buffered_ -= overflow;
+  size_t write_pos = (read_pos_ + buffered_) % capacity;
+  const size_t first_part = std::min(num_samples, capacity - write_pos);
+  std::copy(data, data + first_part, buffer_.begin() + write_pos);
+  std::copy(data + first_part, data + num_samples, buffer_.begin());
+  buffered_ += num_samples;
+}
+
+int PushAudioSource::sample_rate_hz() const {
+  return sample_rate_hz_;
+}
+
+size_t PushAudioSource::num_channels() const {
+  return num_channels_;
+}
+
+const int16_t* PushAudioSource::Next10MsFrame() {
+  rtc::CritScope cs(&crit_);
+  if (buffered_ < frame_.size()) {
+    std::fill(frame_.begin(), frame_.end(), 0);
+    return frame_.data();
+  }
+  const size_t capacity = buffer_.size();
+  const size_t first_part = std::min(frame_.size(), capacity - read_pos_);
+  std::copy_n(buffer_.begin() + read_pos_, first_part, frame_.begin());
+  std::copy_n(buffer_.begin(), frame_.size() - first_part,
+              frame_.begin() + first_part);
+  read_pos_ = (read_pos_ + frame_.size()) % capacity;
+  buffered_ -= frame_.size();
+  return frame_.data();
+}
+
+}  // namespace webrtc
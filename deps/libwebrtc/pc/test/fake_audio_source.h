@@ -0,0 +1,108 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef PC_TEST_FAKE_AUDIO_SOURCE_H_
+#define PC_TEST_FAKE_AUDIO_SOURCE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rtc_base/critical_section.h"
+#include "rtc_base/thread_annotations.h"
+
+namespace webrtc {
+
+// Audio recorded by FakeAudioCaptureModule, 10 ms at a time, instead of its
+// constant buffer.
+class FakeAudioSource {
+ public:
+  virtual ~FakeAudioSource() = default;
+
+  virtual int sample_rate_hz() const = 0;
+  virtual size_t num_channels() const = 0;
+  size_t samples_per_channel() const { return sample_rate_hz() / 100; }
+
+  // Returns the next 10 ms of interleaved samples. The data stays valid until
+  // the next call.
+  virtual const int16_t* Next10MsFrame() = 0;
+};
+
+// Loops a 16 bit PCM WAV file. The file is memory mapped and frames point
+// into the mapping, so samples are never copied. A tail shorter than 10 ms is
+// not played. Returns nullptr if the file can't be read or is not 16 bit PCM.
+std::unique_ptr<FakeAudioSource> CreateWavFileAudioSource(
+    const std::string& path);
+// Same as above, for a headerless file of interleaved 16 bit little endian
+// samples.
+std::unique_ptr<FakeAudioSource> CreateRawFileAudioSource(
+    const std::string& path,
+    int sample_rate_hz,
+    size_t num_channels);
+
+// The generated sources below take 1 or 2 channels at a rate of at least
+// 8000 Hz that is a multiple of 100 Hz, like the files above, and return
+// nullptr for other formats.
+
+// A sine tone with peak |amplitude|, the same on all channels.
+std::unique_ptr<FakeAudioSource> CreateToneAudioSource(int sample_rate_hz,
+                                                       size_t num_channels,
+                                                       double frequency_hz,
+                                                       int amplitude = 8000);
+
+// Synthetic speech: talkspurts of voiced syllables with a wandering pitch
+// and changing formants, separated by pauses, with bursts of unvoiced noise.
+// Unlike a tone or constant samples, it exercises an Opus encoder's VAD, DTX
+// and variable bitrate the way a talking person does.
+std::unique_ptr<FakeAudioSource> CreateSpeechLikeAudioSource(
+    int sample_rate_hz,
+    size_t num_channels,
+    uint32_t seed = 1);
+
+// Plays out audio the application pushes, e.g. from a decoder or another
+// process. Push() may be called on any thread. When there is less than
+// 10 ms buffered, silence is recorded.
+class PushAudioSource : public FakeAudioSource {
+ public:
+  // Buffers up to |max_buffer_ms| of audio; the oldest audio is dropped when
+  // pushing more.
+  static std::unique_ptr<PushAudioSource> Create(int sample_rate_hz,
+                                                 size_t num_channels,
+                                                 int max_buffer_ms = 500);
+  ~PushAudioSource() override;
+
+  // |data| holds |samples_per_channel| interleaved samples per channel at
+  // the source's rate and channel count.
+  void Push(const int16_t* data, size_t samples_per_channel);
+
+  int sample_rate_hz() const override;
+  size_t num_channels() const override;
+  const int16_t* Next10MsFrame() override;
+
+ private:
+  PushAudioSource(int sample_rate_hz, size_t num_channels, int max_buffer_ms);
+
+  const int sample_rate_hz_;
+  const size_t num_channels_;
+  rtc::CriticalSection crit_;
+  // Ring buffer of interleaved samples.
+  std::vector<int16_t> buffer_ RTC_GUARDED_BY(crit_);
+  size_t read_pos_ RTC_GUARDED_BY(crit_);
+  size_t buffered_ RTC_GUARDED_BY(crit_);
+  // Only used by Next10MsFrame().
+  std::vector<int16_t> frame_;
+};
+
+}  // namespace webrtc
+
+#endif  // PC_TEST_FAKE_AUDIO_SOURCE_H_
@@ -0,0 +1,92 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "pc/test/freeze_detector.h"
+
+#include <algorithm>
+
+#include "rtc_base/time_utils.h"
+
+namespace webrtc {
+
+constexpr size_t FreezeDetector::kAverageWindow;
+constexpr int64_t FreezeDetector::kMinFreezeExtraMs;
+constexpr int64_t FreezeDetector::kFreezeFactor;
+
+FreezeDetector::FreezeDetector(test::MetricsRegistry* registry,
+                               const std::string& prefix)
+    : intervals_ms_(),
+      interval_index_(0),
+      num_intervals_(0),
+      interval_sum_ms_(0),
+      last_frame_ms_(-1),
+      threshold_ms_(-1),
+      freeze_count_(registry->GetCounter(prefix + "freezes_total")),
+      total_frozen_ms_(registry->GetCounter(prefix + "frozen_ms_total")),
+      longest_freeze_ms_(registry->GetGauge(prefix + "longest_freeze_ms")) {}
+
+FreezeDetector::~FreezeDetector() = default;
+
+int64_t FreezeDetector::FreezeThresholdMs(int64_t expected_interval_ms) {
+  return std::max(kFreezeFactor * expected_interval_ms,
+                  expected_interval_ms + kMinFreezeExtraMs);
+}
+
+int64_t FreezeDetector::OnFrame(int64_t expected_interval_ms) {
+  const int64_t now_ms = rtc::TimeMillis();
+  const int64_t last_frame_ms =
+      last_frame_ms_.exchange(now_ms, std::memory_order_relaxed);
+  int64_t freeze_ms = 0;
+  if (last_frame_ms >= 0) {
+    const int64_t gap_ms = now_ms - last_frame_ms;
+    const int64_t threshold_ms = threshold_ms_.load(std::memory_order_relaxed);
+    if (threshold_ms >= 0 && gap_ms >= threshold_ms) {
+      freeze_ms = gap_ms;
+      freeze_count_->Add();
+      total_frozen_ms_->Add(gap_ms);
+      if (gap_ms > longest_freeze_ms_->value())
+        longest_freeze_ms_->Set(gap_ms);
+    } else {
+      // Freezes would inflate the average and hide the next ones.
+      interval_sum_ms_ += gap_ms - intervals_ms_[interval_index_];
+      intervals_ms_[interval_index_] = gap_ms;
+      interval_index_ = (interval_index_ + 1) % kAverageWindow;
+      num_intervals_ = std::min(num_intervals_ + 1, kAverageWindow);
+    }
+  }
+
+  if (expected_interval_ms <= 0 && num_intervals_ == kAverageWindow)
+    expected_interval_ms = interval_sum_ms_ / kAverageWindow;
+  if (expected_interval_ms > 0) {
+    threshold_ms_.store(FreezeThresholdMs(expected_interval_ms),
+                        std::memory_order_relaxed);
+  }
+  return freeze_ms;
+}
+
+FreezeDetector::Stats FreezeDetector::GetStats() const {
+  Stats stats;
+  stats.freeze_count = freeze_count_->value();
+  stats.total_frozen_ms = total_frozen_ms_->value();
+  stats.longest_freeze_ms = longest_freeze_ms_->value();
+  const int64_t last_frame_ms = last_frame_ms_.load(std::memory_order_relaxed);
+  const int64_t threshold_ms = threshold_ms_.load(std::memory_order_relaxed);
+  if (last_frame_ms >= 0 && threshold_ms >= 0) {
+    const int64_t gap_ms = rtc::TimeMillis() - last_frame_ms;
+    if (gap_ms >= threshold_ms) {
+      stats.current_freeze_ms = gap_ms;
+      stats.total_frozen_ms += gap_ms;
+      stats.longest_freeze_ms = std::max(stats.longest_freeze_ms, gap_ms);
+    }
+  }
+  return stats;
+}
+
+}  // namespace webrtc
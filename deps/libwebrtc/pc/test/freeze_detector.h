@@ -0,0 +1,86 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef PC_TEST_FREEZE_DETECTOR_H_
+#define PC_TEST_FREEZE_DETECTOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <string>
+
+#include "test/metrics_registry.h"
+
+namespace webrtc {
+
+// Detects freezes in a stream of frames from the times they arrive. As in
+// the receive statistics of the video engine, a gap between two frames is a
+// freeze when it is at least 3 times the expected interval, and at least
+// 150 ms longer. The expected interval is either given with each frame
+// (audio frames have a fixed duration) or the average of the last 30 gaps
+// that were not freezes.
+//
+// The freezes that ended are metrics of a test::MetricsRegistry, named with a
+// prefix: the counters <prefix>freezes_total and <prefix>frozen_ms_total,
+// and the gauge <prefix>longest_freeze_ms.
+//
+// OnFrame() is called on the thread delivering frames and never logs or
+// allocates; GetStats() may be called on any thread.
+class FreezeDetector {
+ public:
+  struct Stats {
+    uint64_t freeze_count = 0;
+    // Including an ongoing freeze, once it is longer than the threshold.
+    int64_t total_frozen_ms = 0;
+    int64_t longest_freeze_ms = 0;
+    // The stream has been frozen for this long and no frame has ended the
+    // freeze yet; 0 if it is not frozen. Counted in |freeze_count| once a
+    // frame arrives.
+    int64_t current_freeze_ms = 0;
+  };
+
+  FreezeDetector(test::MetricsRegistry* registry, const std::string& prefix);
+  ~FreezeDetector();
+
+  // |expected_interval_ms| of 0 uses the average of the last gaps. Returns
+  // the length of the freeze this frame ended, or 0.
+  int64_t OnFrame(int64_t expected_interval_ms = 0);
+
+  Stats GetStats() const;
+
+ private:
+  static constexpr size_t kAverageWindow = 30;
+  static constexpr int64_t kMinFreezeExtraMs = 150;
+  static constexpr int64_t kFreezeFactor = 3;
+
+  static int64_t FreezeThresholdMs(int64_t expected_interval_ms);
+
+  // Only used by OnFrame().
+  std::array<int64_t, kAverageWindow> intervals_ms_;
+  size_t interval_index_;
+  size_t num_intervals_;
+  int64_t interval_sum_ms_;
+
+  // Read by GetStats() for the ongoing freeze.
+  std::atomic<int64_t> last_frame_ms_;
+  // Freeze threshold for the gap after the last frame; -1 before the
+  // expected interval is known.
+  std::atomic<int64_t> threshold_ms_;
+
+  test::MetricsRegistry::Counter* const freeze_count_;
+  test::MetricsRegistry::Counter* const total_frozen_ms_;
+  test::MetricsRegistry::Gauge* const longest_freeze_ms_;
+};
+
+}  // namespace webrtc
+
+#endif  // PC_TEST_FREEZE_DETECTOR_H_
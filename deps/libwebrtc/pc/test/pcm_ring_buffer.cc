@@ -0,0 +1,148 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "pc/test/pcm_ring_buffer.h"
+
+#include <string.h>
+
+#include "rtc_base/checks.h"
+#include "rtc_base/time_utils.h"
+
+namespace webrtc {
+
+PcmRingBuffer::PcmRingBuffer(size_t capacity,
+                             size_t max_samples_per_frame,
+                             OverflowPolicy policy)
+    : capacity_(capacity),
+      max_samples_per_frame_(max_samples_per_frame),
+      policy_(policy),
+      slots_(new Slot[capacity]),
+      samples_(new int16_t[capacity * max_samples_per_frame]),
+      write_position_(0),
+      read_position_(0),
+      frames_written_(0),
+      frames_read_(0),
+      frames_dropped_(0),
+      frames_too_large_(0),
+      frames_evicted_(0) {
+  RTC_CHECK_GT(capacity, 0);
+  for (size_t i = 0; i < capacity_; ++i)
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+PcmRingBuffer::~PcmRingBuffer() = default;
+
+bool PcmRingBuffer::Write(const int16_t* data,
+                          size_t samples_per_channel,
+                          size_t num_channels,
+                          int sample_rate_hz) {
+  const size_t num_samples = samples_per_channel * num_channels;
+  if (num_samples > max_samples_per_frame_) {
+    frames_too_large_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  const size_t position = write_position_;
+  Slot& slot = slots_[position % capacity_];
+  if (slot.sequence.load(std::memory_order_acquire) != position) {
+    // Full. Dropping the oldest frame frees the slot we need, unless the
+    // consumer is still reading it; then the next oldest must stay too.
+    const size_t oldest = position - capacity_;
+    if (policy_ == OverflowPolicy::kDropOldest && ClaimOldest(oldest)) {
+      Release(oldest);
+      frames_dropped_.fetch_add(1, std::memory_order_relaxed);
+      frames_evicted_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (slot.sequence.load(std::memory_order_acquire) != position) {
+      frames_dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+  }
+
+  memcpy(SlotData(position), data, num_samples * sizeof(int16_t));
+  slot.samples_per_channel = samples_per_channel;
+  slot.num_channels = num_channels;
+  slot.sample_rate_hz = sample_rate_hz;
+  slot.timestamp_ms = rtc::TimeMillis();
+  slot.sequence.store(position + 1, std::memory_order_release);
+  write_position_ = position + 1;
+  frames_written_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+bool PcmRingBuffer::Read(Frame* frame) {
+  size_t position;
+  if (!Claim(&position))
+    return false;
+
+  const Slot& slot = slots_[position % capacity_];
+  const int16_t* data = SlotData(position);
+  frame->data.assign(data, data + slot.samples_per_channel * slot.num_channels);
+  frame->samples_per_channel = slot.samples_per_channel;
+  frame->num_channels = slot.num_channels;
+  frame->sample_rate_hz = slot.sample_rate_hz;
+  frame->timestamp_ms = slot.timestamp_ms;
+  Release(position);
+  frames_read_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+size_t PcmRingBuffer::size() const {
+  const uint64_t written = frames_written_.load(std::memory_order_relaxed);
+  const uint64_t removed = frames_read_.load(std::memory_order_relaxed) +
+                           frames_evicted_.load(std::memory_order_relaxed);
+  return written > removed ? static_cast<size_t>(written - removed) : 0;
+}
+
+PcmRingBuffer::Stats PcmRingBuffer::GetStats() const {
+  Stats stats;
+  stats.frames_written = frames_written_.load(std::memory_order_relaxed);
+  stats.frames_read = frames_read_.load(std::memory_order_relaxed);
+  stats.frames_dropped = frames_dropped_.load(std::memory_order_relaxed);
+  stats.frames_too_large = frames_too_large_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+bool PcmRingBuffer::Claim(size_t* position) {
+  size_t read = read_position_.load(std::memory_order_relaxed);
+  while (true) {
+    const size_t sequence =
+        slots_[read % capacity_].sequence.load(std::memory_order_acquire);
+    if (sequence != read + 1) {
+      // Either empty, or the other side claimed |read| and moved on.
+      if (static_cast<ptrdiff_t>(sequence - (read + 1)) < 0)
+        return false;
+      read = read_position_.load(std::memory_order_relaxed);
+      continue;
+    }
+    if (read_position_.compare_exchange_weak(read, read + 1,
+                                             std::memory_order_relaxed)) {
+      *position = read;
+      return true;
+    }
+  }
+}
+
+bool PcmRingBuffer::ClaimOldest(size_t position) {
+  if (slots_[position % capacity_].sequence.load(std::memory_order_acquire) !=
+      position + 1) {
+    return false;
+  }
+  size_t read = position;
+  return read_position_.compare_exchange_strong(read, position + 1,
+                                                std::memory_order_relaxed);
+}
+
+void PcmRingBuffer::Release(size_t position) {
+  slots_[position % capacity_].sequence.store(position + capacity_,
+                                              std::memory_order_release);
+}
+
+}  // namespace webrtc
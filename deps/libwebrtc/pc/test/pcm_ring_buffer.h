@@ -0,0 +1,129 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef PC_TEST_PCM_RING_BUFFER_H_
+#define PC_TEST_PCM_RING_BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace webrtc {
+
+// Bounded queue of audio frames from one producer thread to one consumer
+// thread, without locks. All memory is allocated up front, so Write() is a
+// single copy that never blocks or allocates, and can be called from the
+// audio thread.
+//
+// Each slot carries a sequence number telling whether it is free or filled
+// for a given position (as in D. Vyukov's bounded queue), so the producer
+// can also drop the oldest frame when full without racing with a consumer
+// that is reading it.
+class PcmRingBuffer {
+ public:
+  enum class OverflowPolicy {
+    // A frame written when full is dropped.
+    kDropNewest,
+    // The oldest frame is dropped to make room, so the consumer sees the
+    // most recent audio. If the consumer is reading that very frame, the
+    // new one is dropped instead.
+    kDropOldest,
+  };
+
+  struct Frame {
+    // Interleaved samples, |samples_per_channel| * |num_channels| of them.
+    std::vector<int16_t> data;
+    size_t samples_per_channel = 0;
+    size_t num_channels = 0;
+    int sample_rate_hz = 0;
+    // rtc::TimeMillis() when written.
+    int64_t timestamp_ms = 0;
+  };
+
+  struct Stats {
+    uint64_t frames_written = 0;
+    uint64_t frames_read = 0;
+    // Frames lost to overflow, whichever end was dropped.
+    uint64_t frames_dropped = 0;
+    // Frames larger than |max_samples_per_frame|, which are not written.
+    uint64_t frames_too_large = 0;
+  };
+
+  // Holds up to |capacity| frames of up to |max_samples_per_frame| samples
+  // (over all channels) each.
+  PcmRingBuffer(size_t capacity,
+                size_t max_samples_per_frame,
+                OverflowPolicy policy);
+  ~PcmRingBuffer();
+
+  // Producer side. Returns false if the frame was not queued.
+  bool Write(const int16_t* data,
+             size_t samples_per_channel,
+             size_t num_channels,
+             int sample_rate_hz);
+
+  // Consumer side. Copies the oldest frame to |frame|, reusing its memory.
+  // Returns false if the buffer is empty.
+  bool Read(Frame* frame);
+
+  // Frames currently queued; approximate while the other side runs.
+  size_t size() const;
+  size_t capacity() const { return capacity_; }
+  // May be called on any thread.
+  Stats GetStats() const;
+
+ private:
+  struct Slot {
+    // |position| when free for writing position |position|, |position| + 1
+    // when it holds the frame written at |position|.
+    std::atomic<size_t> sequence;
+    size_t samples_per_channel;
+    size_t num_channels;
+    int sample_rate_hz;
+    int64_t timestamp_ms;
+  };
+
+  // Claims the oldest frame. Returns its position, or false if empty.
+  bool Claim(size_t* position);
+  // Claims the frame at |position| if it is the oldest one and nobody has
+  // claimed it yet.
+  bool ClaimOldest(size_t position);
+  // Makes the slot of |position| free for the write |capacity_| later.
+  void Release(size_t position);
+  int16_t* SlotData(size_t position) {
+    return samples_.get() + (position % capacity_) * max_samples_per_frame_;
+  }
+
+  const size_t capacity_;
+  const size_t max_samples_per_frame_;
+  const OverflowPolicy policy_;
+  const std::unique_ptr<Slot[]> slots_;
+  const std::unique_ptr<int16_t[]> samples_;
+
+  // Only used by the producer.
+  size_t write_position_;
+  // Advanced by the consumer, and by the producer when dropping the oldest
+  // frame.
+  std::atomic<size_t> read_position_;
+
+  std::atomic<uint64_t> frames_written_;
+  std::atomic<uint64_t> frames_read_;
+  std::atomic<uint64_t> frames_dropped_;
+  std::atomic<uint64_t> frames_too_large_;
+  // Queued frames dropped to make room, for size().
+  std::atomic<uint64_t> frames_evicted_;
+};
+
+}  // namespace webrtc
+
+#endif  // PC_TEST_PCM_RING_BUFFER_H_
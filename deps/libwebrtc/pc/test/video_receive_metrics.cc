@@ -0,0 +1,98 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "pc/test/video_receive_metrics.h"
+
+#include <algorithm>
+
+#include "rtc_base/time_utils.h"
+
+namespace webrtc {
+
+constexpr int64_t VideoReceiveMetrics::kWindowUs;
+
+VideoReceiveMetrics::VideoReceiveMetrics(test::MetricsRegistry* registry,
+                                         const std::string& prefix)
+    : last_frame_us_(-1),
+      window_start_us_(-1),
+      window_frames_(0),
+      window_bytes_(0),
+      window_max_inter_arrival_us_(0),
+      frames_(registry->GetCounter(prefix + "frames_total")),
+      resolution_changes_(
+          registry->GetCounter(prefix + "resolution_changes_total")),
+      width_(registry->GetGauge(prefix + "width")),
+      height_(registry->GetGauge(prefix + "height")),
+      millifps_(registry->GetGauge(prefix + "millifps")),
+      bitrate_bps_(registry->GetGauge(prefix + "bitrate_bps")),
+      max_inter_arrival_ms_(
+          registry->GetGauge(prefix + "max_inter_arrival_ms")),
+      // Frames at 30 and 15 fps, 33 and 66 ms apart in whole ms, fall in
+      // the buckets up to 33 and 66.
+      inter_arrival_ms_(registry->GetHistogram(
+          prefix + "inter_arrival_ms",
+          {5, 10, 20, 33, 50, 66, 100, 200, 500})),
+      bitrate_kbps_(registry->GetHistogram(
+          prefix + "bitrate_kbps",
+          {100, 300, 500, 1000, 2000, 4000, 8000, 16000})) {}
+
+VideoReceiveMetrics::~VideoReceiveMetrics() = default;
+
+void VideoReceiveMetrics::OnFrame(int width, int height, size_t encoded_size) {
+  const int64_t now_us = rtc::TimeMicros();
+  frames_->Add();
+  if (width != width_->value() || height != height_->value()) {
+    if (last_frame_us_ >= 0)
+      resolution_changes_->Add();
+    width_->Set(width);
+    height_->Set(height);
+  }
+
+  if (last_frame_us_ >= 0) {
+    const int64_t inter_arrival_us = now_us - last_frame_us_;
+    inter_arrival_ms_->Add(inter_arrival_us / 1000);
+    window_max_inter_arrival_us_ =
+        std::max(window_max_inter_arrival_us_, inter_arrival_us);
+  } else {
+    window_start_us_ = now_us;
+  }
+  last_frame_us_ = now_us;
+
+  // The window is closed by the first frame after it; a stream that stops
+  // keeps its last rates.
+  const int64_t elapsed_us = now_us - window_start_us_;
+  if (elapsed_us >= kWindowUs) {
+    const int64_t bitrate_bps = window_bytes_ * 8 * 1000000 / elapsed_us;
+    millifps_->Set(window_frames_ * 1000000000 / elapsed_us);
+    bitrate_bps_->Set(bitrate_bps);
+    max_inter_arrival_ms_->Set(window_max_inter_arrival_us_ / 1000);
+    bitrate_kbps_->Add(bitrate_bps / 1000);
+    window_start_us_ = now_us;
+    window_frames_ = 0;
+    window_bytes_ = 0;
+    window_max_inter_arrival_us_ = 0;
+  }
+  ++window_frames_;
+  window_bytes_ += encoded_size;
+}
+
+VideoReceiveMetrics::Metrics VideoReceiveMetrics::GetMetrics() const {
+  Metrics metrics;
+  metrics.frames = frames_->value();
+  metrics.width = static_cast<int>(width_->value());
+  metrics.height = static_cast<int>(height_->value());
+  metrics.resolution_changes = resolution_changes_->value();
+  metrics.fps = millifps_->value() / 1000.0;
+  metrics.bitrate_bps = bitrate_bps_->value();
+  metrics.max_inter_arrival_ms = max_inter_arrival_ms_->value();
+  return metrics;
+}
+
+}  // namespace webrtc
@@ -0,0 +1,87 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef PC_TEST_VIDEO_RECEIVE_METRICS_H_
+#define PC_TEST_VIDEO_RECEIVE_METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "test/metrics_registry.h"
+
+namespace webrtc {
+
+// Receive side metrics of one video stream, updated for every frame handed
+// to a sink: the histogram of the times between frames, the frame rate and
+// bitrate over the last second, a histogram of those per second bitrates,
+// and resolution changes. They are metrics of a test::MetricsRegistry, named
+// with a prefix:
+//   <prefix>frames_total, <prefix>resolution_changes_total: counters.
+//   <prefix>width, <prefix>height: gauges, of the last frame.
+//   <prefix>millifps, <prefix>bitrate_bps, <prefix>max_inter_arrival_ms:
+//     gauges, over the last complete 1 s window. The frame rate is in
+//     thousandths of a frame per second.
+//   <prefix>inter_arrival_ms: histogram, up to 5, 10, 20, 33, 50, 66, 100,
+//     200, 500 ms and above.
+//   <prefix>bitrate_kbps: histogram of the 1 s windows, up to 100, 300,
+//     500, 1000, 2000, 4000, 8000, 16000 kbps and above.
+//
+// OnFrame() is called on the thread delivering frames and never logs or
+// allocates; GetMetrics() may be called on any thread.
+class VideoReceiveMetrics {
+ public:
+  struct Metrics {
+    uint64_t frames = 0;
+    int width = 0;
+    int height = 0;
+    uint64_t resolution_changes = 0;
+    // Over the last complete 1 s window.
+    double fps = 0.0;
+    int64_t bitrate_bps = 0;
+    int64_t max_inter_arrival_ms = 0;
+  };
+
+  VideoReceiveMetrics(test::MetricsRegistry* registry,
+                      const std::string& prefix);
+  ~VideoReceiveMetrics();
+
+  // |encoded_size| is the size of the frame as received, if known (for
+  // frames that were not decoded), and 0 otherwise.
+  void OnFrame(int width, int height, size_t encoded_size);
+
+  // The histograms are only in the registry.
+  Metrics GetMetrics() const;
+
+ private:
+  static constexpr int64_t kWindowUs = 1000000;
+
+  // Only used by OnFrame().
+  int64_t last_frame_us_;
+  int64_t window_start_us_;
+  int64_t window_frames_;
+  int64_t window_bytes_;
+  int64_t window_max_inter_arrival_us_;
+
+  test::MetricsRegistry::Counter* const frames_;
+  test::MetricsRegistry::Counter* const resolution_changes_;
+  test::MetricsRegistry::Gauge* const width_;
+  test::MetricsRegistry::Gauge* const height_;
+  test::MetricsRegistry::Gauge* const millifps_;
+  test::MetricsRegistry::Gauge* const bitrate_bps_;
+  test::MetricsRegistry::Gauge* const max_inter_arrival_ms_;
+  test::MetricsRegistry::Histogram* const inter_arrival_ms_;
+  test::MetricsRegistry::Histogram* const bitrate_kbps_;
+};
+
+}  // namespace webrtc
+
+#endif  // PC_TEST_VIDEO_RECEIVE_METRICS_H_
@@ -0,0 +1,224 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "pc/test/video_send_stage_metrics.h"
+
+#include <utility>
+#include <vector>
+
+#include "api/rtc_event_log/rtc_event.h"
+#include "api/rtc_event_log/rtc_event_log.h"
+#include "logging/rtc_event_log/events/rtc_event_rtp_packet_outgoing.h"
+#include "logging/rtc_event_log/events/rtc_event_video_send_stream_config.h"
+#include "logging/rtc_event_log/rtc_stream_config.h"
+#include "rtc_base/time_utils.h"
+
+namespace webrtc {
+
+namespace {
+
+// From 1 ms to 500 ms.
+const std::vector<int64_t>& StageBoundsUs() {
+  static const std::vector<int64_t> bounds = {
+      1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000};
+  return bounds;
+}
+
+// Feeds the metrics with the events of |log| and passes the events on, so
+// that PeerConnection::StartRtcEventLog() keeps working.
+class StageEventLog : public RtcEventLog {
+ public:
+  StageEventLog(VideoSendStageMetrics* metrics,
+                std::unique_ptr<RtcEventLog> log)
+      : metrics_(metrics), log_(std::move(log)) {}
+
+  bool StartLogging(std::unique_ptr<RtcEventLogOutput> output,
+                    int64_t output_period_ms) override {
+    return log_->StartLogging(std::move(output), output_period_ms);
+  }
+  void StopLogging() override { log_->StopLogging(); }
+
+  void Log(std::unique_ptr<RtcEvent> event) override {
+    switch (event->GetType()) {
+      case RtcEvent::Type::RtpPacketOutgoing: {
+        const auto& packet =
+            static_cast<const RtcEventRtpPacketOutgoing&>(*event);
+        metrics_->OnPacketSent(packet.header().Ssrc(),
+                               packet.header().Timestamp(),
+                               packet.header().Marker(),
+                               packet.payload_length());
+        break;
+      }
+      case RtcEvent::Type::VideoSendStreamConfig: {
+        const auto& config =
+            static_cast<const RtcEventVideoSendStreamConfig&>(*event);
+        metrics_->AddVideoSsrc(config.config().local_ssrc);
+        break;
+      }
+      default:
+        break;
+    }
+    log_->Log(std::move(event));
+  }
+
+ private:
+  VideoSendStageMetrics* const metrics_;
+  const std::unique_ptr<RtcEventLog> log_;
+};
+
+class StageEventLogFactory : public RtcEventLogFactoryInterface {
+ public:
+  StageEventLogFactory(VideoSendStageMetrics* metrics,
+                       std::unique_ptr<RtcEventLogFactoryInterface> factory)
+      : metrics_(metrics), factory_(std::move(factory)) {}
+
+  std::unique_ptr<RtcEventLog> CreateRtcEventLog(
+      RtcEventLog::EncodingType encoding_type) override {
+    return std::make_unique<StageEventLog>(
+        metrics_, factory_->CreateRtcEventLog(encoding_type));
+  }
+
+ private:
+  VideoSendStageMetrics* const metrics_;
+  const std::unique_ptr<RtcEventLogFactoryInterface> factory_;
+};
+
+}  // namespace
+
+constexpr size_t VideoSendStageMetrics::kMaxFrames;
+constexpr int VideoSendStageMetrics::kMaxUnmatchedPackets;
+
+VideoSendStageMetrics::VideoSendStageMetrics(test::MetricsRegistry* registry)
+    : next_frame_(0),
+      has_ssrc_(false),
+      ssrc_(0),
+      has_offset_(false),
+      offset_(0),
+      unmatched_packets_(0),
+      frames_sent_(registry->GetCounter("send_frames_total")),
+      capture_to_encoder_us_(
+          registry->GetHistogram("send_capture_to_encoder_us",
+                                 StageBoundsUs())),
+      encode_us_(registry->GetHistogram("send_encode_us", StageBoundsUs())),
+      encoded_to_first_packet_us_(
+          registry->GetHistogram("send_encoded_to_first_packet_us",
+                                 StageBoundsUs())),
+      first_to_last_packet_us_(
+          registry->GetHistogram("send_first_to_last_packet_us",
+                                 StageBoundsUs())),
+      capture_to_last_packet_us_(
+          registry->GetHistogram("send_capture_to_last_packet_us",
+                                 StageBoundsUs())) {}
+
+VideoSendStageMetrics::~VideoSendStageMetrics() = default;
+
+void VideoSendStageMetrics::OnEncoderInput(uint32_t rtp_timestamp,
+                                           int64_t capture_time_us) {
+  int64_t now_us = rtc::TimeMicros();
+  capture_to_encoder_us_->Add(now_us - capture_time_us);
+  rtc::CritScope cs(&crit_);
+  Frame& frame = frames_[next_frame_];
+  next_frame_ = (next_frame_ + 1) % kMaxFrames;
+  frame = Frame();
+  frame.in_use = true;
+  frame.rtp_timestamp = rtp_timestamp;
+  frame.capture_time_us = capture_time_us;
+  frame.input_time_us = now_us;
+}
+
+void VideoSendStageMetrics::OnEncodedImage(uint32_t rtp_timestamp) {
+  int64_t now_us = rtc::TimeMicros();
+  rtc::CritScope cs(&crit_);
+  Frame* frame = FindFrame(rtp_timestamp);
+  // Simulcast layers after the first are encoded from the same frame.
+  if (!frame || frame->encoded_time_us >= 0)
+    return;
+  frame->encoded_time_us = now_us;
+  encode_us_->Add(now_us - frame->input_time_us);
+}
+
+void VideoSendStageMetrics::AddVideoSsrc(uint32_t ssrc) {
+  rtc::CritScope cs(&crit_);
+  if (has_ssrc_)
+    return;
+  has_ssrc_ = true;
+  ssrc_ = ssrc;
+}
+
+void VideoSendStageMetrics::OnPacketSent(uint32_t ssrc,
+                                         uint32_t rtp_timestamp,
+                                         bool marker,
+                                         size_t payload_length) {
+  // Padding carries no frame.
+  if (payload_length == 0)
+    return;
+  int64_t now_us = rtc::TimeMicros();
+  rtc::CritScope cs(&crit_);
+  if (!has_ssrc_ || ssrc != ssrc_)
+    return;
+  if (!has_offset_) {
+    Frame* oldest = OldestUnsentFrame();
+    if (!oldest)
+      return;
+    // Wraps around like the timestamps.
+    offset_ = rtp_timestamp - oldest->rtp_timestamp;
+    has_offset_ = true;
+  }
+  Frame* frame = FindFrame(rtp_timestamp - offset_);
+  if (!frame || frame->encoded_time_us < 0) {
+    // Retransmissions of frames already sent don't match either; only a run
+    // of them means the offset is wrong.
+    if (++unmatched_packets_ >= kMaxUnmatchedPackets) {
+      has_offset_ = false;
+      unmatched_packets_ = 0;
+    }
+    return;
+  }
+  unmatched_packets_ = 0;
+  if (frame->first_packet_time_us < 0) {
+    frame->first_packet_time_us = now_us;
+    encoded_to_first_packet_us_->Add(now_us - frame->encoded_time_us);
+  }
+  if (marker) {
+    first_to_last_packet_us_->Add(now_us - frame->first_packet_time_us);
+    capture_to_last_packet_us_->Add(now_us - frame->capture_time_us);
+    frames_sent_->Add();
+    frame->in_use = false;
+  }
+}
+
+std::unique_ptr<RtcEventLogFactoryInterface>
+VideoSendStageMetrics::CreateEventLogFactory(
+    std::unique_ptr<RtcEventLogFactoryInterface> factory) {
+  return std::make_unique<StageEventLogFactory>(this, std::move(factory));
+}
+
+VideoSendStageMetrics::Frame* VideoSendStageMetrics::FindFrame(
+    uint32_t rtp_timestamp) {
+  for (Frame& frame : frames_) {
+    if (frame.in_use && frame.rtp_timestamp == rtp_timestamp)
+      return &frame;
+  }
+  return nullptr;
+}
+
+VideoSendStageMetrics::Frame* VideoSendStageMetrics::OldestUnsentFrame() {
+  Frame* oldest = nullptr;
+  for (Frame& frame : frames_) {
+    if (frame.in_use && frame.encoded_time_us >= 0 &&
+        frame.first_packet_time_us < 0 &&
+        (!oldest || frame.input_time_us < oldest->input_time_us)) {
+      oldest = &frame;
+    }
+  }
+  return oldest;
+}
+
+}  // namespace webrtc
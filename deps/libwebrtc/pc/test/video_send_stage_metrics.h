@@ -0,0 +1,108 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef PC_TEST_VIDEO_SEND_STAGE_METRICS_H_
+#define PC_TEST_VIDEO_SEND_STAGE_METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <memory>
+
+#include "api/rtc_event_log/rtc_event_log_factory_interface.h"
+#include "rtc_base/critical_section.h"
+#include "rtc_base/thread_annotations.h"
+#include "test/metrics_registry.h"
+
+namespace webrtc {
+
+// Send side latency of each video frame, split into the stages of the
+// pipeline after capture, as histograms in microseconds:
+//   send_capture_to_encoder_us: delivery to the encoder, and its queue.
+//   send_encode_us: encoder input to encoder output.
+//   send_encoded_to_first_packet_us: packetization and pacing.
+//   send_first_to_last_packet_us: pacing of the frame's packets.
+//   send_capture_to_last_packet_us: all of the above.
+// Scaling in the capturer is measured by test::TestVideoCapturer.
+//
+// Frames are matched by RTP timestamp. The packets carry the frame's
+// timestamp plus a random offset, which is learned from the first packet,
+// assumed to be of the oldest frame not sent yet, and again when packets
+// stop matching. With simulcast, only the first layer's packets count.
+class VideoSendStageMetrics {
+ public:
+  explicit VideoSendStageMetrics(test::MetricsRegistry* registry);
+  ~VideoSendStageMetrics();
+
+  // Called by the encoder wrapper, on the encoder queue.
+  void OnEncoderInput(uint32_t rtp_timestamp, int64_t capture_time_us);
+  void OnEncodedImage(uint32_t rtp_timestamp);
+
+  // The first SSRC added is measured. Packets of other SSRCs (audio, RTX,
+  // other layers) are ignored.
+  void AddVideoSsrc(uint32_t ssrc);
+  // Called for each RTP packet sent, on the pacer thread. |marker| ends the
+  // frame.
+  void OnPacketSent(uint32_t ssrc,
+                    uint32_t rtp_timestamp,
+                    bool marker,
+                    size_t payload_length);
+
+  // Wraps the event logs of |factory| to feed OnPacketSent() and
+  // AddVideoSsrc() with the events of the calls they are created for. The
+  // events still reach |factory|'s logs, which write them out once started.
+  // The metrics must outlive the factory and its logs.
+  std::unique_ptr<RtcEventLogFactoryInterface> CreateEventLogFactory(
+      std::unique_ptr<RtcEventLogFactoryInterface> factory);
+
+ private:
+  // Frames between encoder input and their last packet.
+  static constexpr size_t kMaxFrames = 64;
+  // Packets that match no frame before the offset is learned again.
+  static constexpr int kMaxUnmatchedPackets = 30;
+
+  struct Frame {
+    bool in_use = false;
+    uint32_t rtp_timestamp = 0;
+    int64_t capture_time_us = 0;
+    int64_t input_time_us = 0;
+    // -1 until then.
+    int64_t encoded_time_us = -1;
+    int64_t first_packet_time_us = -1;
+  };
+
+  Frame* FindFrame(uint32_t rtp_timestamp)
+      RTC_EXCLUSIVE_LOCKS_REQUIRED(crit_);
+  // The oldest frame encoded and without a packet sent, or null.
+  Frame* OldestUnsentFrame() RTC_EXCLUSIVE_LOCKS_REQUIRED(crit_);
+
+  rtc::CriticalSection crit_;
+  std::array<Frame, kMaxFrames> frames_ RTC_GUARDED_BY(crit_);
+  // Where the next frame goes; older frames are overwritten, e.g. when the
+  // encoder dropped them.
+  size_t next_frame_ RTC_GUARDED_BY(crit_);
+  bool has_ssrc_ RTC_GUARDED_BY(crit_);
+  uint32_t ssrc_ RTC_GUARDED_BY(crit_);
+  bool has_offset_ RTC_GUARDED_BY(crit_);
+  uint32_t offset_ RTC_GUARDED_BY(crit_);
+  int unmatched_packets_ RTC_GUARDED_BY(crit_);
+
+  test::MetricsRegistry::Counter* const frames_sent_;
+  test::MetricsRegistry::Histogram* const capture_to_encoder_us_;
+  test::MetricsRegistry::Histogram* const encode_us_;
+  test::MetricsRegistry::Histogram* const encoded_to_first_packet_us_;
+  test::MetricsRegistry::Histogram* const first_to_last_packet_us_;
+  test::MetricsRegistry::Histogram* const capture_to_last_packet_us_;
+};
+
+}  // namespace webrtc
+
+#endif  // PC_TEST_VIDEO_SEND_STAGE_METRICS_H_
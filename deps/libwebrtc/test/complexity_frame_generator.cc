@@ -0,0 +1,661 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "test/complexity_frame_generator.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "api/video/video_frame.h"
+#include "rtc_base/checks.h"
+#include "third_party/libyuv/include/libyuv/planar_functions.h"
+#include "third_party/libyuv/include/libyuv/scale.h"
+
+// The build does not define the WEBRTC_ARCH_* / WEBRTC_HAS_NEON macros for
+// this library, so the SIMD paths are selected on the compiler's target.
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace webrtc {
+namespace test {
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+// Roughly the bits spent per frame on headers, modes and motion vectors.
+constexpr double kFrameOverheadBits = 4000;
+// OnEncodedBitrate() leaves the amplitude alone within about 5% of the
+// target, and corrects the model by at most this factor either way.
+constexpr double kBitrateDeadBand = 0.05;
+constexpr double kMaxRateCorrection = 16;
+// The part of the error OnEncodedBitrate() corrects at once.
+constexpr double kMaxCorrectionGain = 0.5;
+constexpr double kMinCorrectionGain = 0.05;
+
+// State of four xorshift32 generators, one per 32-bit SIMD lane. Each step
+// yields 16 noise bytes, in the same order on every code path.
+struct NoiseState {
+  uint32_t lane[4];
+};
+
+uint32_t Mix(uint32_t x) {
+  // MurmurHash3 finalizer.
+  x ^= x >> 16;
+  x *= 0x85ebca6b;
+  x ^= x >> 13;
+  x *= 0xc2b2ae35;
+  x ^= x >> 16;
+  return x;
+}
+
+// Seeds a noise stream for one row of one frame, so rows are independent.
+NoiseState SeedNoise(uint32_t seed, int64_t frame, int row) {
+  NoiseState state;
+  const uint32_t key = Mix(seed ^ Mix(static_cast<uint32_t>(frame)) ^
+                           Mix(static_cast<uint32_t>(row) + 0x9e3779b9));
+  for (uint32_t i = 0; i < 4; ++i) {
+    state.lane[i] = Mix(key + (i + 1) * 0x9e3779b9);
+    if (state.lane[i] == 0)
+      state.lane[i] = 1;
+  }
+  return state;
+}
+
+void NextNoiseBytes(NoiseState* state, uint8_t bytes[16]) {
+  for (uint32_t& x : state->lane) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+  }
+  memcpy(bytes, state->lane, 16);
+}
+
+// Adds uniform noise in [-amplitude / 2, amplitude / 2) to |width| pixels.
+void AddNoiseRow(uint8_t* row,
+                 int width,
+                 int amplitude,
+                 NoiseState* state) {
+  if (amplitude <= 0)
+    return;
+  int x = 0;
+#if defined(__SSE2__)
+  __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state->lane));
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i amp = _mm_set1_epi16(static_cast<int16_t>(amplitude));
+  const __m128i half = _mm_set1_epi16(static_cast<int16_t>(amplitude / 2));
+  for (; x + 16 <= width; x += 16) {
+    s = _mm_xor_si128(s, _mm_slli_epi32(s, 13));
+    s = _mm_xor_si128(s, _mm_srli_epi32(s, 17));
+    s = _mm_xor_si128(s, _mm_slli_epi32(s, 5));
+    // noise = (random_byte * amplitude) >> 8 - amplitude / 2, in 16 bits.
+    __m128i noise_lo = _mm_sub_epi16(
+        _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), amp), 8),
+        half);
+    __m128i noise_hi = _mm_sub_epi16(
+        _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), amp), 8),
+        half);
+    __m128i* dst = reinterpret_cast<__m128i*>(row + x);
+    __m128i pixels = _mm_loadu_si128(dst);
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(pixels, zero), noise_lo);
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(pixels, zero), noise_hi);
+    _mm_storeu_si128(dst, _mm_packus_epi16(lo, hi));
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state->lane), s);
+#elif defined(__ARM_NEON)
+  uint32x4_t s = vld1q_u32(state->lane);
+  const uint8x8_t amp = vdup_n_u8(static_cast<uint8_t>(amplitude));
+  const int16x8_t half = vdupq_n_s16(static_cast<int16_t>(amplitude / 2));
+  for (; x + 16 <= width; x += 16) {
+    s = veorq_u32(s, vshlq_n_u32(s, 13));
+    s = veorq_u32(s, vshrq_n_u32(s, 17));
+    s = veorq_u32(s, vshlq_n_u32(s, 5));
+    uint8x16_t random = vreinterpretq_u8_u32(s);
+    uint8x8_t noise_lo = vshrn_n_u16(vmull_u8(vget_low_u8(random), amp), 8);
+    uint8x8_t noise_hi = vshrn_n_u16(vmull_u8(vget_high_u8(random), amp), 8);
+    uint8x16_t pixels = vld1q_u8(row + x);
+    int16x8_t lo = vsubq_s16(
+        vreinterpretq_s16_u16(vaddl_u8(vget_low_u8(pixels), noise_lo)), half);
+    int16x8_t hi = vsubq_s16(
+        vreinterpretq_s16_u16(vaddl_u8(vget_high_u8(pixels), noise_hi)), half);
+    vst1q_u8(row + x, vcombine_u8(vqmovun_s16(lo), vqmovun_s16(hi)));
+  }
+  vst1q_u32(state->lane, s);
+#endif
+  // Tail of the row, and the whole row on other CPUs.
+  for (; x < width; x += 16) {
+    uint8_t random[16];
+    NextNoiseBytes(state, random);
+    const int count = std::min(16, width - x);
+    for (int i = 0; i < count; ++i) {
+      int value = row[x + i] + ((random[i] * amplitude) >> 8) - amplitude / 2;
+      row[x + i] = static_cast<uint8_t>(std::min(255, std::max(0, value)));
+    }
+  }
+}
+
+// Maps an ever increasing |position| onto [0, range], bouncing at the ends.
+int PingPong(int64_t position, int range) {
+  if (range <= 0)
+    return 0;
+  int64_t period = 2 * static_cast<int64_t>(range);
+  int64_t p = position % period;
+  if (p < 0)
+    p += period;
+  return static_cast<int>(p <= range ? p : period - p);
+}
+
+// Scales |rows| rows of a plane from |src_width| to |dst_width| pixels. Rows
+// only read their own source row, so bands of rows scale independently.
+void ScaleRowsHorizontally(const uint8_t* src,
+                           int src_stride,
+                           int src_width,
+                           uint8_t* dst,
+                           int dst_stride,
+                           int dst_width,
+                           int rows) {
+  libyuv::ScalePlane(src, src_stride, src_width, rows, dst, dst_stride,
+                     dst_width, rows, libyuv::kFilterBox);
+}
+
+// Rows [row_begin, row_end) of a plane scaled from |src_height| to
+// |dst_height| rows of |width| pixels. Each row is interpolated from the two
+// source rows nearest to its center, so bands of rows scale independently.
+void ScaleRowsVertically(const uint8_t* src,
+                         int src_stride,
+                         int src_height,
+                         uint8_t* dst,
+                         int dst_stride,
+                         int width,
+                         int dst_height,
+                         int row_begin,
+                         int row_end) {
+  const int64_t max_position = (src_height - 1) * int64_t{256};
+  for (int y = row_begin; y < row_end; ++y) {
+    // In 1/256 of a source row.
+    int64_t position =
+        (2 * y + 1) * int64_t{src_height} * 256 / (2 * dst_height) - 128;
+    position = std::min(max_position, std::max(int64_t{0}, position));
+    const uint8_t* row = src + (position >> 8) * src_stride;
+    const int fraction = static_cast<int>(position & 255);
+    // Without a fraction, which the last row never has, |row| is copied.
+    libyuv::InterpolatePlane(row, src_stride, fraction ? row + src_stride : row,
+                             src_stride, dst + y * dst_stride, dst_stride,
+                             width, 1, fraction);
+  }
+}
+
+uint8_t ClampToByte(double value) {
+  return static_cast<uint8_t>(std::min(255.0, std::max(0.0, value + 0.5)));
+}
+
+// H.264 quantizer step size.
+double QpToQstep(int qp) {
+  return 0.625 * std::pow(2.0, qp / 6.0);
+}
+
+// Bits per sample for a transform coefficient with standard deviation
+// |sigma|, taken as Gaussian, quantized with step |qstep| and the dead zone
+// of H.264 inter blocks: magnitudes round down below 5/6 of a step. This is
+// the entropy of the levels and their signs, which CABAC comes close to.
+// Noise well below the dead zone costs nothing, unlike in the high-rate
+// approximation.
+double BitsPerSample(double sigma, double qstep) {
+  if (sigma <= 0)
+    return 0;
+  // Probability of a magnitude of at least |t|.
+  auto tail = [sigma](double t) {
+    return std::erfc(t / (sigma * std::sqrt(2.0)));
+  };
+  constexpr double kMinProbability = 1e-12;
+  double bits = 0;
+  const double p_zero = 1 - tail(5.0 / 6 * qstep);
+  if (p_zero > kMinProbability)
+    bits -= p_zero * std::log2(p_zero);
+  for (int level = 1;; ++level) {
+    const double p_magnitude =
+        tail((level - 1.0 / 6) * qstep) - tail((level + 5.0 / 6) * qstep);
+    if (p_magnitude < kMinProbability)
+      break;
+    // Either sign.
+    bits -= p_magnitude * std::log2(p_magnitude / 2);
+  }
+  return bits;
+}
+
+// Bitrate at |target_qp| for |bitrate_bps| produced at |qp|, by the rule of
+// thumb that the bitrate halves every 6 QP.
+double BitrateAtQp(double bitrate_bps, double qp, int target_qp) {
+  return bitrate_bps * std::pow(2.0, (qp - target_qp) / 6.0);
+}
+
+}  // namespace
+
+ComplexityFrameGenerator::ComplexityFrameGenerator(
+    int width,
+    int height,
+    const ComplexityFrameGeneratorConfig& config)
+    : config_(config),
+      picture_width_(width),
+      picture_height_(height),
+      width_(width),
+      height_(height),
+      noise_amplitude_(config.noise_amplitude),
+      rate_correction_(1.0),
+      correction_gain_(kMaxCorrectionGain),
+      correction_steps_(0),
+      last_error_above_(false),
+      frame_count_(0),
+      random_generator_(config.seed),
+      buffer_pool_(/*zero_initialize=*/false),
+      picture_pool_(/*zero_initialize=*/false),
+      render_pool_(config.render_threads) {
+  rtc::CritScope lock(&lock_);
+  RTC_CHECK_GE(config_.zoom_amplitude, 0);
+  RTC_CHECK_LE(config_.zoom_amplitude, 0.5);
+  RTC_CHECK_GT(config_.framerate, 0);
+  if (config_.target_bitrate_bps) {
+    noise_amplitude_ = NoiseAmplitudeForBitrate(
+        config_, width_, height_, *config_.target_bitrate_bps);
+  }
+  CreateWorld();
+}
+
+ComplexityFrameGenerator::~ComplexityFrameGenerator() = default;
+
+void ComplexityFrameGenerator::ChangeResolution(size_t width, size_t height) {
+  rtc::CritScope lock(&lock_);
+  width_ = static_cast<int>(width);
+  height_ = static_cast<int>(height);
+  if (config_.target_bitrate_bps) {
+    noise_amplitude_ = NoiseAmplitudeForBitrate(
+        config_, width_, height_,
+        rate_correction_ * *config_.target_bitrate_bps);
+  }
+}
+
+void ComplexityFrameGenerator::OnEncodedBitrate(int64_t bitrate_bps,
+                                                double qp) {
+  rtc::CritScope lock(&lock_);
+  if (!config_.target_bitrate_bps || bitrate_bps <= 0)
+    return;
+  const double target = *config_.target_bitrate_bps;
+  const double measured =
+      BitrateAtQp(bitrate_bps, qp > 0 ? qp : config_.target_qp,
+                  config_.target_qp);
+  // Within the dead band, the amplitude would only toggle between two steps.
+  const double error = target / measured;
+  if (std::abs(std::log(error)) < kBitrateDeadBand)
+    return;
+  // A part of the error is corrected per measurement, and at most a factor
+  // of two, so that one noisy measurement can't swing the amplitude far.
+  // The part halves whenever the error changes sign, which settles the
+  // oscillation where the bitrate is steep in the amplitude.
+  const bool above = error < 1;
+  if (correction_steps_ > 0 && above != last_error_above_)
+    correction_gain_ = std::max(kMinCorrectionGain, correction_gain_ / 2);
+  last_error_above_ = above;
+  ++correction_steps_;
+  rate_correction_ *=
+      std::min(2.0, std::max(0.5, std::pow(error, correction_gain_)));
+  rate_correction_ = std::min(kMaxRateCorrection,
+                              std::max(1 / kMaxRateCorrection,
+                                       rate_correction_));
+  noise_amplitude_ = NoiseAmplitudeForBitrate(config_, width_, height_,
+                                              rate_correction_ * target);
+}
+
+void ComplexityFrameGenerator::CreateWorld() {
+  RTC_CHECK_GT(picture_width_, 0);
+  RTC_CHECK_GT(picture_height_, 0);
+  const int world_width = 2 * picture_width_;
+  const int world_height = 2 * picture_height_;
+  world_ = I420Buffer::Create(world_width, world_height);
+
+  // Static texture: uniform noise on a grid of cells, smoothed by the
+  // bilinear upscale when the cells are larger than one pixel.
+  const int cell_size = std::max(1, config_.texture_cell_size);
+  const int cells_width = (world_width + cell_size - 1) / cell_size;
+  const int cells_height = (world_height + cell_size - 1) / cell_size;
+  std::vector<uint8_t> cells(cells_width * cells_height, 128);
+  for (int y = 0; y < cells_height; ++y) {
+    NoiseState state = SeedNoise(config_.seed, /*frame=*/-1, y);
+    AddNoiseRow(&cells[y * cells_width], cells_width,
+                config_.texture_amplitude, &state);
+  }
+  std::vector<uint8_t> texture(world_width * world_height);
+  libyuv::ScalePlane(cells.data(), cells_width, cells_width, cells_height,
+                     texture.data(), world_width, world_width, world_height,
+                     libyuv::kFilterBilinear);
+
+  // Large scale shading, so the picture is not flat below the texture.
+  std::vector<double> shade_x(world_width);
+  std::vector<double> shade_y(world_height);
+  for (int x = 0; x < world_width; ++x)
+    shade_x[x] = 40 * std::sin(2 * kPi * 3 * x / world_width);
+  for (int y = 0; y < world_height; ++y)
+    shade_y[y] = 40 * std::cos(2 * kPi * 2 * y / world_height);
+  for (int y = 0; y < world_height; ++y) {
+    uint8_t* row = world_->MutableDataY() + y * world_->StrideY();
+    const uint8_t* texture_row = &texture[y * world_width];
+    for (int x = 0; x < world_width; ++x)
+      row[x] = ClampToByte(shade_x[x] + shade_y[y] + texture_row[x]);
+  }
+  for (int y = 0; y < world_->ChromaHeight(); ++y) {
+    uint8_t* row_u = world_->MutableDataU() + y * world_->StrideU();
+    uint8_t* row_v = world_->MutableDataV() + y * world_->StrideV();
+    for (int x = 0; x < world_->ChromaWidth(); ++x) {
+      row_u[x] = ClampToByte(128 + shade_x[2 * x] - shade_y[2 * y] / 2);
+      row_v[x] = ClampToByte(128 + shade_y[2 * y] - shade_x[2 * x] / 2);
+    }
+  }
+
+  blocks_.clear();
+  const int block_size = std::max(16, config_.block_size) & ~1;
+  for (int y = 0; y + block_size <= picture_height_; y += block_size) {
+    for (int x = 0; x + block_size <= picture_width_; x += block_size) {
+      if (random_generator_.Rand<double>() >= config_.moving_block_fraction)
+        continue;
+      MovingBlock block;
+      block.x = x;
+      block.y = y;
+      block.dx = random_generator_.Rand(-config_.max_block_speed,
+                                        config_.max_block_speed);
+      block.dy = random_generator_.Rand(-config_.max_block_speed,
+                                        config_.max_block_speed);
+      blocks_.push_back(block);
+    }
+  }
+}
+
+FrameGeneratorInterface::VideoFrameData
+ComplexityFrameGenerator::NextFrame() {
+  rtc::CritScope lock(&lock_);
+  rtc::scoped_refptr<I420Buffer> buffer =
+      buffer_pool_.CreateBuffer(width_, height_);
+  if (!buffer)
+    buffer = I420Buffer::Create(width_, height_);
+  // At another resolution, the picture is rendered at its own and scaled,
+  // like a camera scaling its sensor's output.
+  const bool scaled = width_ != picture_width_ || height_ != picture_height_;
+  rtc::scoped_refptr<I420Buffer> picture = buffer;
+  if (scaled) {
+    picture = picture_pool_.CreateBuffer(picture_width_, picture_height_);
+    if (!picture)
+      picture = I420Buffer::Create(picture_width_, picture_height_);
+  }
+
+  // Zoom, then pan the crop window across the picture.
+  double zoom = 1.0;
+  if (config_.zoom_amplitude > 0 && config_.zoom_period_frames > 0) {
+    zoom += config_.zoom_amplitude *
+            std::sin(2 * kPi * frame_count_ / config_.zoom_period_frames);
+  }
+  const int crop_width =
+      std::min(world_->width(),
+               static_cast<int>(std::lround(picture_width_ / zoom)) & ~1);
+  const int crop_height =
+      std::min(world_->height(),
+               static_cast<int>(std::lround(picture_height_ / zoom)) & ~1);
+  const int offset_x =
+      PingPong(frame_count_ * config_.pan_x, world_->width() - crop_width) &
+      ~1;
+  const int offset_y =
+      PingPong(frame_count_ * config_.pan_y, world_->height() - crop_height) &
+      ~1;
+  // Without zoom the crop is a plain copy, made along with the blocks.
+  const bool copy_in_bands =
+      crop_width == picture_width_ && crop_height == picture_height_;
+  if (!copy_in_bands) {
+    ScaleInBands(*world_, offset_x, offset_y, crop_width, crop_height,
+                 picture.get());
+  }
+
+  // The render threads don't take |lock_|. This thread holds it until
+  // Render() returns, so the state the bands read can't change meanwhile.
+  const I420BufferInterface& world = *world_;
+  const std::vector<MovingBlock>& blocks = blocks_;
+  const int block_size = std::max(16, config_.block_size) & ~1;
+  const int64_t frame = frame_count_;
+  const uint32_t seed = config_.seed;
+  const double noise_amplitude = noise_amplitude_;
+  I420Buffer* output = picture.get();
+  render_pool_.Render(picture_height_, [&](int row_begin, int row_end) {
+    if (copy_in_bands) {
+      const int chroma_begin = row_begin / 2;
+      const int chroma_rows = (row_end + 1) / 2 - chroma_begin;
+      libyuv::CopyPlane(
+          world.DataY() + (offset_y + row_begin) * world.StrideY() + offset_x,
+          world.StrideY(),
+          output->MutableDataY() + row_begin * output->StrideY(),
+          output->StrideY(), output->width(), row_end - row_begin);
+      libyuv::CopyPlane(world.DataU() +
+                            (offset_y / 2 + chroma_begin) * world.StrideU() +
+                            offset_x / 2,
+                        world.StrideU(),
+                        output->MutableDataU() +
+                            chroma_begin * output->StrideU(),
+                        output->StrideU(), output->ChromaWidth(), chroma_rows);
+      libyuv::CopyPlane(world.DataV() +
+                            (offset_y / 2 + chroma_begin) * world.StrideV() +
+                            offset_x / 2,
+                        world.StrideV(),
+                        output->MutableDataV() +
+                            chroma_begin * output->StrideV(),
+                        output->StrideV(), output->ChromaWidth(), chroma_rows);
+    }
+    DrawMovingBlocks(world, blocks, block_size, frame, row_begin, row_end,
+                     output);
+    if (!scaled) {
+      AddNoiseRows(seed, frame, noise_amplitude, row_begin, row_end, output);
+    }
+  });
+
+  if (scaled) {
+    // The noise is added after scaling, which would otherwise smooth it.
+    ScaleInBands(*picture, 0, 0, picture_width_, picture_height_,
+                 buffer.get());
+    output = buffer.get();
+    render_pool_.Render(height_, [&](int row_begin, int row_end) {
+      AddNoiseRows(seed, frame, noise_amplitude, row_begin, row_end, output);
+    });
+  }
+
+  ++frame_count_;
+  return VideoFrameData(buffer, absl::nullopt);
+}
+
+void ComplexityFrameGenerator::ScaleInBands(const I420BufferInterface& src,
+                                            int offset_x,
+                                            int offset_y,
+                                            int crop_width,
+                                            int crop_height,
+                                            I420Buffer* dst) {
+  // Horizontally first, every row of the crop, then vertically, every row
+  // of |dst|. Both passes split into bands of rows.
+  // |scaled_rows_| is shared by the crop and the output scaling, which have
+  // different widths, so only the leftmost |dst| width columns are used.
+  if (!scaled_rows_ || scaled_rows_->width() < dst->width() ||
+      scaled_rows_->height() < crop_height) {
+    scaled_rows_ = I420Buffer::Create(
+        std::max(dst->width(), scaled_rows_ ? scaled_rows_->width() : 0),
+        std::max(crop_height, scaled_rows_ ? scaled_rows_->height() : 0));
+  }
+  I420Buffer* rows = scaled_rows_.get();
+  const int crop_chroma_width = (crop_width + 1) / 2;
+  const int crop_chroma_height = (crop_height + 1) / 2;
+  render_pool_.Render(crop_height, [&](int row_begin, int row_end) {
+    ScaleRowsHorizontally(
+        src.DataY() + (offset_y + row_begin) * src.StrideY() + offset_x,
+        src.StrideY(), crop_width,
+        rows->MutableDataY() + row_begin * rows->StrideY(), rows->StrideY(),
+        dst->width(), row_end - row_begin);
+    const int chroma_begin = row_begin / 2;
+    const int chroma_rows = (row_end + 1) / 2 - chroma_begin;
+    ScaleRowsHorizontally(
+        src.DataU() + (offset_y / 2 + chroma_begin) * src.StrideU() +
+            offset_x / 2,
+        src.StrideU(), crop_chroma_width,
+        rows->MutableDataU() + chroma_begin * rows->StrideU(),
+        rows->StrideU(), dst->ChromaWidth(), chroma_rows);
+    ScaleRowsHorizontally(
+        src.DataV() + (offset_y / 2 + chroma_begin) * src.StrideV() +
+            offset_x / 2,
+        src.StrideV(), crop_chroma_width,
+        rows->MutableDataV() + chroma_begin * rows->StrideV(),
+        rows->StrideV(), dst->ChromaWidth(), chroma_rows);
+  });
+  render_pool_.Render(dst->height(), [&](int row_begin, int row_end) {
+    ScaleRowsVertically(rows->DataY(), rows->StrideY(), crop_height,
+                        dst->MutableDataY(), dst->StrideY(), dst->width(),
+                        dst->height(), row_begin, row_end);
+    const int chroma_begin = row_begin / 2;
+    const int chroma_end = (row_end + 1) / 2;
+    ScaleRowsVertically(rows->DataU(), rows->StrideU(), crop_chroma_height,
+                        dst->MutableDataU(), dst->StrideU(),
+                        dst->ChromaWidth(), dst->ChromaHeight(), chroma_begin,
+                        chroma_end);
+    ScaleRowsVertically(rows->DataV(), rows->StrideV(), crop_chroma_height,
+                        dst->MutableDataV(), dst->StrideV(),
+                        dst->ChromaWidth(), dst->ChromaHeight(), chroma_begin,
+                        chroma_end);
+  });
+}
+
+// static
+void ComplexityFrameGenerator::AddNoiseRows(uint32_t seed,
+                                            int64_t frame,
+                                            double amplitude,
+                                            int row_begin,
+                                            int row_end,
+                                            I420Buffer* buffer) {
+  // A fractional amplitude is made of rows with the amplitudes on either
+  // side, in proportion, so that the bitrate follows it smoothly.
+  const int whole = static_cast<int>(amplitude);
+  const uint32_t fraction =
+      static_cast<uint32_t>((amplitude - whole) * 65536);
+  // Each row has its own noise stream, so bands don't change the output.
+  for (int y = row_begin; y < row_end; ++y) {
+    NoiseState state = SeedNoise(seed, frame, y);
+    const bool round_up = (Mix(state.lane[0] ^ 0x5bd1e995) >> 16) < fraction;
+    AddNoiseRow(buffer->MutableDataY() + y * buffer->StrideY(),
+                buffer->width(), whole + (round_up ? 1 : 0), &state);
+  }
+}
+
+// static
+void ComplexityFrameGenerator::DrawMovingBlocks(
+    const I420BufferInterface& world,
+    const std::vector<MovingBlock>& blocks,
+    int block_size,
+    int64_t frame,
+    int row_begin,
+    int row_end,
+    I420Buffer* buffer) {
+  for (const MovingBlock& block : blocks) {
+    // Blocks and bands both start on even rows.
+    const int first_row = std::max(block.y, row_begin);
+    const int end_row = std::min(block.y + block_size, row_end);
+    if (first_row >= end_row)
+      continue;
+    const int source_x =
+        PingPong(block.x + frame * block.dx, world.width() - block_size) & ~1;
+    const int source_y =
+        PingPong(block.y + frame * block.dy, world.height() - block_size) & ~1;
+    const int source_row = source_y + first_row - block.y;
+    libyuv::CopyPlane(
+        world.DataY() + source_row * world.StrideY() + source_x,
+        world.StrideY(),
+        buffer->MutableDataY() + first_row * buffer->StrideY() + block.x,
+        buffer->StrideY(), block_size, end_row - first_row);
+    const int chroma_rows = (end_row - first_row + 1) / 2;
+    libyuv::CopyPlane(
+        world.DataU() + source_row / 2 * world.StrideU() + source_x / 2,
+        world.StrideU(),
+        buffer->MutableDataU() + first_row / 2 * buffer->StrideU() +
+            block.x / 2,
+        buffer->StrideU(), block_size / 2, chroma_rows);
+    libyuv::CopyPlane(
+        world.DataV() + source_row / 2 * world.StrideV() + source_x / 2,
+        world.StrideV(),
+        buffer->MutableDataV() + first_row / 2 * buffer->StrideV() +
+            block.x / 2,
+        buffer->StrideV(), block_size / 2, chroma_rows);
+  }
+}
+
+// static
+double ComplexityFrameGenerator::EstimateBitrateBps(
+    const ComplexityFrameGeneratorConfig& config,
+    int width,
+    int height) {
+  const double qstep = QpToQstep(config.target_qp);
+  // Uniform noise of peak-to-peak amplitude A has a variance of A^2 / 12.
+  // Fresh noise is in both the frame and its reference, doubling the
+  // variance of the prediction residual.
+  const double noise_variance =
+      2 * config.noise_amplitude * config.noise_amplitude / 12.0;
+  // Panning and block motion are whole-pixel moves that motion compensation
+  // predicts. Zooming rescales the texture, which is mispredicted in
+  // proportion to how far the texture moves relative to its cell size.
+  double mispredicted = 0;
+  if (config.zoom_amplitude > 0 && config.zoom_period_frames > 0) {
+    const double zoom_rate =
+        2 * kPi * config.zoom_amplitude / config.zoom_period_frames;
+    const double mean_displacement = zoom_rate * std::max(width, height) / 4;
+    mispredicted = std::min(
+        1.0, mean_displacement / std::max(1, config.texture_cell_size));
+  }
+  const double texture_variance = mispredicted * mispredicted *
+                                  config.texture_amplitude *
+                                  config.texture_amplitude / 12.0;
+  const double bits_per_pixel =
+      BitsPerSample(std::sqrt(noise_variance + texture_variance), qstep);
+  return (bits_per_pixel * width * height + kFrameOverheadBits) *
+         config.framerate;
+}
+
+// static
+double ComplexityFrameGenerator::NoiseAmplitudeForBitrate(
+    const ComplexityFrameGeneratorConfig& config,
+    int width,
+    int height,
+    double target_bitrate_bps) {
+  // The estimate grows monotonically with the noise amplitude.
+  ComplexityFrameGeneratorConfig candidate = config;
+  int low = 0;
+  int high = 255;
+  while (low < high) {
+    candidate.noise_amplitude = (low + high) / 2;
+    if (EstimateBitrateBps(candidate, width, height) < target_bitrate_bps) {
+      low = candidate.noise_amplitude + 1;
+    } else {
+      high = candidate.noise_amplitude;
+    }
+  }
+  if (low == 0)
+    return 0;
+  // Interpolated between the amplitudes on either side of the target.
+  candidate.noise_amplitude = low - 1;
+  const double below = EstimateBitrateBps(candidate, width, height);
+  candidate.noise_amplitude = low;
+  const double above = EstimateBitrateBps(candidate, width, height);
+  if (above <= below)
+    return low;
+  return low - 1 +
+         std::min(1.0, std::max(0.0, (target_bitrate_bps - below) /
+                                         (above - below)));
+}
+
+}  // namespace test
+}  // namespace webrtc
@@ -0,0 +1,176 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef TEST_COMPLEXITY_FRAME_GENERATOR_H_
+#define TEST_COMPLEXITY_FRAME_GENERATOR_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "absl/types/optional.h"
+#include "api/scoped_refptr.h"
+#include "api/test/frame_generator_interface.h"
+#include "api/video/i420_buffer.h"
+#include "common_video/include/i420_buffer_pool.h"
+#include "rtc_base/critical_section.h"
+#include "rtc_base/random.h"
+#include "test/tiled_render_pool.h"
+
+namespace webrtc {
+namespace test {
+
+struct ComplexityFrameGeneratorConfig {
+  // Peak-to-peak amplitude (0-255) of the static texture. The texture moves
+  // with the picture, so motion compensation predicts most of it.
+  int texture_amplitude = 48;
+  // Size in pixels of the texture cells; 1 gives per-pixel detail.
+  int texture_cell_size = 2;
+  // Peak-to-peak amplitude (0-255) of the luma noise added to every frame.
+  // This is new information in each frame and dominates the bitrate.
+  int noise_amplitude = 6;
+  // Pan speed in pixels per frame.
+  int pan_x = 2;
+  int pan_y = 1;
+  // The picture zooms in and out by up to |zoom_amplitude| (at most 0.5),
+  // once every |zoom_period_frames| frames. 0 disables zooming.
+  double zoom_amplitude = 0.1;
+  int zoom_period_frames = 300;
+  // The frame is split into |block_size| blocks, |moving_block_fraction| of
+  // which show content moving on its own motion vector of up to
+  // |max_block_speed| pixels per frame.
+  int block_size = 64;
+  double moving_block_fraction = 0.25;
+  int max_block_speed = 4;
+  // If set, |noise_amplitude| is derived from the bitrate model so that an
+  // encoder running at |target_qp| and |framerate| produces this bitrate.
+  // The model only gets the amplitude close; OnEncodedBitrate() steers it
+  // the rest of the way with what the encoder actually produces.
+  absl::optional<int64_t> target_bitrate_bps;
+  // QP on the H.264 scale (0-51).
+  int target_qp = 32;
+  int framerate = 30;
+  uint32_t seed = 1;
+  // Threads rendering each frame in horizontal bands, the calling one
+  // included.
+  int render_threads = 1;
+};
+
+// ComplexityFrameGenerator produces camera-like content with tunable spatial
+// and temporal complexity, unlike SquareGenerator whose flat frames compress
+// to almost nothing. Each frame is a panning and zooming crop of a large
+// textured picture. Blocks with their own motion vectors are drawn on top,
+// and fresh luma noise is added to every frame.
+class ComplexityFrameGenerator : public FrameGeneratorInterface {
+ public:
+  ComplexityFrameGenerator(int width,
+                           int height,
+                           const ComplexityFrameGeneratorConfig& config);
+  ~ComplexityFrameGenerator() override;
+
+  VideoFrameData NextFrame() override;
+  // Scales the frames to |width|x|height|. The scene keeps the layout it has
+  // at the resolution the generator was created with, so adapting is cheap
+  // and doesn't change what is shown.
+  void ChangeResolution(size_t width, size_t height) override;
+  // Closes the loop on |config.target_bitrate_bps|: the encoder produced
+  // |bitrate_bps| at an average |qp| (H.264 scale; 0 if unknown) over the
+  // last few seconds. The noise amplitude is adjusted so that the bitrate
+  // this implies at |config.target_qp| approaches the target. Does nothing
+  // without a target. May be called on any thread.
+  void OnEncodedBitrate(int64_t bitrate_bps, double qp);
+
+  // Rate model: the bitrate an encoder at |config.target_qp| and
+  // |config.framerate| is expected to produce for |width|x|height| frames,
+  // from the entropy of the residual after the quantizer's dead zone.
+  static double EstimateBitrateBps(const ComplexityFrameGeneratorConfig& config,
+                                   int width,
+                                   int height);
+  // Noise amplitude for which EstimateBitrateBps() reaches
+  // |target_bitrate_bps|, interpolated between whole amplitudes, or 255 if
+  // the target is out of reach.
+  static double NoiseAmplitudeForBitrate(
+      const ComplexityFrameGeneratorConfig& config,
+      int width,
+      int height,
+      double target_bitrate_bps);
+
+ private:
+  struct MovingBlock {
+    int x;
+    int y;
+    int dx;
+    int dy;
+  };
+
+  void CreateWorld() RTC_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+  // Scales the |crop_width|x|crop_height| crop of |src| at (|offset_x|,
+  // |offset_y|), both even, to the size of |dst| on the render threads.
+  void ScaleInBands(const I420BufferInterface& src,
+                    int offset_x,
+                    int offset_y,
+                    int crop_width,
+                    int crop_height,
+                    I420Buffer* dst) RTC_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+  // Adds the luma noise of |frame| to rows [row_begin, row_end) of
+  // |buffer|. Called on the render threads.
+  static void AddNoiseRows(uint32_t seed,
+                           int64_t frame,
+                           double amplitude,
+                           int row_begin,
+                           int row_end,
+                           I420Buffer* buffer);
+  // Draws the parts of |blocks| within rows [row_begin, row_end) of
+  // |buffer|, as they are at |frame|. Called on the render threads.
+  static void DrawMovingBlocks(const I420BufferInterface& world,
+                               const std::vector<MovingBlock>& blocks,
+                               int block_size,
+                               int64_t frame,
+                               int row_begin,
+                               int row_end,
+                               I420Buffer* buffer);
+
+  rtc::CriticalSection lock_;
+  const ComplexityFrameGeneratorConfig config_;
+  // The resolution the generator was created with, which the world, the
+  // blocks and the pan and zoom are laid out for.
+  const int picture_width_;
+  const int picture_height_;
+  // The output resolution.
+  int width_ RTC_GUARDED_BY(lock_);
+  int height_ RTC_GUARDED_BY(lock_);
+  double noise_amplitude_ RTC_GUARDED_BY(lock_);
+  // The target is scaled by this before the model is inverted, to make up
+  // for the model's error as measured by OnEncodedBitrate().
+  double rate_correction_ RTC_GUARDED_BY(lock_);
+  double correction_gain_ RTC_GUARDED_BY(lock_);
+  int64_t correction_steps_ RTC_GUARDED_BY(lock_);
+  // Whether the last measurement was above the target.
+  bool last_error_above_ RTC_GUARDED_BY(lock_);
+  int64_t frame_count_ RTC_GUARDED_BY(lock_);
+  Random random_generator_ RTC_GUARDED_BY(lock_);
+  // The picture the frames are cropped from, twice the size of
+  // |picture_width_| x |picture_height_|.
+  rtc::scoped_refptr<I420Buffer> world_ RTC_GUARDED_BY(lock_);
+  std::vector<MovingBlock> blocks_ RTC_GUARDED_BY(lock_);
+  I420BufferPool buffer_pool_ RTC_GUARDED_BY(lock_);
+  // Frames at the picture's resolution, while the output is scaled.
+  I420BufferPool picture_pool_ RTC_GUARDED_BY(lock_);
+  // Crops scaled horizontally, by ScaleInBands(). Only grows, in either
+  // dimension, as the crop changes size with every zoomed frame and a scaled
+  // output uses it twice per frame at different widths.
+  rtc::scoped_refptr<I420Buffer> scaled_rows_ RTC_GUARDED_BY(lock_);
+  TiledRenderPool render_pool_;
+};
+
+}  // namespace test
+}  // namespace webrtc
+
+#endif  // TEST_COMPLEXITY_FRAME_GENERATOR_H_
@@ -11,9 +11,12 @@
 
 #include <string.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdio>
+#include <limits>
 #include <memory>
+#include <vector>
 
 #include "api/video/i010_buffer.h"
 #include "api/video/video_rotation.h"
@@ -32,6 +35,61 @@ namespace {
 void KeepBufferRefs(rtc::scoped_refptr<webrtc::VideoFrameBuffer>,
                     rtc::scoped_refptr<webrtc::VideoFrameBuffer>) {}
 
+// A |length| x |length| square with its top left corner at (x, y).
+struct ColoredSquare {
+  int x;
+  int y;
+  int length;
+  uint8_t yuv_y;
+  uint8_t yuv_u;
+  uint8_t yuv_v;
+};
+
+// First row at or below |row_begin| with the parity of |square.y|, so a
+// square clipped to a band writes the same chroma rows as an unclipped one.
+int FirstSquareRow(const ColoredSquare& square, int row_begin) {
+  if (square.y >= row_begin)
+    return square.y;
+  return row_begin + ((row_begin - square.y) & 1);
+}
+
+// Draws the part of |square| within rows [row_begin, row_end).
+void DrawI420Square(I420Buffer* buffer,
+                    const ColoredSquare& square,
+                    int row_begin,
+                    int row_end) {
+  const int first_row = FirstSquareRow(square, row_begin);
+  const int end_row = std::min(square.y + square.length, row_end);
+  for (int yy = first_row; yy < end_row; ++yy) {
+    uint8_t* pos_y =
+        buffer->MutableDataY() + square.x + yy * buffer->StrideY();
+    memset(pos_y, square.yuv_y, square.length);
+  }
+  for (int yy = first_row; yy < end_row; yy += 2) {
+    uint8_t* pos_u =
+        buffer->MutableDataU() + square.x / 2 + yy / 2 * buffer->StrideU();
+    memset(pos_u, square.yuv_u, square.length / 2);
+    uint8_t* pos_v =
+        buffer->MutableDataV() + square.x / 2 + yy / 2 * buffer->StrideV();
+    memset(pos_v, square.yuv_v, square.length / 2);
+  }
+}
+
+// Scales |buffer| to |width|x|height| into a buffer from |pool|.
+rtc::scoped_refptr<VideoFrameBuffer> ScaleBuffer(
+    const rtc::scoped_refptr<VideoFrameBuffer>& buffer,
+    int width,
+    int height,
+    I420BufferPool* pool) {
+  if (buffer->width() == width && buffer->height() == height)
+    return buffer;
+  rtc::scoped_refptr<I420Buffer> scaled = pool->CreateBuffer(width, height);
+  if (!scaled)
+    scaled = I420Buffer::Create(width, height);
+  scaled->ScaleFrom(*buffer->ToI420());
+  return scaled;
+}
+
 }  // namespace
 
 SquareGenerator::SquareGenerator(int width,
@@ -46,11 +104,9 @@ SquareGenerator::SquareGenerator(int width,
 }
 
 void SquareGenerator::ChangeResolution(size_t width, size_t height) {
-  rtc::CritScope lock(&crit_);
-  width_ = static_cast<int>(width);
-  height_ = static_cast<int>(height);
-  RTC_CHECK(width_ > 0);
-  RTC_CHECK(height_ > 0);
+  RTC_CHECK(width > 0 && width <= std::numeric_limits<uint32_t>::max());
+  RTC_CHECK(height > 0 && height <= std::numeric_limits<uint32_t>::max());
+  resolution_ = static_cast<uint64_t>(width) << 32 | height;
 }
 
 rtc::scoped_refptr<I420Buffer> SquareGenerator::CreateI420Buffer(int width,
@@ -65,20 +121,22 @@ rtc::scoped_refptr<I420Buffer> SquareGenerator::CreateI420Buffer(int width,
 }
 
 FrameGeneratorInterface::VideoFrameData SquareGenerator::NextFrame() {
-  rtc::CritScope lock(&crit_);
+  const uint64_t resolution = resolution_;
+  const int width = static_cast<int>(resolution >> 32);
+  const int height = static_cast<int>(resolution & 0xffffffff);
 
   rtc::scoped_refptr<VideoFrameBuffer> buffer = nullptr;
   switch (type_) {
     case OutputType::kI420:
     case OutputType::kI010: {
-      buffer = CreateI420Buffer(width_, height_);
+      buffer = CreateI420Buffer(width, height);
       break;
     }
     case OutputType::kI420A: {
       rtc::scoped_refptr<I420Buffer> yuv_buffer =
-          CreateI420Buffer(width_, height_);
+          CreateI420Buffer(width, height);
       rtc::scoped_refptr<I420Buffer> axx_buffer =
-          CreateI420Buffer(width_, height_);
+          CreateI420Buffer(width, height);
       buffer = WrapI420ABuffer(
           yuv_buffer->width(), yuv_buffer->height(), yuv_buffer->DataY(),
           yuv_buffer->StrideY(), yuv_buffer->DataU(), yuv_buffer->StrideU(),
@@ -111,15 +169,20 @@ SquareGenerator::Square::Square(int width, int height, int seed)
       yuv_v_(random_generator_.Rand(0, 255)),
       yuv_a_(random_generator_.Rand(0, 255)) {}
 
+int SquareGenerator::Square::Move(int width, int height) {
+  int length_cap = std::min(height, width) / 4;
+  int length = std::min(length_, length_cap);
+  x_ = (x_ + random_generator_.Rand(0, 4)) % (width - length);
+  y_ = (y_ + random_generator_.Rand(0, 4)) % (height - length);
+  return length;
+}
+
 void SquareGenerator::Square::Draw(
     const rtc::scoped_refptr<VideoFrameBuffer>& frame_buffer) {
   RTC_DCHECK(frame_buffer->type() == VideoFrameBuffer::Type::kI420 ||
              frame_buffer->type() == VideoFrameBuffer::Type::kI420A);
   rtc::scoped_refptr<I420BufferInterface> buffer = frame_buffer->ToI420();
-  int length_cap = std::min(buffer->height(), buffer->width()) / 4;
-  int length = std::min(length_, length_cap);
-  x_ = (x_ + random_generator_.Rand(0, 4)) % (buffer->width() - length);
-  y_ = (y_ + random_generator_.Rand(0, 4)) % (buffer->height() - length);
+  int length = Move(buffer->width(), buffer->height());
   for (int y = y_; y < y_ + length; ++y) {
     uint8_t* pos_y =
         (const_cast<uint8_t*>(buffer->DataY()) + x_ + y * buffer->StrideY());
@@ -161,7 +224,10 @@ YuvFileGenerator::YuvFileGenerator(std::vector<FILE*> files,
                                  static_cast<int>(height_))),
       frame_buffer_(new uint8_t[frame_size_]),
       frame_display_count_(frame_repeat_count),
-      current_display_count_(0) {
+      current_display_count_(0),
+      output_width_(static_cast<int>(width)),
+      output_height_(static_cast<int>(height)),
+      scale_pool_(/*zero_initialize=*/false) {
   RTC_DCHECK_GT(width, 0);
   RTC_DCHECK_GT(height, 0);
   RTC_DCHECK_GT(frame_repeat_count, 0);
@@ -179,14 +245,32 @@ FrameGeneratorInterface::VideoFrameData YuvFileGenerator::NextFrame() {
     const bool got_new_frame = ReadNextFrame();
     // Full update on a new frame from file.
     if (got_new_frame) {
-      update_rect = VideoFrame::UpdateRect{0, 0, static_cast<int>(width_),
-                                           static_cast<int>(height_)};
+      update_rect =
+          VideoFrame::UpdateRect{0, 0, output_width_, output_height_};
+      scaled_buffer_ = nullptr;
     }
   }
   if (++current_display_count_ >= frame_display_count_)
     current_display_count_ = 0;
 
-  return VideoFrameData(last_read_buffer_, update_rect);
+  if (output_width_ == static_cast<int>(width_) &&
+      output_height_ == static_cast<int>(height_)) {
+    return VideoFrameData(last_read_buffer_, update_rect);
+  }
+  if (!scaled_buffer_) {
+    scaled_buffer_ = ScaleBuffer(last_read_buffer_, output_width_,
+                                 output_height_, &scale_pool_);
+    update_rect = VideoFrame::UpdateRect{0, 0, output_width_, output_height_};
+  }
+  return VideoFrameData(scaled_buffer_, update_rect);
+}
+
+void YuvFileGenerator::ChangeResolution(size_t width, size_t height) {
+  output_width_ = static_cast<int>(width);
+  output_height_ = static_cast<int>(height);
+  RTC_CHECK_GT(output_width_, 0);
+  RTC_CHECK_GT(output_height_, 0);
+  scaled_buffer_ = nullptr;
 }
 
 bool YuvFileGenerator::ReadNextFrame() {
@@ -209,12 +293,17 @@ bool YuvFileGenerator::ReadNextFrame() {
   return frame_index_ != prev_frame_index || file_index_ != prev_file_index;
 }
 
-SlideGenerator::SlideGenerator(int width, int height, int frame_repeat_count)
+SlideGenerator::SlideGenerator(int width,
+                               int height,
+                               int frame_repeat_count,
+                               int render_threads)
     : width_(width),
       height_(height),
       frame_display_count_(frame_repeat_count),
       current_display_count_(0),
-      random_generator_(1234) {
+      random_generator_(1234),
+      render_pool_(render_threads),
+      scale_pool_(/*zero_initialize=*/false) {
   RTC_DCHECK_GT(width, 0);
   RTC_DCHECK_GT(height, 0);
   RTC_DCHECK_GT(frame_repeat_count, 0);
@@ -229,18 +318,23 @@ FrameGeneratorInterface::VideoFrameData SlideGenerator::NextFrame() {
   return VideoFrameData(buffer_, absl::nullopt);
 }
 
+void SlideGenerator::ChangeResolution(size_t width, size_t height) {
+  width_ = static_cast<int>(width);
+  height_ = static_cast<int>(height);
+  RTC_CHECK_GT(width_, 0);
+  RTC_CHECK_GT(height_, 0);
+  if (buffer_)
+    buffer_ = ScaleBuffer(buffer_, width_, height_, &scale_pool_);
+}
+
 void SlideGenerator::GenerateNewFrame() {
   // The squares should have a varying order of magnitude in order
   // to simulate variation in the slides' complexity.
   const int kSquareNum = 1 << (4 + (random_generator_.Rand(0, 3) * 2));
 
-  buffer_ = I420Buffer::Create(width_, height_);
-  memset(buffer_->MutableDataY(), 127, height_ * buffer_->StrideY());
-  memset(buffer_->MutableDataU(), 127,
-         buffer_->ChromaHeight() * buffer_->StrideU());
-  memset(buffer_->MutableDataV(), 127,
-         buffer_->ChromaHeight() * buffer_->StrideV());
-
+  // The squares are laid out first, so the random sequence does not depend
+  // on how the frame is split into bands.
+  std::vector<ColoredSquare> squares(kSquareNum);
   for (int i = 0; i < kSquareNum; ++i) {
     int length = random_generator_.Rand(1, width_ > 4 ? width_ / 4 : 1);
     // Limit the length of later squares so that they don't overwrite the
@@ -252,20 +346,25 @@ void SlideGenerator::GenerateNewFrame() {
     uint8_t yuv_y = random_generator_.Rand(0, 255);
     uint8_t yuv_u = random_generator_.Rand(0, 255);
     uint8_t yuv_v = random_generator_.Rand(0, 255);
-
-    for (int yy = y; yy < y + length; ++yy) {
-      uint8_t* pos_y = (buffer_->MutableDataY() + x + yy * buffer_->StrideY());
-      memset(pos_y, yuv_y, length);
-    }
-    for (int yy = y; yy < y + length; yy += 2) {
-      uint8_t* pos_u =
-          (buffer_->MutableDataU() + x / 2 + yy / 2 * buffer_->StrideU());
-      memset(pos_u, yuv_u, length / 2);
-      uint8_t* pos_v =
-          (buffer_->MutableDataV() + x / 2 + yy / 2 * buffer_->StrideV());
-      memset(pos_v, yuv_v, length / 2);
-    }
+    squares[i] = {x, y, length, yuv_y, yuv_u, yuv_v};
   }
+
+  rtc::scoped_refptr<I420Buffer> i420_buffer =
+      I420Buffer::Create(width_, height_);
+  I420Buffer* buffer = i420_buffer.get();
+  render_pool_.Render(height_, [&](int row_begin, int row_end) {
+    memset(buffer->MutableDataY() + row_begin * buffer->StrideY(), 127,
+           (row_end - row_begin) * buffer->StrideY());
+    const int chroma_begin = row_begin / 2;
+    const int chroma_end = (row_end + 1) / 2;
+    memset(buffer->MutableDataU() + chroma_begin * buffer->StrideU(), 127,
+           (chroma_end - chroma_begin) * buffer->StrideU());
+    memset(buffer->MutableDataV() + chroma_begin * buffer->StrideV(), 127,
+           (chroma_end - chroma_begin) * buffer->StrideV());
+    for (const ColoredSquare& square : squares)
+      DrawI420Square(buffer, square, row_begin, row_end);
+  });
+  buffer_ = i420_buffer;
 }
 
 ScrollingImageFrameGenerator::ScrollingImageFrameGenerator(
@@ -284,10 +383,16 @@ ScrollingImageFrameGenerator::ScrollingImageFrameGenerator(
       num_frames_(files.size()),
       target_width_(static_cast<int>(target_width)),
       target_height_(static_cast<int>(target_height)),
+      output_width_(target_width_),
+      output_height_(target_height_),
+      scale_pool_(/*zero_initialize=*/false),
       current_frame_num_(num_frames_ - 1),
       prev_frame_not_scrolled_(false),
       current_source_frame_(nullptr, absl::nullopt),
       current_frame_(nullptr, absl::nullopt),
+      cropped_source_(nullptr),
+      cropped_x_(0),
+      cropped_y_(0),
       file_generator_(files, source_width, source_height, 1) {
   RTC_DCHECK(clock_ != nullptr);
   RTC_DCHECK_GT(num_frames_, 0);
@@ -325,13 +430,23 @@ ScrollingImageFrameGenerator::NextFrame() {
   if (!same_scroll_position) {
     // If scrolling is not finished yet, force full frame update.
     current_frame_.update_rect =
-        VideoFrame::UpdateRect{0, 0, target_width_, target_height_};
+        VideoFrame::UpdateRect{0, 0, output_width_, output_height_};
   }
   prev_frame_not_scrolled_ = cur_frame_not_scrolled;
 
   return current_frame_;
 }
 
+void ScrollingImageFrameGenerator::ChangeResolution(size_t width,
+                                                    size_t height) {
+  output_width_ = static_cast<int>(width);
+  output_height_ = static_cast<int>(height);
+  RTC_CHECK_GT(output_width_, 0);
+  RTC_CHECK_GT(output_height_, 0);
+  // The next frame is a full update.
+  prev_frame_not_scrolled_ = false;
+}
+
 void ScrollingImageFrameGenerator::UpdateSourceFrame(size_t frame_num) {
   VideoFrame::UpdateRect acc_update{0, 0, 0, 0};
   while (current_frame_num_ != frame_num) {
@@ -353,6 +468,24 @@ void ScrollingImageFrameGenerator::CropSourceToScrolledImage(
   int pixels_scrolled_y =
       static_cast<int>(scroll_margin_y * scroll_factor + 0.5);
 
+  VideoFrame::UpdateRect update_rect =
+      current_source_frame_.update_rect->IsEmpty()
+          ? VideoFrame::UpdateRect{0, 0, 0, 0}
+          : VideoFrame::UpdateRect{0, 0, output_width_, output_height_};
+  // While the crop stays, e.g. during the pause, the frame is not scaled
+  // again.
+  if (current_frame_.buffer &&
+      cropped_source_ == current_source_frame_.buffer.get() &&
+      cropped_x_ == pixels_scrolled_x && cropped_y_ == pixels_scrolled_y &&
+      current_frame_.buffer->width() == output_width_ &&
+      current_frame_.buffer->height() == output_height_) {
+    current_frame_.update_rect = update_rect;
+    return;
+  }
+  cropped_source_ = current_source_frame_.buffer.get();
+  cropped_x_ = pixels_scrolled_x;
+  cropped_y_ = pixels_scrolled_y;
+
   rtc::scoped_refptr<I420BufferInterface> i420_buffer =
       current_source_frame_.buffer->ToI420();
   int offset_y =
@@ -362,16 +495,14 @@ void ScrollingImageFrameGenerator::CropSourceToScrolledImage(
   int offset_v = (i420_buffer->StrideV() * (pixels_scrolled_y / 2)) +
                  (pixels_scrolled_x / 2);
 
-  VideoFrame::UpdateRect update_rect =
-      current_source_frame_.update_rect->IsEmpty()
-          ? VideoFrame::UpdateRect{0, 0, 0, 0}
-          : VideoFrame::UpdateRect{0, 0, target_width_, target_height_};
+  rtc::scoped_refptr<VideoFrameBuffer> cropped_buffer = WrapI420Buffer(
+      target_width_, target_height_, &i420_buffer->DataY()[offset_y],
+      i420_buffer->StrideY(), &i420_buffer->DataU()[offset_u],
+      i420_buffer->StrideU(), &i420_buffer->DataV()[offset_v],
+      i420_buffer->StrideV(), KeepRefUntilDone(i420_buffer));
+  // Without a resolution change the output is a zero-copy view of the source.
   current_frame_ = VideoFrameData(
-      WrapI420Buffer(target_width_, target_height_,
-                     &i420_buffer->DataY()[offset_y], i420_buffer->StrideY(),
-                     &i420_buffer->DataU()[offset_u], i420_buffer->StrideU(),
-                     &i420_buffer->DataV()[offset_v], i420_buffer->StrideV(),
-                     KeepRefUntilDone(i420_buffer)),
+      ScaleBuffer(cropped_buffer, output_width_, output_height_, &scale_pool_),
       update_rect);
 }
 
@@ -10,6 +10,7 @@
 #ifndef TEST_FRAME_GENERATOR_H_
 #define TEST_FRAME_GENERATOR_H_
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <vector>
@@ -20,9 +21,10 @@
 #include "api/video/video_frame.h"
 #include "api/video/video_frame_buffer.h"
 #include "api/video/video_source_interface.h"
-#include "rtc_base/critical_section.h"
+#include "common_video/include/i420_buffer_pool.h"
 #include "rtc_base/random.h"
 #include "system_wrappers/include/clock.h"
+#include "test/tiled_render_pool.h"
 
 namespace webrtc {
 namespace test {
@@ -47,6 +49,10 @@ class SquareGenerator : public FrameGeneratorInterface {
     void Draw(const rtc::scoped_refptr<VideoFrameBuffer>& frame_buffer);
 
    private:
+    // Moves the square slightly and returns its side length, capped to fit a
+    // frame of the given size.
+    int Move(int width, int height);
+
     Random random_generator_;
     int x_;
     int y_;
@@ -57,11 +63,13 @@ class SquareGenerator : public FrameGeneratorInterface {
     const uint8_t yuv_a_;
   };
 
-  rtc::CriticalSection crit_;
   const OutputType type_;
-  int width_ RTC_GUARDED_BY(&crit_);
-  int height_ RTC_GUARDED_BY(&crit_);
-  std::vector<std::unique_ptr<Square>> squares_ RTC_GUARDED_BY(&crit_);
+  // Width in the upper and height in the lower 32 bits, so that
+  // ChangeResolution() never blocks NextFrame() and a frame never sees half
+  // of a change.
+  std::atomic<uint64_t> resolution_;
+  // Only used by NextFrame().
+  std::vector<std::unique_ptr<Square>> squares_;
 };
 
 class YuvFileGenerator : public FrameGeneratorInterface {
@@ -74,9 +82,8 @@ class YuvFileGenerator : public FrameGeneratorInterface {
   ~YuvFileGenerator();
 
   VideoFrameData NextFrame() override;
-  void ChangeResolution(size_t width, size_t height) override {
-    RTC_NOTREACHED();
-  }
+  // Frames are still read at the file's resolution and then scaled.
+  void ChangeResolution(size_t width, size_t height) override;
 
  private:
   // Returns true if the new frame was loaded.
@@ -93,31 +100,42 @@ class YuvFileGenerator : public FrameGeneratorInterface {
   const int frame_display_count_;
   int current_display_count_;
   rtc::scoped_refptr<I420Buffer> last_read_buffer_;
+  int output_width_;
+  int output_height_;
+  // |last_read_buffer_| scaled to the output resolution, if that differs.
+  rtc::scoped_refptr<VideoFrameBuffer> scaled_buffer_;
+  I420BufferPool scale_pool_;
 };
 
 // SlideGenerator works similarly to YuvFileGenerator but it fills the frames
 // with randomly sized and colored squares instead of reading their content
 // from files.
+// Slides are rendered in bands on |render_threads| threads.
 class SlideGenerator : public FrameGeneratorInterface {
  public:
-  SlideGenerator(int width, int height, int frame_repeat_count);
+  SlideGenerator(int width,
+                 int height,
+                 int frame_repeat_count,
+                 int render_threads = 1);
 
   VideoFrameData NextFrame() override;
-  void ChangeResolution(size_t width, size_t height) override {
-    RTC_NOTREACHED();
-  }
+  // Scales the current slide; the following ones are rendered at the new
+  // resolution.
+  void ChangeResolution(size_t width, size_t height) override;
 
  private:
   // Generates some randomly sized and colored squares scattered
   // over the frame.
   void GenerateNewFrame();
 
-  const int width_;
-  const int height_;
+  int width_;
+  int height_;
   const int frame_display_count_;
   int current_display_count_;
   Random random_generator_;
-  rtc::scoped_refptr<I420Buffer> buffer_;
+  rtc::scoped_refptr<VideoFrameBuffer> buffer_;
+  TiledRenderPool render_pool_;
+  I420BufferPool scale_pool_;
 };
 
 class ScrollingImageFrameGenerator : public FrameGeneratorInterface {
@@ -133,9 +151,9 @@ class ScrollingImageFrameGenerator : public FrameGeneratorInterface {
   ~ScrollingImageFrameGenerator() override = default;
 
   VideoFrameData NextFrame() override;
-  void ChangeResolution(size_t width, size_t height) override {
-    RTC_NOTREACHED();
-  }
+  // The scrolled window keeps its size in the source image; it is scaled to
+  // |width|x|height|.
+  void ChangeResolution(size_t width, size_t height) override;
 
  private:
   void UpdateSourceFrame(size_t frame_num);
@@ -148,11 +166,18 @@ class ScrollingImageFrameGenerator : public FrameGeneratorInterface {
   const size_t num_frames_;
   const int target_width_;
   const int target_height_;
+  int output_width_;
+  int output_height_;
+  I420BufferPool scale_pool_;
 
   size_t current_frame_num_;
   bool prev_frame_not_scrolled_;
   VideoFrameData current_source_frame_;
   VideoFrameData current_frame_;
+  // The source frame and scroll offset |current_frame_| was cropped from.
+  const VideoFrameBuffer* cropped_source_;
+  int cropped_x_;
+  int cropped_y_;
   YuvFileGenerator file_generator_;
 };
 
@@ -12,6 +12,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdlib>
 #include <limits>
 #include <memory>
 #include <utility>
@@ -24,6 +25,7 @@
 #include "rtc_base/logging.h"
 #include "rtc_base/task_queue.h"
 #include "rtc_base/time_utils.h"
+#include "rtc_base/trace_event.h"
 #include "system_wrappers/include/clock.h"
 #include "test/testsupport/file_utils.h"
 
@@ -42,25 +44,90 @@ std::string TransformFilePath(std::string path) {
   }
   return path;
 }
+
+// Mirrors cricket::VideoAdapter, which steps the resolution down by
+// alternately 3/4 and 2/3 and picks the step closest to the target pixel
+// count. A frame at the resulting size passes through the adapter unscaled.
+void ScaleForSinkWants(int width,
+                       int height,
+                       const rtc::VideoSinkWants& wants,
+                       int* out_width,
+                       int* out_height) {
+  *out_width = width;
+  *out_height = height;
+  const int64_t input_pixels = static_cast<int64_t>(width) * height;
+  const int64_t max_pixels = wants.max_pixel_count;
+  const int64_t target_pixels =
+      std::min<int64_t>(wants.target_pixel_count.value_or(max_pixels),
+                        max_pixels);
+  if (target_pixels >= input_pixels)
+    return;
+
+  int numerator = 1;
+  int denominator = 1;
+  int best_numerator = 1;
+  int best_denominator = 1;
+  int64_t min_pixel_diff = std::numeric_limits<int64_t>::max();
+  if (input_pixels <= max_pixels)
+    min_pixel_diff = std::abs(input_pixels - target_pixels);
+  while (input_pixels * numerator * numerator /
+             (denominator * denominator) >
+         target_pixels) {
+    if (numerator % 3 == 0 && denominator % 2 == 0) {
+      numerator /= 3;
+      denominator /= 2;
+    } else {
+      numerator *= 3;
+      denominator *= 4;
+    }
+    const int64_t output_pixels =
+        input_pixels * numerator * numerator / (denominator * denominator);
+    if (output_pixels <= max_pixels &&
+        std::abs(target_pixels - output_pixels) < min_pixel_diff) {
+      min_pixel_diff = std::abs(target_pixels - output_pixels);
+      best_numerator = numerator;
+      best_denominator = denominator;
+    }
+  }
+  // Even dimensions keep the chroma planes aligned with the luma plane.
+  *out_width = std::max(2, width * best_numerator / best_denominator & ~1);
+  *out_height = std::max(2, height * best_numerator / best_denominator & ~1);
+}
 }  // namespace
 
+constexpr TimeDelta FrameGeneratorCapturer::kLateFrameThreshold;
+
 FrameGeneratorCapturer::FrameGeneratorCapturer(
     Clock* clock,
     std::unique_ptr<FrameGeneratorInterface> frame_generator,
-    int target_fps,
+    double target_fps,
     TaskQueueFactory& task_queue_factory)
     : clock_(clock),
       sending_(true),
       sink_wants_observer_(nullptr),
       frame_generator_(std::move(frame_generator)),
-      source_fps_(target_fps),
-      target_capture_fps_(target_fps),
+      source_width_(0),
+      source_height_(0),
+      output_width_(0),
+      output_height_(0),
+      schedule_start_(Timestamp::Zero()),
+      schedule_fps_(target_fps),
+      next_frame_index_(0),
+      frames_metric_(nullptr),
+      skipped_frames_metric_(nullptr),
+      late_frames_metric_(nullptr),
+      lateness_ms_metric_(nullptr),
+      frame_duration_us_metric_(nullptr),
       first_frame_capture_time_(-1),
       task_queue_(task_queue_factory.CreateTaskQueue(
           "FrameGenCapQ",
           TaskQueueFactory::Priority::HIGH)) {
   RTC_DCHECK(frame_generator_);
   RTC_DCHECK_GT(target_fps, 0);
+  auto config = std::make_shared<FrameConfig>();
+  config->source_fps = target_fps;
+  config->target_capture_fps = target_fps;
+  frame_config_ = std::move(config);
 }
 
 FrameGeneratorCapturer::~FrameGeneratorCapturer() {
@@ -81,12 +148,12 @@ std::unique_ptr<FrameGeneratorCapturer> FrameGeneratorCapturer::Create(
     Clock* clock,
     TaskQueueFactory& task_queue_factory,
     FrameGeneratorCapturerConfig::SquareSlides config) {
+  int frame_repeat_count =
+      config.change_interval.seconds<double>() * config.framerate;
   return std::make_unique<FrameGeneratorCapturer>(
       clock,
-      CreateSlideFrameGenerator(
-          config.width, config.height,
-          /*frame_repeat_count*/ config.change_interval.seconds<double>() *
-              config.framerate),
+      CreateSlideFrameGenerator(config.width, config.height,
+                                frame_repeat_count, config.render_threads),
       config.framerate, task_queue_factory);
 }
 std::unique_ptr<FrameGeneratorCapturer> FrameGeneratorCapturer::Create(
@@ -102,6 +169,16 @@ std::unique_ptr<FrameGeneratorCapturer> FrameGeneratorCapturer::Create(
       config.framerate, task_queue_factory);
 }
 
+std::unique_ptr<FrameGeneratorCapturer> FrameGeneratorCapturer::Create(
+    Clock* clock,
+    TaskQueueFactory& task_queue_factory,
+    FrameGeneratorCapturerConfig::Lz4File config) {
+  return std::make_unique<FrameGeneratorCapturer>(
+      clock,
+      CreateFromLz4FileFrameGenerator(config.name, config.prefetch_frames),
+      config.framerate, task_queue_factory);
+}
+
 std::unique_ptr<FrameGeneratorCapturer> FrameGeneratorCapturer::Create(
     Clock* clock,
     TaskQueueFactory& task_queue_factory,
@@ -132,14 +209,29 @@ std::unique_ptr<FrameGeneratorCapturer> FrameGeneratorCapturer::Create(
       clock, std::move(slides_generator), config.framerate, task_queue_factory);
 }
 
+std::unique_ptr<FrameGeneratorCapturer> FrameGeneratorCapturer::Create(
+    Clock* clock,
+    TaskQueueFactory& task_queue_factory,
+    FrameGeneratorCapturerConfig::ComplexityVideo config) {
+  return std::make_unique<FrameGeneratorCapturer>(
+      clock,
+      std::make_unique<ComplexityFrameGenerator>(config.width, config.height,
+                                                 config.generator),
+      config.generator.framerate, task_queue_factory);
+}
+
 std::unique_ptr<FrameGeneratorCapturer> FrameGeneratorCapturer::Create(
     Clock* clock,
     TaskQueueFactory& task_queue_factory,
     const FrameGeneratorCapturerConfig& config) {
   if (config.video_file) {
     return Create(clock, task_queue_factory, *config.video_file);
+  } else if (config.lz4_file) {
+    return Create(clock, task_queue_factory, *config.lz4_file);
   } else if (config.image_slides) {
     return Create(clock, task_queue_factory, *config.image_slides);
+  } else if (config.complexity_video) {
+    return Create(clock, task_queue_factory, *config.complexity_video);
   } else if (config.squares_slides) {
     return Create(clock, task_queue_factory, *config.squares_slides);
   } else {
@@ -149,15 +241,57 @@ std::unique_ptr<FrameGeneratorCapturer> FrameGeneratorCapturer::Create(
   }
 }
 
+double FrameGeneratorCapturer::FrameConfig::framerate() const {
+  if (wanted_fps && *wanted_fps < target_capture_fps)
+    return *wanted_fps;
+  return target_capture_fps;
+}
+
+std::shared_ptr<FrameGeneratorCapturer::FrameConfig>
+FrameGeneratorCapturer::CopyFrameConfig() const {
+  return std::make_shared<FrameConfig>(*std::atomic_load(&frame_config_));
+}
+
+void FrameGeneratorCapturer::PublishFrameConfig(
+    std::shared_ptr<FrameConfig> config) {
+  std::atomic_store(&frame_config_,
+                    std::shared_ptr<const FrameConfig>(std::move(config)));
+}
+
 void FrameGeneratorCapturer::SetFakeRotation(VideoRotation rotation) {
   rtc::CritScope cs(&lock_);
-  fake_rotation_ = rotation;
+  std::shared_ptr<FrameConfig> config = CopyFrameConfig();
+  config->rotation = rotation;
+  PublishFrameConfig(std::move(config));
 }
 
 void FrameGeneratorCapturer::SetFakeColorSpace(
     absl::optional<ColorSpace> color_space) {
   rtc::CritScope cs(&lock_);
-  fake_color_space_ = color_space;
+  std::shared_ptr<FrameConfig> config = CopyFrameConfig();
+  config->color_space = color_space;
+  PublishFrameConfig(std::move(config));
+}
+
+void FrameGeneratorCapturer::SetPhase(double phase) {
+  RTC_CHECK(phase >= 0 && phase < 1);
+  rtc::CritScope cs(&lock_);
+  std::shared_ptr<FrameConfig> config = CopyFrameConfig();
+  config->phase = phase;
+  PublishFrameConfig(std::move(config));
+}
+
+void FrameGeneratorCapturer::SetMetricsRegistry(MetricsRegistry* registry) {
+  TestVideoCapturer::SetMetricsRegistry(registry);
+  frames_metric_ = registry->GetCounter("capturer_frames_total");
+  skipped_frames_metric_ =
+      registry->GetCounter("capturer_skipped_frames_total");
+  late_frames_metric_ = registry->GetCounter("capturer_late_frames_total");
+  lateness_ms_metric_ = registry->GetHistogram(
+      "capturer_lateness_ms", {1, 2, 5, 10, 20, 50, 100});
+  frame_duration_us_metric_ = registry->GetHistogram(
+      "capturer_frame_duration_us",
+      {1000, 2000, 5000, 10000, 20000, 33000, 50000, 100000});
 }
 
 bool FrameGeneratorCapturer::Init() {
@@ -166,82 +300,189 @@ bool FrameGeneratorCapturer::Init() {
   if (frame_generator_.get() == nullptr)
     return false;
 
+  const Timestamp now = clock_->CurrentTime();
+  ResetSchedule(now, GetCurrentConfiguredFramerate());
+  next_frame_index_ = 1;
   frame_task_ = RepeatingTaskHandle::DelayedStart(
-      task_queue_.Get(),
-      TimeDelta::Seconds(1) / GetCurrentConfiguredFramerate(), [this] {
-        InsertFrame();
-        return TimeDelta::Seconds(1) / GetCurrentConfiguredFramerate();
-      });
+      task_queue_.Get(), FrameDeadline(1) - now,
+      [this] { return OnFrameTick(); });
   return true;
 }
 
-void FrameGeneratorCapturer::InsertFrame() {
-  rtc::CritScope cs(&lock_);
+void FrameGeneratorCapturer::ResetSchedule(Timestamp start, double fps) {
+  absl::optional<double> phase = std::atomic_load(&frame_config_)->phase;
+  if (phase) {
+    const double interval_us = rtc::kNumMicrosecsPerSec / fps;
+    const double offset_us = *phase * interval_us;
+    const double intervals = std::ceil((start.us() - offset_us) / interval_us);
+    start =
+        Timestamp::Micros(std::llround(intervals * interval_us + offset_us));
+  }
+  schedule_start_ = start;
+  schedule_fps_ = fps;
+  next_frame_index_ = 0;
+}
+
+Timestamp FrameGeneratorCapturer::FrameDeadline(int64_t frame_index) const {
+  return schedule_start_ +
+         TimeDelta::Micros(std::llround(frame_index *
+                                        rtc::kNumMicrosecsPerSec /
+                                        schedule_fps_));
+}
+
+TimeDelta FrameGeneratorCapturer::OnFrameTick() {
+  const Timestamp deadline = FrameDeadline(next_frame_index_);
   if (sending_) {
-    FrameGeneratorInterface::VideoFrameData frame_data =
-        frame_generator_->NextFrame();
-    // TODO(srte): Use more advanced frame rate control to allow arbritrary
-    // fractions.
-    int decimation =
-        std::round(static_cast<double>(source_fps_) / target_capture_fps_);
-    for (int i = 1; i < decimation; ++i)
-      frame_data = frame_generator_->NextFrame();
-
-    VideoFrame frame = VideoFrame::Builder()
-                           .set_video_frame_buffer(frame_data.buffer)
-                           .set_rotation(fake_rotation_)
-                           .set_timestamp_us(clock_->TimeInMicroseconds())
-                           .set_ntp_time_ms(clock_->CurrentNtpInMilliseconds())
-                           .set_update_rect(frame_data.update_rect)
-                           .set_color_space(fake_color_space_)
-                           .build();
-    if (first_frame_capture_time_ == -1) {
-      first_frame_capture_time_ = frame.ntp_time_ms();
+    const TimeDelta lateness =
+        std::max(clock_->CurrentTime() - deadline, TimeDelta::Zero());
+    if (frames_metric_) {
+      frames_metric_->Add();
+      lateness_ms_metric_->Add(lateness.ms());
+      if (lateness > kLateFrameThreshold)
+        late_frames_metric_->Add();
     }
+    rtc::CritScope cs(&stats_lock_);
+    ++scheduling_stats_.frames;
+    scheduling_stats_.total_lateness += lateness;
+    scheduling_stats_.max_lateness =
+        std::max(scheduling_stats_.max_lateness, lateness);
+    if (lateness > kLateFrameThreshold)
+      ++scheduling_stats_.late_frames;
+  }
+
+  const int64_t insert_start_us =
+      frame_duration_us_metric_ ? rtc::TimeMicros() : 0;
+  InsertFrame();
+  if (frame_duration_us_metric_)
+    frame_duration_us_metric_->Add(rtc::TimeMicros() - insert_start_us);
 
-    TestVideoCapturer::OnFrame(frame);
+  const double framerate = GetCurrentConfiguredFramerate();
+  bool advance = true;
+  if (framerate != schedule_fps_) {
+    ResetSchedule(deadline, framerate);
+    // With a phase, the new grid may start after this frame, and its frame 0
+    // is still due.
+    advance = schedule_start_ <= deadline;
   }
+  if (advance)
+    ++next_frame_index_;
+  // At most one overdue frame is delivered right away; deadlines further
+  // behind are dropped without generating their frames.
+  const Timestamp now = clock_->CurrentTime();
+  int64_t skipped_frames = 0;
+  while (FrameDeadline(next_frame_index_ + 1) <= now) {
+    ++next_frame_index_;
+    ++skipped_frames;
+  }
+  if (skipped_frames > 0) {
+    rtc::CritScope cs(&stats_lock_);
+    scheduling_stats_.skipped_frames += skipped_frames;
+  }
+  if (skipped_frames > 0 && skipped_frames_metric_)
+    skipped_frames_metric_->Add(skipped_frames);
+  // The repeating task measures its delay from when this tick was due, which
+  // is |deadline|.
+  return FrameDeadline(next_frame_index_) - deadline;
 }
 
-void FrameGeneratorCapturer::Start() {
-  {
-    rtc::CritScope cs(&lock_);
-    sending_ = true;
+void FrameGeneratorCapturer::InsertFrame() {
+  if (!sending_)
+    return;
+  TRACE_EVENT0("webrtc", "FrameGeneratorCapturer::InsertFrame");
+
+  std::shared_ptr<const rtc::VideoSinkWants> sink_wants = std::atomic_exchange(
+      &pending_sink_wants_, std::shared_ptr<const rtc::VideoSinkWants>());
+  if (sink_wants && source_width_ > 0)
+    AdaptResolution(*sink_wants);
+  TRACE_EVENT_BEGIN0("webrtc", "FrameGeneratorCapturer::NextFrame");
+  FrameGeneratorInterface::VideoFrameData frame_data =
+      frame_generator_->NextFrame();
+  TRACE_EVENT_END0("webrtc", "FrameGeneratorCapturer::NextFrame");
+  if (source_width_ == 0) {
+    source_width_ = output_width_ = frame_data.buffer->width();
+    source_height_ = output_height_ = frame_data.buffer->height();
+    // Takes effect from the next frame.
+    if (sink_wants)
+      AdaptResolution(*sink_wants);
   }
-  if (!frame_task_.Running()) {
-    frame_task_ = RepeatingTaskHandle::Start(task_queue_.Get(), [this] {
-      InsertFrame();
-      return TimeDelta::Seconds(1) / GetCurrentConfiguredFramerate();
-    });
+
+  std::shared_ptr<const FrameConfig> config = std::atomic_load(&frame_config_);
+  VideoFrame frame = VideoFrame::Builder()
+                         .set_video_frame_buffer(frame_data.buffer)
+                         .set_rotation(config->rotation)
+                         .set_timestamp_us(clock_->TimeInMicroseconds())
+                         .set_ntp_time_ms(clock_->CurrentNtpInMilliseconds())
+                         .set_update_rect(frame_data.update_rect)
+                         .set_color_space(config->color_space)
+                         .build();
+  if (first_frame_capture_time_ == -1) {
+    first_frame_capture_time_ = frame.ntp_time_ms();
   }
+
+  // No lock is held while the sinks run.
+  TestVideoCapturer::OnFrame(frame);
+}
+
+void FrameGeneratorCapturer::Start() {
+  sending_ = true;
+  // Once Init() started the frame task, the schedule belongs to the task
+  // queue, so it is only reset there.
+  task_queue_.PostTask([this] {
+    if (frame_task_.Running())
+      return;
+    const Timestamp now = clock_->CurrentTime();
+    ResetSchedule(now, GetCurrentConfiguredFramerate());
+    frame_task_ = RepeatingTaskHandle::DelayedStart(
+        task_queue_.Get(), schedule_start_ - now,
+        [this] { return OnFrameTick(); });
+  });
 }
 
 void FrameGeneratorCapturer::Stop() {
-  rtc::CritScope cs(&lock_);
   sending_ = false;
 }
 
 void FrameGeneratorCapturer::ChangeResolution(size_t width, size_t height) {
-  rtc::CritScope cs(&lock_);
+  // The generator is only used on the task queue, so the change is made there
+  // between two frames.
+  task_queue_.PostTask([this, width, height] {
+    frame_generator_->ChangeResolution(width, height);
+    source_width_ = output_width_ = static_cast<int>(width);
+    source_height_ = output_height_ = static_cast<int>(height);
+    // Sinks may still want less than the new source resolution.
+    AdaptResolution(GetSinkWants());
+  });
+}
+
+void FrameGeneratorCapturer::AdaptResolution(const rtc::VideoSinkWants& wants) {
+  int width;
+  int height;
+  ScaleForSinkWants(source_width_, source_height_, wants, &width, &height);
+  if (width == output_width_ && height == output_height_)
+    return;
+  RTC_LOG(LS_INFO) << "Rendering at " << width << "x" << height
+                   << " instead of " << source_width_ << "x" << source_height_
+                   << " for the sink wants";
   frame_generator_->ChangeResolution(width, height);
+  output_width_ = width;
+  output_height_ = height;
 }
 
-void FrameGeneratorCapturer::ChangeFramerate(int target_framerate) {
+void FrameGeneratorCapturer::ChangeFramerate(double target_framerate) {
   rtc::CritScope cs(&lock_);
-  RTC_CHECK(target_capture_fps_ > 0);
-  if (target_framerate > source_fps_)
+  RTC_CHECK(target_framerate > 0);
+  std::shared_ptr<FrameConfig> config = CopyFrameConfig();
+  if (target_framerate > config->source_fps)
     RTC_LOG(LS_WARNING) << "Target framerate clamped from " << target_framerate
-                        << " to " << source_fps_;
-  if (source_fps_ % target_capture_fps_ != 0) {
-    int decimation =
-        std::round(static_cast<double>(source_fps_) / target_capture_fps_);
-    int effective_rate = target_capture_fps_ / decimation;
-    RTC_LOG(LS_WARNING) << "Target framerate, " << target_framerate
-                        << ", is an uneven fraction of the source rate, "
-                        << source_fps_
-                        << ". The framerate will be :" << effective_rate;
-  }
-  target_capture_fps_ = std::min(source_fps_, target_framerate);
+                        << " to " << config->source_fps;
+  config->target_capture_fps = std::min(config->source_fps, target_framerate);
+  PublishFrameConfig(std::move(config));
+}
+
+FrameGeneratorCapturer::SchedulingStats
+FrameGeneratorCapturer::GetSchedulingStats() const {
+  rtc::CritScope cs(&stats_lock_);
+  return scheduling_stats_;
 }
 
 void FrameGeneratorCapturer::SetSinkWantsObserver(SinkWantsObserver* observer) {
@@ -259,7 +500,10 @@ void FrameGeneratorCapturer::AddOrUpdateSink(
     // Tests need to observe unmodified sink wants.
     sink_wants_observer_->OnSinkWantsChanged(sink, wants);
   }
-  UpdateFps(GetSinkWants().max_framerate_fps);
+  const rtc::VideoSinkWants sink_wants = GetSinkWants();
+  UpdateFps(sink_wants.max_framerate_fps);
+  std::atomic_store(&pending_sink_wants_,
+                    std::make_shared<const rtc::VideoSinkWants>(sink_wants));
 }
 
 void FrameGeneratorCapturer::RemoveSink(
@@ -267,15 +511,20 @@ void FrameGeneratorCapturer::RemoveSink(
   TestVideoCapturer::RemoveSink(sink);
 
   rtc::CritScope cs(&lock_);
-  UpdateFps(GetSinkWants().max_framerate_fps);
+  const rtc::VideoSinkWants sink_wants = GetSinkWants();
+  UpdateFps(sink_wants.max_framerate_fps);
+  std::atomic_store(&pending_sink_wants_,
+                    std::make_shared<const rtc::VideoSinkWants>(sink_wants));
 }
 
 void FrameGeneratorCapturer::UpdateFps(int max_fps) {
-  if (max_fps < target_capture_fps_) {
-    wanted_fps_.emplace(max_fps);
+  std::shared_ptr<FrameConfig> config = CopyFrameConfig();
+  if (max_fps < config->target_capture_fps) {
+    config->wanted_fps.emplace(max_fps);
   } else {
-    wanted_fps_.reset();
+    config->wanted_fps.reset();
   }
+  PublishFrameConfig(std::move(config));
 }
 
 void FrameGeneratorCapturer::ForceFrame() {
@@ -283,11 +532,8 @@ void FrameGeneratorCapturer::ForceFrame() {
   task_queue_.PostTask([this] { InsertFrame(); });
 }
 
-int FrameGeneratorCapturer::GetCurrentConfiguredFramerate() {
-  rtc::CritScope cs(&lock_);
-  if (wanted_fps_ && *wanted_fps_ < target_capture_fps_)
-    return *wanted_fps_;
-  return target_capture_fps_;
+double FrameGeneratorCapturer::GetCurrentConfiguredFramerate() {
+  return std::atomic_load(&frame_config_)->framerate();
 }
 
 }  // namespace test
@@ -10,16 +10,21 @@
 #ifndef TEST_FRAME_GENERATOR_CAPTURER_H_
 #define TEST_FRAME_GENERATOR_CAPTURER_H_
 
+#include <atomic>
 #include <memory>
 #include <string>
 
 #include "api/task_queue/task_queue_factory.h"
 #include "api/test/frame_generator_interface.h"
+#include "api/units/time_delta.h"
+#include "api/units/timestamp.h"
 #include "api/video/video_frame.h"
 #include "rtc_base/critical_section.h"
 #include "rtc_base/task_queue.h"
 #include "rtc_base/task_utils/repeating_task.h"
 #include "system_wrappers/include/clock.h"
+#include "test/complexity_frame_generator.h"
+#include "test/metrics_registry.h"
 #include "test/test_video_capturer.h"
 
 namespace webrtc {
@@ -52,6 +57,8 @@ struct FrameGeneratorCapturerConfig {
     TimeDelta change_interval = TimeDelta::Seconds(10);
     int width = 1600;
     int height = 1200;
+    // Threads rendering each slide, including the capturer's task queue.
+    int render_threads = 1;
   };
 
   struct VideoFile {
@@ -62,6 +69,23 @@ struct FrameGeneratorCapturerConfig {
     int height = 0;
   };
 
+  // Loops a LZ4 frame file (see test/testsupport/lz4_frame_file.h), at the
+  // file's resolution.
+  struct Lz4File {
+    int framerate = 30;
+    // Path of the file.
+    std::string name;
+    // Frames decompressed ahead on the prefetch thread; unset for 8.
+    absl::optional<size_t> prefetch_frames;
+  };
+
+  struct ComplexityVideo {
+    int width = 640;
+    int height = 480;
+    // |generator.framerate| is the capture framerate.
+    ComplexityFrameGeneratorConfig generator;
+  };
+
   struct ImageSlides {
     int framerate = 30;
     TimeDelta change_interval = TimeDelta::Seconds(10);
@@ -83,7 +107,9 @@ struct FrameGeneratorCapturerConfig {
   frame_gen_cap_impl::AutoOpt<SquaresVideo> squares_video;
   frame_gen_cap_impl::AutoOpt<SquareSlides> squares_slides;
   frame_gen_cap_impl::AutoOpt<VideoFile> video_file;
+  frame_gen_cap_impl::AutoOpt<Lz4File> lz4_file;
   frame_gen_cap_impl::AutoOpt<ImageSlides> image_slides;
+  frame_gen_cap_impl::AutoOpt<ComplexityVideo> complexity_video;
 };
 
 class FrameGeneratorCapturer : public TestVideoCapturer {
@@ -99,10 +125,26 @@ class FrameGeneratorCapturer : public TestVideoCapturer {
     virtual ~SinkWantsObserver() {}
   };
 
+  struct SchedulingStats {
+    // Frames delivered on the frame schedule; ForceFrame() is not counted.
+    int64_t frames = 0;
+    // Frames whose deadline had already passed by more than a frame interval
+    // when the previous frame was done. They are skipped instead of being
+    // delivered in a burst.
+    int64_t skipped_frames = 0;
+    // Frames delivered more than kLateFrameThreshold after their deadline.
+    int64_t late_frames = 0;
+    // How far frame ticks ran behind their deadlines.
+    TimeDelta total_lateness = TimeDelta::Zero();
+    TimeDelta max_lateness = TimeDelta::Zero();
+  };
+  static constexpr TimeDelta kLateFrameThreshold = TimeDelta::Millis(5);
+
+  // |target_fps| may be fractional, e.g. 29.97.
   FrameGeneratorCapturer(
       Clock* clock,
       std::unique_ptr<FrameGeneratorInterface> frame_generator,
-      int target_fps,
+      double target_fps,
       TaskQueueFactory& task_queue_factory);
   virtual ~FrameGeneratorCapturer();
 
@@ -118,10 +160,18 @@ class FrameGeneratorCapturer : public TestVideoCapturer {
       Clock* clock,
       TaskQueueFactory& task_queue_factory,
       FrameGeneratorCapturerConfig::VideoFile config);
+  static std::unique_ptr<FrameGeneratorCapturer> Create(
+      Clock* clock,
+      TaskQueueFactory& task_queue_factory,
+      FrameGeneratorCapturerConfig::Lz4File config);
   static std::unique_ptr<FrameGeneratorCapturer> Create(
       Clock* clock,
       TaskQueueFactory& task_queue_factory,
       FrameGeneratorCapturerConfig::ImageSlides config);
+  static std::unique_ptr<FrameGeneratorCapturer> Create(
+      Clock* clock,
+      TaskQueueFactory& task_queue_factory,
+      FrameGeneratorCapturerConfig::ComplexityVideo config);
   static std::unique_ptr<FrameGeneratorCapturer> Create(
       Clock* clock,
       TaskQueueFactory& task_queue_factory,
@@ -129,8 +179,22 @@ class FrameGeneratorCapturer : public TestVideoCapturer {
 
   void Start();
   void Stop();
+  // Sets the resolution frames are produced at while no sink asks for less.
   void ChangeResolution(size_t width, size_t height);
-  void ChangeFramerate(int target_framerate);
+  // Any rate up to the source rate is produced exactly, e.g. 29.97 or 7.5,
+  // with one NextFrame() call per delivered frame.
+  void ChangeFramerate(double target_framerate);
+  // Puts frame deadlines |phase| (in [0, 1)) of a frame interval after
+  // multiples of the interval on |clock_|, instead of counting from Start().
+  // Capturers started together with different phases then spread their
+  // frames over the interval rather than all firing at once. Takes effect at
+  // the next (re)start of the frame schedule.
+  void SetPhase(double phase);
+  // Counts delivered, skipped and late frames in |registry|, with histograms
+  // of the frames' lateness and of the time taken to produce them, besides
+  // the adaptation metrics. Must be called before Init(); |registry| must
+  // outlive the capturer.
+  void SetMetricsRegistry(MetricsRegistry* registry) override;
 
   void SetSinkWantsObserver(SinkWantsObserver* observer);
 
@@ -144,29 +208,86 @@ class FrameGeneratorCapturer : public TestVideoCapturer {
 
   int64_t first_frame_capture_time() const { return first_frame_capture_time_; }
 
+  SchedulingStats GetSchedulingStats() const;
+
   bool Init();
 
  private:
+  // Settings read on every frame. Control calls never modify a published
+  // FrameConfig; they publish a modified copy with std::atomic_store(), so
+  // the frame path reads them without taking a lock.
+  struct FrameConfig {
+    // The rate the frame schedule runs at.
+    double framerate() const;
+
+    VideoRotation rotation = kVideoRotation_0;
+    absl::optional<ColorSpace> color_space;
+    double source_fps = 0;
+    double target_capture_fps = 0;
+    absl::optional<int> wanted_fps;
+    absl::optional<double> phase;
+  };
+
   void InsertFrame();
+  // Runs on the frame schedule. Returns the delay until the next frame's
+  // deadline, relative to this frame's deadline.
+  TimeDelta OnFrameTick();
+  // Restarts the frame schedule at |fps| with frame 0 due at |start|, or at
+  // the first time on the phase grid from |start| if a phase is set.
+  void ResetSchedule(Timestamp start, double fps);
+  Timestamp FrameDeadline(int64_t frame_index) const;
   static bool Run(void* obj);
-  int GetCurrentConfiguredFramerate();
+  double GetCurrentConfiguredFramerate();
   void UpdateFps(int max_fps) RTC_EXCLUSIVE_LOCKS_REQUIRED(&lock_);
+  std::shared_ptr<FrameConfig> CopyFrameConfig() const
+      RTC_EXCLUSIVE_LOCKS_REQUIRED(&lock_);
+  void PublishFrameConfig(std::shared_ptr<FrameConfig> config)
+      RTC_EXCLUSIVE_LOCKS_REQUIRED(&lock_);
+  // Switches the generator to the resolution the video adapter would scale
+  // the source resolution to for |wants|. Runs on |task_queue_|.
+  void AdaptResolution(const rtc::VideoSinkWants& wants);
 
   Clock* const clock_;
+  // Started by Init(), and only used on |task_queue_| after that.
   RepeatingTaskHandle frame_task_;
-  bool sending_;
-  SinkWantsObserver* sink_wants_observer_ RTC_GUARDED_BY(&lock_);
+  std::atomic<bool> sending_;
 
+  // Serializes the control calls. Never taken on the frame path.
   rtc::CriticalSection lock_;
+  SinkWantsObserver* sink_wants_observer_ RTC_GUARDED_BY(&lock_);
+  // Only accessed with std::atomic_load() and std::atomic_store().
+  std::shared_ptr<const FrameConfig> frame_config_;
+  // Set when the sink wants change and taken with std::atomic_exchange()
+  // before the next frame.
+  std::shared_ptr<const rtc::VideoSinkWants> pending_sink_wants_;
+
+  // The members below are only used on |task_queue_|, or before the frame
+  // task is started.
   std::unique_ptr<FrameGeneratorInterface> frame_generator_;
+  // Frames are rendered at the resolution the sinks want, so that the video
+  // adapter in TestVideoCapturer does not have to scale them down. The source
+  // resolution is learned from the first frame or set by ChangeResolution().
+  int source_width_;
+  int source_height_;
+  int output_width_;
+  int output_height_;
+  // Deadlines are computed from the schedule start, rather than by adding up
+  // intervals, so rounding never accumulates into drift. The schedule
+  // restarts whenever the rate changes.
+  Timestamp schedule_start_;
+  double schedule_fps_;
+  int64_t next_frame_index_;
 
-  int source_fps_ RTC_GUARDED_BY(&lock_);
-  int target_capture_fps_ RTC_GUARDED_BY(&lock_);
-  absl::optional<int> wanted_fps_ RTC_GUARDED_BY(&lock_);
-  VideoRotation fake_rotation_ = kVideoRotation_0;
-  absl::optional<ColorSpace> fake_color_space_ RTC_GUARDED_BY(&lock_);
+  rtc::CriticalSection stats_lock_;
+  SchedulingStats scheduling_stats_ RTC_GUARDED_BY(&stats_lock_);
+  // Set by SetMetricsRegistry(), or null.
+  MetricsRegistry::Counter* frames_metric_;
+  MetricsRegistry::Counter* skipped_frames_metric_;
+  MetricsRegistry::Counter* late_frames_metric_;
+  MetricsRegistry::Histogram* lateness_ms_metric_;
+  MetricsRegistry::Histogram* frame_duration_us_metric_;
 
-  int64_t first_frame_capture_time_;
+  std::atomic<int64_t> first_frame_capture_time_;
   // Must be the last field, so it will be deconstructed first as tasks
   // in the TaskQueue access other fields of the instance of this class.
   rtc::TaskQueue task_queue_;
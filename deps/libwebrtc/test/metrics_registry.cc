@@ -0,0 +1,130 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "test/metrics_registry.h"
+
+#include <algorithm>
+
+#include "rtc_base/checks.h"
+
+namespace webrtc {
+namespace test {
+
+constexpr size_t MetricsRegistry::kMaxMetrics;
+constexpr size_t MetricsRegistry::kMaxHistogramBuckets;
+constexpr size_t MetricsRegistry::kCacheLineSize;
+
+MetricsRegistry::Histogram::Histogram() : num_bounds_(0), sum_(0) {
+  upper_bounds_.fill(0);
+  for (auto& count : counts_)
+    count.store(0, std::memory_order_relaxed);
+}
+
+void MetricsRegistry::Histogram::Add(int64_t value) {
+  size_t bucket = 0;
+  while (bucket < num_bounds_ && value > upper_bounds_[bucket])
+    ++bucket;
+  counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+MetricsRegistry::MetricsRegistry() = default;
+
+MetricsRegistry::~MetricsRegistry() = default;
+
+int MetricsRegistry::Find(const std::array<std::string, kMaxMetrics>& names,
+                          size_t size,
+                          const std::string& name) {
+  for (size_t i = 0; i < size; ++i) {
+    if (names[i] == name)
+      return static_cast<int>(i);
+  }
+  return -1;
+}
+
+MetricsRegistry::Counter* MetricsRegistry::GetCounter(
+    const std::string& name) {
+  rtc::CritScope cs(&lock_);
+  const size_t size = counters_.size.load(std::memory_order_relaxed);
+  const int index = Find(counters_.names, size, name);
+  if (index >= 0)
+    return &counters_.metrics[index];
+  RTC_CHECK_LT(size, kMaxMetrics) << "Too many counters, adding " << name;
+  counters_.names[size] = name;
+  counters_.size.store(size + 1, std::memory_order_release);
+  return &counters_.metrics[size];
+}
+
+MetricsRegistry::Gauge* MetricsRegistry::GetGauge(const std::string& name) {
+  rtc::CritScope cs(&lock_);
+  const size_t size = gauges_.size.load(std::memory_order_relaxed);
+  const int index = Find(gauges_.names, size, name);
+  if (index >= 0)
+    return &gauges_.metrics[index];
+  RTC_CHECK_LT(size, kMaxMetrics) << "Too many gauges, adding " << name;
+  gauges_.names[size] = name;
+  gauges_.size.store(size + 1, std::memory_order_release);
+  return &gauges_.metrics[size];
+}
+
+MetricsRegistry::Histogram* MetricsRegistry::GetHistogram(
+    const std::string& name,
+    const std::vector<int64_t>& upper_bounds) {
+  RTC_CHECK_LT(upper_bounds.size(), kMaxHistogramBuckets);
+  RTC_CHECK(std::is_sorted(upper_bounds.begin(), upper_bounds.end()));
+  rtc::CritScope cs(&lock_);
+  const size_t size = histograms_.size.load(std::memory_order_relaxed);
+  const int index = Find(histograms_.names, size, name);
+  if (index >= 0)
+    return &histograms_.metrics[index];
+  RTC_CHECK_LT(size, kMaxMetrics) << "Too many histograms, adding " << name;
+  Histogram* histogram = &histograms_.metrics[size];
+  histogram->num_bounds_ = upper_bounds.size();
+  std::copy(upper_bounds.begin(), upper_bounds.end(),
+            histogram->upper_bounds_.begin());
+  histograms_.names[size] = name;
+  histograms_.size.store(size + 1, std::memory_order_release);
+  return histogram;
+}
+
+MetricsRegistry::Snapshot MetricsRegistry::GetSnapshot() const {
+  Snapshot snapshot;
+  const size_t num_counters = counters_.size.load(std::memory_order_acquire);
+  snapshot.counters.reserve(num_counters);
+  for (size_t i = 0; i < num_counters; ++i) {
+    snapshot.counters.push_back(
+        {counters_.names[i], counters_.metrics[i].value()});
+  }
+  const size_t num_gauges = gauges_.size.load(std::memory_order_acquire);
+  snapshot.gauges.reserve(num_gauges);
+  for (size_t i = 0; i < num_gauges; ++i)
+    snapshot.gauges.push_back({gauges_.names[i], gauges_.metrics[i].value()});
+  const size_t num_histograms =
+      histograms_.size.load(std::memory_order_acquire);
+  snapshot.histograms.resize(num_histograms);
+  for (size_t i = 0; i < num_histograms; ++i) {
+    const Histogram& histogram = histograms_.metrics[i];
+    Snapshot::HistogramValue& value = snapshot.histograms[i];
+    value.name = histograms_.names[i];
+    value.upper_bounds.assign(
+        histogram.upper_bounds_.begin(),
+        histogram.upper_bounds_.begin() + histogram.num_bounds_);
+    value.counts.resize(histogram.num_bounds_ + 1);
+    for (size_t bucket = 0; bucket <= histogram.num_bounds_; ++bucket) {
+      value.counts[bucket] =
+          histogram.counts_[bucket].load(std::memory_order_relaxed);
+    }
+    value.sum = histogram.sum_.load(std::memory_order_relaxed);
+  }
+  return snapshot;
+}
+
+}  // namespace test
+}  // namespace webrtc
@@ -0,0 +1,153 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef TEST_METRICS_REGISTRY_H_
+#define TEST_METRICS_REGISTRY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "rtc_base/critical_section.h"
+
+namespace webrtc {
+namespace test {
+
+// Counters, gauges and fixed-bucket histograms for hot paths, such as the
+// frame and audio threads of a session.
+//
+// Metrics are registered by name, once, before the hot path runs; that takes
+// a lock. Updates are relaxed atomic operations on a value that has a cache
+// line to itself, so threads updating different metrics never contend.
+// GetSnapshot() reads everything without taking the lock, and may run on any
+// thread while metrics are updated and registered.
+class MetricsRegistry {
+ public:
+  // Per kind of metric.
+  static constexpr size_t kMaxMetrics = 32;
+  static constexpr size_t kMaxHistogramBuckets = 16;
+  // Of the x86 and ARM cores this runs on.
+  static constexpr size_t kCacheLineSize = 64;
+
+  class Counter {
+   public:
+    void Add(int64_t value = 1) {
+      value_.fetch_add(value, std::memory_order_relaxed);
+    }
+    int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+   private:
+    friend class MetricsRegistry;
+    Counter() : value_(0) {}
+
+    std::atomic<int64_t> value_;
+    char padding_[kCacheLineSize - sizeof(std::atomic<int64_t>)];
+  };
+
+  class Gauge {
+   public:
+    void Set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+    void Add(int64_t value) {
+      value_.fetch_add(value, std::memory_order_relaxed);
+    }
+    int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+   private:
+    friend class MetricsRegistry;
+    Gauge() : value_(0) {}
+
+    std::atomic<int64_t> value_;
+    char padding_[kCacheLineSize - sizeof(std::atomic<int64_t>)];
+  };
+
+  // Bucket i counts values up to |upper_bounds[i]|, the last bucket the
+  // values above all bounds. Meant to be updated by one thread at a time;
+  // its buckets share cache lines with each other, but not with other
+  // metrics.
+  class Histogram {
+   public:
+    void Add(int64_t value);
+
+   private:
+    friend class MetricsRegistry;
+    Histogram();
+
+    char padding_before_[kCacheLineSize];
+    size_t num_bounds_;
+    std::array<int64_t, kMaxHistogramBuckets - 1> upper_bounds_;
+    std::array<std::atomic<uint64_t>, kMaxHistogramBuckets> counts_;
+    std::atomic<int64_t> sum_;
+    char padding_after_[kCacheLineSize];
+  };
+
+  struct Snapshot {
+    struct Value {
+      std::string name;
+      int64_t value;
+    };
+    struct HistogramValue {
+      std::string name;
+      std::vector<int64_t> upper_bounds;
+      // One more than |upper_bounds|; not cumulative.
+      std::vector<uint64_t> counts;
+      int64_t sum;
+    };
+    std::vector<Value> counters;
+    std::vector<Value> gauges;
+    std::vector<HistogramValue> histograms;
+  };
+
+  MetricsRegistry();
+  ~MetricsRegistry();
+
+  MetricsRegistry(const MetricsRegistry&) = delete;
+  MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+  // Return the metric registered under |name|, registering it first if
+  // needed. The metrics live as long as the registry. At most kMaxMetrics of
+  // each kind may be registered. A histogram that exists keeps its bounds.
+  Counter* GetCounter(const std::string& name);
+  Gauge* GetGauge(const std::string& name);
+  Histogram* GetHistogram(const std::string& name,
+                          const std::vector<int64_t>& upper_bounds);
+
+  Snapshot GetSnapshot() const;
+
+ private:
+  // Names are written before the size that publishes them is incremented,
+  // and never change afterwards.
+  template <typename T>
+  struct Metrics {
+    Metrics() : size(0) {}
+    T metrics[kMaxMetrics];
+    std::array<std::string, kMaxMetrics> names;
+    std::atomic<size_t> size;
+  };
+
+  // Index of |name| in |names|, or -1.
+  static int Find(const std::array<std::string, kMaxMetrics>& names,
+                  size_t size,
+                  const std::string& name);
+
+  // Serializes registrations. The metrics are read without it.
+  rtc::CriticalSection lock_;
+  Metrics<Counter> counters_;
+  Metrics<Gauge> gauges_;
+  Metrics<Histogram> histograms_;
+};
+
+}  // namespace test
+}  // namespace webrtc
+
+#endif  // TEST_METRICS_REGISTRY_H_
@@ -0,0 +1,157 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "test/passthrough_audio_encoder_factory.h"
+
+#include <utility>
+#include <vector>
+
+#include "absl/strings/match.h"
+#include "api/audio_codecs/audio_encoder.h"
+#include "api/units/time_delta.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/ref_counted_object.h"
+
+namespace webrtc {
+namespace test {
+namespace {
+
+constexpr int kOpusSampleRateHz = 48000;
+constexpr int kSamplesPer10Ms = kOpusSampleRateHz / 100;
+constexpr size_t kMax10MsFramesInAPacket = 12;
+// Opus DTX packets are one or two bytes long.
+constexpr size_t kMaxDtxPacketSize = 2;
+
+class PassthroughAudioEncoder : public AudioEncoder {
+ public:
+  PassthroughAudioEncoder(int payload_type,
+                          std::shared_ptr<const OggOpusFile> file)
+      : payload_type_(payload_type),
+        file_(std::move(file)),
+        next_packet_(0),
+        num_10ms_frames_buffered_(0),
+        first_timestamp_in_buffer_(0) {}
+
+  int SampleRateHz() const override { return kOpusSampleRateHz; }
+  size_t NumChannels() const override { return file_->num_channels(); }
+
+  size_t Num10MsFramesInNextPacket() const override {
+    // OggOpusFile only loads packets of whole 10 ms frames.
+    int duration = file_->packet_duration(next_packet_);
+    RTC_DCHECK_EQ(duration % kSamplesPer10Ms, 0);
+    return duration / kSamplesPer10Ms;
+  }
+
+  size_t Max10MsFramesInAPacket() const override {
+    return kMax10MsFramesInAPacket;
+  }
+
+  int GetTargetBitrate() const override {
+    return file_->average_bitrate_bps();
+  }
+
+  void Reset() override { num_10ms_frames_buffered_ = 0; }
+
+  absl::optional<std::pair<TimeDelta, TimeDelta>> GetFrameLengthRange()
+      const override {
+    return {{TimeDelta::Millis(10),
+             TimeDelta::Millis(10 * kMax10MsFramesInAPacket)}};
+  }
+
+ protected:
+  EncodedInfo EncodeImpl(uint32_t rtp_timestamp,
+                         rtc::ArrayView<const int16_t> audio,
+                         rtc::Buffer* encoded) override {
+    if (num_10ms_frames_buffered_ == 0)
+      first_timestamp_in_buffer_ = rtp_timestamp;
+    if (++num_10ms_frames_buffered_ < Num10MsFramesInNextPacket())
+      return EncodedInfo();
+    num_10ms_frames_buffered_ = 0;
+
+    rtc::ArrayView<const uint8_t> packet = file_->packet(next_packet_);
+    next_packet_ = (next_packet_ + 1) % file_->num_packets();
+    encoded->AppendData(packet.data(), packet.size());
+
+    EncodedInfo info;
+    info.encoded_bytes = packet.size();
+    info.encoded_timestamp = first_timestamp_in_buffer_;
+    info.payload_type = payload_type_;
+    info.send_even_if_empty = true;
+    info.speech = packet.size() > kMaxDtxPacketSize;
+    info.encoder_type = CodecType::kOpus;
+    return info;
+  }
+
+ private:
+  const int payload_type_;
+  const std::shared_ptr<const OggOpusFile> file_;
+  size_t next_packet_;
+  size_t num_10ms_frames_buffered_;
+  uint32_t first_timestamp_in_buffer_;
+};
+
+class PassthroughAudioEncoderFactory : public AudioEncoderFactory {
+ public:
+  explicit PassthroughAudioEncoderFactory(
+      std::shared_ptr<const OggOpusFile> file)
+      : file_(std::move(file)) {}
+
+  std::vector<AudioCodecSpec> GetSupportedEncoders() override {
+    SdpAudioFormat::Parameters parameters = {{"minptime", "10"},
+                                             {"useinbandfec", "1"}};
+    if (file_->num_channels() == 2)
+      parameters["stereo"] = "1";
+    return {{SdpAudioFormat("opus", kOpusSampleRateHz, 2,
+                            std::move(parameters)),
+             Info()}};
+  }
+
+  absl::optional<AudioCodecInfo> QueryAudioEncoder(
+      const SdpAudioFormat& format) override {
+    if (!absl::EqualsIgnoreCase(format.name, "opus") ||
+        format.clockrate_hz != kOpusSampleRateHz) {
+      return absl::nullopt;
+    }
+    return Info();
+  }
+
+  std::unique_ptr<AudioEncoder> MakeAudioEncoder(
+      int payload_type,
+      const SdpAudioFormat& format,
+      absl::optional<AudioCodecPairId> codec_pair_id) override {
+    if (!QueryAudioEncoder(format))
+      return nullptr;
+    return std::make_unique<PassthroughAudioEncoder>(payload_type, file_);
+  }
+
+ private:
+  AudioCodecInfo Info() const {
+    const int bitrate_bps = file_->average_bitrate_bps();
+    AudioCodecInfo info(kOpusSampleRateHz, file_->num_channels(), bitrate_bps,
+                        bitrate_bps, bitrate_bps);
+    info.allow_comfort_noise = false;
+    info.supports_network_adaption = false;
+    return info;
+  }
+
+  const std::shared_ptr<const OggOpusFile> file_;
+};
+
+}  // namespace
+
+rtc::scoped_refptr<AudioEncoderFactory> CreatePassthroughAudioEncoderFactory(
+    std::shared_ptr<const OggOpusFile> file) {
+  RTC_CHECK(file);
+  return new rtc::RefCountedObject<PassthroughAudioEncoderFactory>(
+      std::move(file));
+}
+
+}  // namespace test
+}  // namespace webrtc
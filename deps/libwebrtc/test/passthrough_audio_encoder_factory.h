@@ -0,0 +1,37 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef TEST_PASSTHROUGH_AUDIO_ENCODER_FACTORY_H_
+#define TEST_PASSTHROUGH_AUDIO_ENCODER_FACTORY_H_
+
+#include <memory>
+
+#include "api/audio_codecs/audio_encoder_factory.h"
+#include "api/scoped_refptr.h"
+#include "test/testsupport/ogg_opus_file.h"
+
+namespace webrtc {
+namespace test {
+
+// Creates a factory for Opus encoders that don't encode: each encoder
+// ignores the audio it is given and sends the packets of |file| instead,
+// looping, each one once its duration of audio has been captured. The
+// capture device then only provides the clock, and a publisher costs no
+// encoder CPU however many sessions run.
+//
+// |file| is shared by all encoders. Bitrate, packet loss and DTX settings
+// from the network are ignored.
+rtc::scoped_refptr<AudioEncoderFactory> CreatePassthroughAudioEncoderFactory(
+    std::shared_ptr<const OggOpusFile> file);
+
+}  // namespace test
+}  // namespace webrtc
+
+#endif  // TEST_PASSTHROUGH_AUDIO_ENCODER_FACTORY_H_
@@ -16,12 +16,25 @@
 #include "api/video/i420_buffer.h"
 #include "api/video/video_frame_buffer.h"
 #include "api/video/video_rotation.h"
+#include "rtc_base/time_utils.h"
 
 namespace webrtc {
 namespace test {
+TestVideoCapturer::TestVideoCapturer()
+    : scale_pool_(/*zero_initialize=*/false) {}
+
 TestVideoCapturer::~TestVideoCapturer() = default;
 
+void TestVideoCapturer::SetMetricsRegistry(MetricsRegistry* registry) {
+  scaled_frames_metric_ = registry->GetCounter("capturer_scaled_frames_total");
+  adapter_dropped_frames_metric_ =
+      registry->GetCounter("capturer_adapter_dropped_frames_total");
+  adapt_us_metric_ = registry->GetHistogram(
+      "capturer_adapt_us", {100, 200, 500, 1000, 2000, 5000, 10000, 20000});
+}
+
 void TestVideoCapturer::OnFrame(const VideoFrame& original_frame) {
+  const int64_t start_us = adapt_us_metric_ ? rtc::TimeMicros() : 0;
   int cropped_width = 0;
   int cropped_height = 0;
   int out_width = 0;
@@ -33,15 +46,20 @@ void TestVideoCapturer::OnFrame(const VideoFrame& original_frame) {
           frame.width(), frame.height(), frame.timestamp_us() * 1000,
           &cropped_width, &cropped_height, &out_width, &out_height)) {
     // Drop frame in order to respect frame rate constraint.
+    if (adapter_dropped_frames_metric_)
+      adapter_dropped_frames_metric_->Add();
     return;
   }
 
   if (out_height != frame.height() || out_width != frame.width()) {
-    // Video adapter has requested a down-scale. Allocate a new buffer and
-    // return scaled version.
+    // Video adapter has requested a down-scale. Take a buffer from the pool
+    // and return scaled version. Sources that render at the wanted resolution
+    // themselves never get here.
     // For simplicity, only scale here without cropping.
     rtc::scoped_refptr<I420Buffer> scaled_buffer =
-        I420Buffer::Create(out_width, out_height);
+        scale_pool_.CreateBuffer(out_width, out_height);
+    if (!scaled_buffer)
+      scaled_buffer = I420Buffer::Create(out_width, out_height);
     scaled_buffer->ScaleFrom(*frame.video_frame_buffer()->ToI420());
     VideoFrame::Builder new_frame_builder =
         VideoFrame::Builder()
@@ -55,10 +73,17 @@ void TestVideoCapturer::OnFrame(const VideoFrame& original_frame) {
           out_width, out_height);
       new_frame_builder.set_update_rect(new_rect);
     }
-    broadcaster_.OnFrame(new_frame_builder.build());
+    VideoFrame scaled_frame = new_frame_builder.build();
+    if (adapt_us_metric_) {
+      scaled_frames_metric_->Add();
+      adapt_us_metric_->Add(rtc::TimeMicros() - start_us);
+    }
+    broadcaster_.OnFrame(scaled_frame);
 
   } else {
     // No adaptations needed, just return the frame as is.
+    if (adapt_us_metric_)
+      adapt_us_metric_->Add(rtc::TimeMicros() - start_us);
     broadcaster_.OnFrame(frame);
   }
 }
@@ -84,9 +109,10 @@ void TestVideoCapturer::UpdateVideoAdapter() {
 }
 
 VideoFrame TestVideoCapturer::MaybePreprocess(const VideoFrame& frame) {
-  rtc::CritScope crit(&lock_);
-  if (preprocessor_ != nullptr) {
-    return preprocessor_->Preprocess(frame);
+  std::shared_ptr<FramePreprocessor> preprocessor =
+      std::atomic_load(&preprocessor_);
+  if (preprocessor != nullptr) {
+    return preprocessor->Preprocess(frame);
   } else {
     return frame;
   }
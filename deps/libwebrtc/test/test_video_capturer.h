@@ -16,9 +16,10 @@
 
 #include "api/video/video_frame.h"
 #include "api/video/video_source_interface.h"
+#include "common_video/include/i420_buffer_pool.h"
 #include "media/base/video_adapter.h"
 #include "media/base/video_broadcaster.h"
-#include "rtc_base/critical_section.h"
+#include "test/metrics_registry.h"
 
 namespace webrtc {
 namespace test {
@@ -32,14 +33,21 @@ class TestVideoCapturer : public rtc::VideoSourceInterface<VideoFrame> {
     virtual VideoFrame Preprocess(const VideoFrame& frame) = 0;
   };
 
+  TestVideoCapturer();
   ~TestVideoCapturer() override;
 
   void AddOrUpdateSink(rtc::VideoSinkInterface<VideoFrame>* sink,
                        const rtc::VideoSinkWants& wants) override;
   void RemoveSink(rtc::VideoSinkInterface<VideoFrame>* sink) override;
+  // Registers the time spent preprocessing, adapting and scaling each frame
+  // and the frames scaled or dropped by the adapter in |registry|. Must be
+  // called before frames are delivered.
+  virtual void SetMetricsRegistry(MetricsRegistry* registry);
+  // May be called while frames are delivered; a frame being preprocessed
+  // keeps the old preprocessor alive until it is done.
   void SetFramePreprocessor(std::unique_ptr<FramePreprocessor> preprocessor) {
-    rtc::CritScope crit(&lock_);
-    preprocessor_ = std::move(preprocessor);
+    std::atomic_store(&preprocessor_, std::shared_ptr<FramePreprocessor>(
+                                          std::move(preprocessor)));
   }
 
  protected:
@@ -50,10 +58,17 @@ class TestVideoCapturer : public rtc::VideoSourceInterface<VideoFrame> {
   void UpdateVideoAdapter();
   VideoFrame MaybePreprocess(const VideoFrame& frame);
 
-  rtc::CriticalSection lock_;
-  std::unique_ptr<FramePreprocessor> preprocessor_ RTC_GUARDED_BY(lock_);
+  // Only accessed with std::atomic_load() and std::atomic_store(), so that
+  // frame delivery never waits for SetFramePreprocessor().
+  std::shared_ptr<FramePreprocessor> preprocessor_;
   rtc::VideoBroadcaster broadcaster_;
   cricket::VideoAdapter video_adapter_;
+  // Only used on the thread delivering frames.
+  I420BufferPool scale_pool_;
+  // Set by SetMetricsRegistry(), or null.
+  MetricsRegistry::Counter* scaled_frames_metric_ = nullptr;
+  MetricsRegistry::Counter* adapter_dropped_frames_metric_ = nullptr;
+  MetricsRegistry::Histogram* adapt_us_metric_ = nullptr;
 };
 }  // namespace test
 }  // namespace webrtc
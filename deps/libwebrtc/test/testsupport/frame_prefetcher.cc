@@ -0,0 +1,122 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "test/testsupport/frame_prefetcher.h"
+
+#include <utility>
+
+#include "rtc_base/checks.h"
+#include "rtc_base/time_utils.h"
+
+namespace webrtc {
+namespace test {
+
+FramePrefetcher::FramePrefetcher(ProduceFunction produce,
+                                 size_t capacity,
+                                 absl::string_view thread_name)
+    : produce_(std::move(produce)),
+      capacity_(capacity),
+      generation_(0),
+      stopped_(false),
+      underruns_(0),
+      thread_(&FramePrefetcher::Run, this, thread_name) {
+  RTC_DCHECK(produce_);
+  RTC_DCHECK_GT(capacity_, 0);
+  thread_.Start();
+}
+
+FramePrefetcher::~FramePrefetcher() {
+  {
+    rtc::CritScope crit(&crit_);
+    stopped_ = true;
+  }
+  space_ready_.Set();
+  thread_.Stop();
+}
+
+absl::optional<FrameGeneratorInterface::VideoFrameData> FramePrefetcher::Pop(
+    int max_wait_ms) {
+  const int64_t deadline_ms = rtc::TimeMillis() + max_wait_ms;
+  bool counted_underrun = false;
+  while (true) {
+    {
+      rtc::CritScope crit(&crit_);
+      if (!queue_.empty()) {
+        FrameGeneratorInterface::VideoFrameData frame = queue_.front();
+        queue_.pop_front();
+        space_ready_.Set();
+        return frame;
+      }
+      if (stopped_)
+        return absl::nullopt;
+      if (!counted_underrun) {
+        ++underruns_;
+        counted_underrun = true;
+      }
+    }
+    const int64_t wait_ms = deadline_ms - rtc::TimeMillis();
+    if (wait_ms <= 0 || !frame_ready_.Wait(static_cast<int>(wait_ms)))
+      return absl::nullopt;
+  }
+}
+
+void FramePrefetcher::Flush() {
+  rtc::CritScope crit(&crit_);
+  queue_.clear();
+  ++generation_;
+  space_ready_.Set();
+}
+
+int FramePrefetcher::underruns() const {
+  rtc::CritScope crit(&crit_);
+  return underruns_;
+}
+
+void FramePrefetcher::Run(void* obj) {
+  static_cast<FramePrefetcher*>(obj)->ProduceLoop();
+}
+
+void FramePrefetcher::ProduceLoop() {
+  while (true) {
+    int generation;
+    {
+      rtc::CritScope crit(&crit_);
+      if (stopped_)
+        return;
+      generation = generation_;
+      if (queue_.size() >= capacity_) {
+        // Wait outside of the lock until the consumer makes room.
+        generation = -1;
+      }
+    }
+    if (generation < 0) {
+      space_ready_.Wait(rtc::Event::kForever);
+      continue;
+    }
+
+    absl::optional<FrameGeneratorInterface::VideoFrameData> frame = produce_();
+
+    rtc::CritScope crit(&crit_);
+    if (!frame) {
+      stopped_ = true;
+      frame_ready_.Set();
+      return;
+    }
+    if (stopped_)
+      return;
+    if (generation != generation_)
+      continue;
+    queue_.push_back(std::move(*frame));
+    frame_ready_.Set();
+  }
+}
+
+}  // namespace test
+}  // namespace webrtc
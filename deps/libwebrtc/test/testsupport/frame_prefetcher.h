@@ -0,0 +1,78 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef TEST_TESTSUPPORT_FRAME_PREFETCHER_H_
+#define TEST_TESTSUPPORT_FRAME_PREFETCHER_H_
+
+#include <deque>
+#include <functional>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "api/test/frame_generator_interface.h"
+#include "rtc_base/critical_section.h"
+#include "rtc_base/event.h"
+#include "rtc_base/platform_thread.h"
+#include "rtc_base/thread_annotations.h"
+
+namespace webrtc {
+namespace test {
+
+// Keeps up to |capacity| frames ready ahead of the consumer by calling
+// |produce| on a dedicated thread. File based generators use it so that
+// reading, decompressing or decoding does not happen on the capturer's frame
+// tick.
+class FramePrefetcher {
+ public:
+  // Called on the prefetch thread only. Returns absl::nullopt when no frame
+  // could be produced; the prefetch thread then stops.
+  using ProduceFunction =
+      std::function<absl::optional<FrameGeneratorInterface::VideoFrameData>()>;
+
+  FramePrefetcher(ProduceFunction produce,
+                  size_t capacity,
+                  absl::string_view thread_name);
+  ~FramePrefetcher();
+
+  // Returns the oldest prefetched frame. Waits up to |max_wait_ms| if the
+  // queue is empty and returns absl::nullopt on timeout.
+  absl::optional<FrameGeneratorInterface::VideoFrameData> Pop(int max_wait_ms);
+
+  // Drops all queued frames and any frame currently being produced, e.g.
+  // after the output resolution has changed.
+  void Flush();
+
+  // Number of Pop() calls that found the queue empty.
+  int underruns() const;
+
+ private:
+  static void Run(void* obj);
+  void ProduceLoop();
+
+  const ProduceFunction produce_;
+  const size_t capacity_;
+
+  rtc::CriticalSection crit_;
+  std::deque<FrameGeneratorInterface::VideoFrameData> queue_
+      RTC_GUARDED_BY(crit_);
+  // Incremented by Flush() so that a frame produced concurrently is dropped.
+  int generation_ RTC_GUARDED_BY(crit_);
+  bool stopped_ RTC_GUARDED_BY(crit_);
+  int underruns_ RTC_GUARDED_BY(crit_);
+
+  rtc::Event frame_ready_;
+  rtc::Event space_ready_;
+  rtc::PlatformThread thread_;
+};
+
+}  // namespace test
+}  // namespace webrtc
+
+#endif  // TEST_TESTSUPPORT_FRAME_PREFETCHER_H_
@@ -28,13 +28,24 @@ namespace test {
 namespace {
 
 constexpr int kMaxNextFrameWaitTemeoutMs = 1000;
+// Frames handed out by NextFrame() may still be referenced downstream (e.g.
+// by the encoder) while the prefetcher fills its queue.
+constexpr size_t kExtraScaleBuffers = 4;
 
 }  // namespace
 
+constexpr size_t IvfVideoFrameGenerator::kDefaultPrefetchFrames;
+
 IvfVideoFrameGenerator::IvfVideoFrameGenerator(const std::string& file_name)
+    : IvfVideoFrameGenerator(file_name, kDefaultPrefetchFrames) {}
+
+IvfVideoFrameGenerator::IvfVideoFrameGenerator(const std::string& file_name,
+                                               size_t prefetch_frames)
     : callback_(this),
       file_reader_(IvfFileReader::Create(FileWrapper::OpenReadOnly(file_name))),
       video_decoder_(CreateVideoDecoder(file_reader_->GetVideoCodecType())),
+      scale_pool_(/*zero_initialize=*/false,
+                  prefetch_frames + kExtraScaleBuffers),
       width_(file_reader_->GetFrameWidth()),
       height_(file_reader_->GetFrameHeight()) {
   RTC_CHECK(video_decoder_) << "No decoder found for file's video codec type";
@@ -51,9 +62,13 @@ IvfVideoFrameGenerator::IvfVideoFrameGenerator(const std::string& file_name)
   RTC_CHECK_EQ(
       video_decoder_->InitDecode(&codec_settings, /*number_of_cores=*/1),
       WEBRTC_VIDEO_CODEC_OK);
+  prefetcher_ = std::make_unique<FramePrefetcher>(
+      [this] { return DecodeNextFrame(); }, prefetch_frames, "IvfFrameDecode");
 }
 IvfVideoFrameGenerator::~IvfVideoFrameGenerator() {
-  rtc::CritScope crit(&lock_);
+  // Joins the prefetch thread; after that nothing else touches the reader and
+  // the decoder.
+  prefetcher_.reset();
   if (!file_reader_) {
     return;
   }
@@ -70,7 +85,25 @@ IvfVideoFrameGenerator::~IvfVideoFrameGenerator() {
 }
 
 FrameGeneratorInterface::VideoFrameData IvfVideoFrameGenerator::NextFrame() {
-  rtc::CritScope crit(&lock_);
+  absl::optional<VideoFrameData> frame =
+      prefetcher_->Pop(kMaxNextFrameWaitTemeoutMs);
+  RTC_CHECK(frame) << "Failed to decode next frame in "
+                   << kMaxNextFrameWaitTemeoutMs << "ms. Can't continue";
+  return *frame;
+}
+
+void IvfVideoFrameGenerator::ChangeResolution(size_t width, size_t height) {
+  {
+    rtc::CritScope crit(&lock_);
+    width_ = width;
+    height_ = height;
+  }
+  // Frames already decoded have been scaled to the old resolution.
+  prefetcher_->Flush();
+}
+
+absl::optional<FrameGeneratorInterface::VideoFrameData>
+IvfVideoFrameGenerator::DecodeNextFrame() {
   next_frame_decoded_.Reset();
   RTC_CHECK(file_reader_);
   if (!file_reader_->HasMoreFrames()) {
@@ -86,27 +119,31 @@ FrameGeneratorInterface::VideoFrameData IvfVideoFrameGenerator::NextFrame() {
   RTC_CHECK(decoded) << "Failed to decode next frame in "
                      << kMaxNextFrameWaitTemeoutMs << "ms. Can't continue";
 
+  size_t width;
+  size_t height;
+  {
+    rtc::CritScope crit(&lock_);
+    width = width_;
+    height = height_;
+  }
+
   rtc::CritScope frame_crit(&frame_decode_lock_);
   rtc::scoped_refptr<VideoFrameBuffer> buffer =
       next_frame_->video_frame_buffer();
-  if (width_ != static_cast<size_t>(buffer->width()) ||
-      height_ != static_cast<size_t>(buffer->height())) {
-    // Video adapter has requested a down-scale. Allocate a new buffer and
-    // return scaled version.
+  if (width != static_cast<size_t>(buffer->width()) ||
+      height != static_cast<size_t>(buffer->height())) {
+    // Video adapter has requested a down-scale. Scale into a pooled buffer
+    // instead of allocating a new one per frame.
     rtc::scoped_refptr<I420Buffer> scaled_buffer =
-        I420Buffer::Create(width_, height_);
+        scale_pool_.CreateBuffer(width, height);
+    if (!scaled_buffer)
+      scaled_buffer = I420Buffer::Create(width, height);
     scaled_buffer->ScaleFrom(*buffer->ToI420());
     buffer = scaled_buffer;
   }
   return VideoFrameData(buffer, next_frame_->update_rect());
 }
 
-void IvfVideoFrameGenerator::ChangeResolution(size_t width, size_t height) {
-  rtc::CritScope crit(&lock_);
-  width_ = width;
-  height_ = height;
-}
-
 int32_t IvfVideoFrameGenerator::DecodedCallback::Decoded(
     VideoFrame& decoded_image) {
   Decoded(decoded_image, 0, 0);
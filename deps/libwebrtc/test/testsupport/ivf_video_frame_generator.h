@@ -19,18 +19,25 @@
 #include "api/video/video_codec_type.h"
 #include "api/video/video_frame.h"
 #include "api/video_codecs/video_decoder.h"
+#include "common_video/include/i420_buffer_pool.h"
 #include "modules/video_coding/utility/ivf_file_reader.h"
 #include "rtc_base/critical_section.h"
 #include "rtc_base/event.h"
 #include "rtc_base/synchronization/sequence_checker.h"
+#include "test/testsupport/frame_prefetcher.h"
 
 namespace webrtc {
 namespace test {
 
 // All methods except constructor must be used from the same thread.
+// Frames are decoded and scaled on a background thread which keeps
+// |prefetch_frames| frames ready, so NextFrame() only dequeues.
 class IvfVideoFrameGenerator : public FrameGeneratorInterface {
  public:
+  static constexpr size_t kDefaultPrefetchFrames = 4;
+
   explicit IvfVideoFrameGenerator(const std::string& file_name);
+  IvfVideoFrameGenerator(const std::string& file_name, size_t prefetch_frames);
   ~IvfVideoFrameGenerator() override;
 
   VideoFrameData NextFrame() override;
@@ -52,33 +59,37 @@ class IvfVideoFrameGenerator : public FrameGeneratorInterface {
     IvfVideoFrameGenerator* const reader_;
   };
 
+  // Reads, decodes and scales the next frame. Runs on the prefetch thread.
+  absl::optional<VideoFrameData> DecodeNextFrame();
   void OnFrameDecoded(const VideoFrame& decoded_frame);
   static std::unique_ptr<VideoDecoder> CreateVideoDecoder(
       VideoCodecType codec_type);
 
   DecodedCallback callback_;
+  // |file_reader_|, |video_decoder_| and |scale_pool_| are only used on the
+  // prefetch thread once the constructor has returned.
   std::unique_ptr<IvfFileReader> file_reader_;
   std::unique_ptr<VideoDecoder> video_decoder_;
+  I420BufferPool scale_pool_;
 
-  size_t width_;
-  size_t height_;
-
-  // This lock is used to ensure that all API method will be called
-  // sequentially. It is required because we need to ensure that generator
-  // won't be destroyed while it is reading the next frame on another thread,
-  // because it will cause SIGSEGV when decoder callback will be invoked.
-  //
-  // FrameGenerator is injected into PeerConnection via some scoped_ref object
-  // and it can happen that the last pointer will be destroyed on the different
-  // thread comparing to the one from which frames were read.
+  // Protects the output resolution, which is set by ChangeResolution() and
+  // read on the prefetch thread.
   rtc::CriticalSection lock_;
+  size_t width_ RTC_GUARDED_BY(lock_);
+  size_t height_ RTC_GUARDED_BY(lock_);
+
   // This lock is used to sync between sending and receiving frame from decoder.
-  // We can't reuse |lock_| because then generator can be destroyed between
-  // frame was sent to decoder and decoder callback was invoked.
   rtc::CriticalSection frame_decode_lock_;
 
   rtc::Event next_frame_decoded_;
   absl::optional<VideoFrame> next_frame_ RTC_GUARDED_BY(frame_decode_lock_);
+
+  // FrameGenerator is injected into PeerConnection via some scoped_ref object
+  // and it can happen that the last pointer will be destroyed on a different
+  // thread than the one frames were read on. The destructor stops the
+  // prefetch thread first, so the decoder callback is never invoked on a
+  // destroyed generator.
+  std::unique_ptr<FramePrefetcher> prefetcher_;
 };
 
 }  // namespace test
@@ -0,0 +1,429 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "test/testsupport/lz4_frame_file.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <utility>
+
+#include "lz4.h"
+#include "lz4hc.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/logging.h"
+
+namespace webrtc {
+namespace test {
+namespace {
+
+constexpr char kMagic[8] = {'L', 'Z', '4', 'I', '4', '2', '0', '\0'};
+constexpr size_t kHeaderSize = 32;
+constexpr size_t kRecordHeaderSize = 3 * sizeof(uint32_t);
+constexpr size_t kIndexEntrySize = sizeof(uint64_t) + sizeof(uint32_t);
+constexpr size_t kMaxY4mHeaderSize = 1024;
+
+void PutLe32(uint8_t* dst, uint32_t value) {
+  for (int i = 0; i < 4; ++i)
+    dst[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+void PutLe64(uint8_t* dst, uint64_t value) {
+  for (int i = 0; i < 8; ++i)
+    dst[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+uint32_t GetLe32(const uint8_t* src) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; ++i)
+    value |= static_cast<uint32_t>(src[i]) << (8 * i);
+  return value;
+}
+
+uint64_t GetLe64(const uint8_t* src) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; ++i)
+    value |= static_cast<uint64_t>(src[i]) << (8 * i);
+  return value;
+}
+
+// Clips larger than 2 GB are common at 4K, so avoid the long based fseek().
+bool SeekTo(FILE* file, uint64_t offset) {
+#if defined(WEBRTC_WIN)
+  return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+  return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+}
+
+// The size of |file|, or -1. Leaves the position at the end.
+int64_t FileSize(FILE* file) {
+#if defined(WEBRTC_WIN)
+  if (_fseeki64(file, 0, SEEK_END) != 0)
+    return -1;
+  return _ftelli64(file);
+#else
+  if (fseeko(file, 0, SEEK_END) != 0)
+    return -1;
+  return ftello(file);
+#endif
+}
+
+size_t ChromaWidth(int width) {
+  return static_cast<size_t>((width + 1) / 2);
+}
+
+size_t ChromaHeight(int height) {
+  return static_cast<size_t>((height + 1) / 2);
+}
+
+// Reads one tightly packed I420 frame from |file|.
+bool ReadRawFrame(FILE* file, size_t frame_size, std::vector<uint8_t>* frame) {
+  frame->resize(frame_size);
+  return fread(frame->data(), 1, frame_size, file) == frame_size;
+}
+
+bool WriteRawFrame(Lz4FrameFileWriter* writer,
+                   const std::vector<uint8_t>& frame,
+                   int width,
+                   int height) {
+  const size_t size_y = static_cast<size_t>(width) * height;
+  const size_t size_uv = ChromaWidth(width) * ChromaHeight(height);
+  const int stride_uv = static_cast<int>(ChromaWidth(width));
+  return writer->WriteFrame(frame.data(), width, frame.data() + size_y,
+                            stride_uv, frame.data() + size_y + size_uv,
+                            stride_uv);
+}
+
+}  // namespace
+
+const char kLz4FrameFileExtension[] = "lz4yuv";
+
+std::unique_ptr<Lz4FrameFileWriter> Lz4FrameFileWriter::Open(
+    const std::string& path,
+    int width,
+    int height,
+    int compression_level) {
+  RTC_DCHECK_GT(width, 0);
+  RTC_DCHECK_GT(height, 0);
+  FILE* file = fopen(path.c_str(), "wb");
+  if (!file) {
+    RTC_LOG(LS_ERROR) << "Failed to open " << path << " for writing";
+    return nullptr;
+  }
+  // Reserve the header; Close() writes it once the index offset is known.
+  uint8_t header[kHeaderSize] = {0};
+  if (fwrite(header, 1, kHeaderSize, file) != kHeaderSize) {
+    fclose(file);
+    return nullptr;
+  }
+  return std::unique_ptr<Lz4FrameFileWriter>(
+      new Lz4FrameFileWriter(file, width, height, compression_level));
+}
+
+Lz4FrameFileWriter::Lz4FrameFileWriter(FILE* file,
+                                       int width,
+                                       int height,
+                                       int compression_level)
+    : file_(file),
+      width_(width),
+      height_(height),
+      compression_level_(compression_level),
+      offset_(kHeaderSize) {}
+
+Lz4FrameFileWriter::~Lz4FrameFileWriter() {
+  Close();
+}
+
+bool Lz4FrameFileWriter::WriteFrame(const uint8_t* data_y,
+                                    int stride_y,
+                                    const uint8_t* data_u,
+                                    int stride_u,
+                                    const uint8_t* data_v,
+                                    int stride_v) {
+  RTC_DCHECK(file_);
+  const uint8_t* planes[3] = {data_y, data_u, data_v};
+  const int strides[3] = {stride_y, stride_u, stride_v};
+  const int widths[3] = {width_, static_cast<int>(ChromaWidth(width_)),
+                         static_cast<int>(ChromaWidth(width_))};
+  const int heights[3] = {height_, static_cast<int>(ChromaHeight(height_)),
+                          static_cast<int>(ChromaHeight(height_))};
+
+  uint8_t record_header[kRecordHeaderSize];
+  uint32_t record_size = kRecordHeaderSize;
+  for (int i = 0; i < 3; ++i) {
+    const size_t plane_size = static_cast<size_t>(widths[i]) * heights[i];
+    const uint8_t* src = planes[i];
+    if (strides[i] != widths[i]) {
+      packed_.resize(plane_size);
+      for (int y = 0; y < heights[i]; ++y) {
+        memcpy(&packed_[static_cast<size_t>(y) * widths[i]],
+               planes[i] + y * strides[i], widths[i]);
+      }
+      src = packed_.data();
+    }
+
+    std::vector<uint8_t>& dst = compressed_[i];
+    dst.resize(LZ4_compressBound(static_cast<int>(plane_size)));
+    const int compressed_size =
+        compression_level_ > 0
+            ? LZ4_compress_HC(reinterpret_cast<const char*>(src),
+                              reinterpret_cast<char*>(dst.data()),
+                              static_cast<int>(plane_size),
+                              static_cast<int>(dst.size()), compression_level_)
+            : LZ4_compress_default(reinterpret_cast<const char*>(src),
+                                   reinterpret_cast<char*>(dst.data()),
+                                   static_cast<int>(plane_size),
+                                   static_cast<int>(dst.size()));
+    if (compressed_size <= 0) {
+      RTC_LOG(LS_ERROR) << "LZ4 compression failed for frame "
+                        << index_.size();
+      return false;
+    }
+    dst.resize(compressed_size);
+    PutLe32(&record_header[i * sizeof(uint32_t)], compressed_size);
+    record_size += compressed_size;
+  }
+
+  if (fwrite(record_header, 1, kRecordHeaderSize, file_) != kRecordHeaderSize)
+    return false;
+  for (const std::vector<uint8_t>& payload : compressed_) {
+    if (fwrite(payload.data(), 1, payload.size(), file_) != payload.size())
+      return false;
+  }
+  index_.push_back({offset_, record_size});
+  offset_ += record_size;
+  return true;
+}
+
+bool Lz4FrameFileWriter::Close() {
+  if (!file_)
+    return true;
+
+  bool success = true;
+  uint8_t entry[kIndexEntrySize];
+  for (const IndexEntry& index_entry : index_) {
+    PutLe64(entry, index_entry.offset);
+    PutLe32(entry + sizeof(uint64_t), index_entry.size);
+    success &= fwrite(entry, 1, kIndexEntrySize, file_) == kIndexEntrySize;
+  }
+
+  uint8_t header[kHeaderSize];
+  memcpy(header, kMagic, sizeof(kMagic));
+  PutLe32(header + 8, kLz4FrameFileVersion);
+  PutLe32(header + 12, width_);
+  PutLe32(header + 16, height_);
+  PutLe32(header + 20, static_cast<uint32_t>(index_.size()));
+  PutLe64(header + 24, offset_);
+  success &= SeekTo(file_, 0) &&
+             fwrite(header, 1, kHeaderSize, file_) == kHeaderSize;
+
+  success &= fclose(file_) == 0;
+  file_ = nullptr;
+  return success;
+}
+
+std::unique_ptr<Lz4FrameFileReader> Lz4FrameFileReader::Open(
+    const std::string& path) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file) {
+    RTC_LOG(LS_ERROR) << "Failed to open " << path;
+    return nullptr;
+  }
+  uint8_t header[kHeaderSize];
+  if (fread(header, 1, kHeaderSize, file) != kHeaderSize ||
+      memcmp(header, kMagic, sizeof(kMagic)) != 0 ||
+      GetLe32(header + 8) != kLz4FrameFileVersion) {
+    RTC_LOG(LS_ERROR) << path << " is not a LZ4 frame file";
+    fclose(file);
+    return nullptr;
+  }
+  const int width = static_cast<int>(GetLe32(header + 12));
+  const int height = static_cast<int>(GetLe32(header + 16));
+  const uint32_t frame_count = GetLe32(header + 20);
+  const uint64_t index_offset = GetLe64(header + 24);
+  const uint64_t index_size =
+      static_cast<uint64_t>(frame_count) * kIndexEntrySize;
+  // Checked before allocating the index, so that a corrupt |frame_count|
+  // doesn't allocate up to 48 GB.
+  const int64_t file_size = FileSize(file);
+  if (width <= 0 || height <= 0 || frame_count == 0 || file_size < 0 ||
+      index_offset < kHeaderSize ||
+      index_offset > static_cast<uint64_t>(file_size) ||
+      index_size > static_cast<uint64_t>(file_size) - index_offset) {
+    RTC_LOG(LS_ERROR) << path << " has a corrupt header or index";
+    fclose(file);
+    return nullptr;
+  }
+
+  std::vector<uint8_t> raw_index(static_cast<size_t>(index_size));
+  if (!SeekTo(file, index_offset) ||
+      fread(raw_index.data(), 1, raw_index.size(), file) != raw_index.size()) {
+    RTC_LOG(LS_ERROR) << path << " has a corrupt header or index";
+    fclose(file);
+    return nullptr;
+  }
+
+  std::vector<IndexEntry> index(frame_count);
+  for (uint32_t i = 0; i < frame_count; ++i) {
+    const uint8_t* entry = &raw_index[static_cast<size_t>(i) * kIndexEntrySize];
+    index[i].offset = GetLe64(entry);
+    index[i].size = GetLe32(entry + sizeof(uint64_t));
+  }
+  return std::unique_ptr<Lz4FrameFileReader>(
+      new Lz4FrameFileReader(file, width, height, std::move(index)));
+}
+
+Lz4FrameFileReader::Lz4FrameFileReader(FILE* file,
+                                       int width,
+                                       int height,
+                                       std::vector<IndexEntry> index)
+    : file_(file), width_(width), height_(height), index_(std::move(index)) {}
+
+Lz4FrameFileReader::~Lz4FrameFileReader() {
+  fclose(file_);
+}
+
+bool Lz4FrameFileReader::ReadFrame(size_t frame_index,
+                                   uint8_t* data_y,
+                                   uint8_t* data_u,
+                                   uint8_t* data_v) {
+  RTC_CHECK_LT(frame_index, index_.size());
+  const IndexEntry& entry = index_[frame_index];
+  if (entry.size < kRecordHeaderSize)
+    return false;
+  record_.resize(entry.size);
+  if (!SeekTo(file_, entry.offset) ||
+      fread(record_.data(), 1, entry.size, file_) != entry.size) {
+    return false;
+  }
+
+  uint8_t* planes[3] = {data_y, data_u, data_v};
+  const size_t plane_sizes[3] = {
+      static_cast<size_t>(width_) * height_,
+      ChromaWidth(width_) * ChromaHeight(height_),
+      ChromaWidth(width_) * ChromaHeight(height_)};
+  size_t payload_offset = kRecordHeaderSize;
+  for (int i = 0; i < 3; ++i) {
+    const uint32_t compressed_size = GetLe32(&record_[i * sizeof(uint32_t)]);
+    if (payload_offset + compressed_size > record_.size())
+      return false;
+    const int decompressed_size = LZ4_decompress_safe(
+        reinterpret_cast<const char*>(&record_[payload_offset]),
+        reinterpret_cast<char*>(planes[i]), static_cast<int>(compressed_size),
+        static_cast<int>(plane_sizes[i]));
+    if (decompressed_size != static_cast<int>(plane_sizes[i]))
+      return false;
+    payload_offset += compressed_size;
+  }
+  return true;
+}
+
+bool ConvertYuvToLz4FrameFile(const std::string& yuv_path,
+                              int width,
+                              int height,
+                              const std::string& output_path,
+                              int compression_level) {
+  FILE* input = fopen(yuv_path.c_str(), "rb");
+  if (!input) {
+    RTC_LOG(LS_ERROR) << "Failed to open " << yuv_path;
+    return false;
+  }
+  std::unique_ptr<Lz4FrameFileWriter> writer =
+      Lz4FrameFileWriter::Open(output_path, width, height, compression_level);
+  if (!writer) {
+    fclose(input);
+    return false;
+  }
+
+  const size_t frame_size = static_cast<size_t>(width) * height +
+                            2 * ChromaWidth(width) * ChromaHeight(height);
+  std::vector<uint8_t> frame;
+  bool success = true;
+  while (success && ReadRawFrame(input, frame_size, &frame))
+    success = WriteRawFrame(writer.get(), frame, width, height);
+  fclose(input);
+
+  success &= writer->frames_written() > 0;
+  success &= writer->Close();
+  return success;
+}
+
+bool ConvertY4mToLz4FrameFile(const std::string& y4m_path,
+                              const std::string& output_path,
+                              int compression_level) {
+  FILE* input = fopen(y4m_path.c_str(), "rb");
+  if (!input) {
+    RTC_LOG(LS_ERROR) << "Failed to open " << y4m_path;
+    return false;
+  }
+
+  char line[kMaxY4mHeaderSize];
+  if (!fgets(line, sizeof(line), input) ||
+      strncmp(line, "YUV4MPEG2 ", 10) != 0) {
+    RTC_LOG(LS_ERROR) << y4m_path << " is not a Y4M file";
+    fclose(input);
+    return false;
+  }
+  int width = 0;
+  int height = 0;
+  bool supported_colorspace = true;
+  for (char* token = strtok(line + 10, " \n"); token;
+       token = strtok(nullptr, " \n")) {
+    if (token[0] == 'W') {
+      width = atoi(token + 1);
+    } else if (token[0] == 'H') {
+      height = atoi(token + 1);
+    } else if (token[0] == 'C') {
+      // These only differ in chroma siting, which doesn't matter here.
+      const char* colorspace = token + 1;
+      supported_colorspace = strcmp(colorspace, "420") == 0 ||
+                             strcmp(colorspace, "420jpeg") == 0 ||
+                             strcmp(colorspace, "420mpeg2") == 0 ||
+                             strcmp(colorspace, "420paldv") == 0;
+    }
+  }
+  if (width <= 0 || height <= 0 || !supported_colorspace) {
+    RTC_LOG(LS_ERROR) << y4m_path << " has an unsupported Y4M header";
+    fclose(input);
+    return false;
+  }
+
+  std::unique_ptr<Lz4FrameFileWriter> writer =
+      Lz4FrameFileWriter::Open(output_path, width, height, compression_level);
+  if (!writer) {
+    fclose(input);
+    return false;
+  }
+
+  const size_t frame_size = static_cast<size_t>(width) * height +
+                            2 * ChromaWidth(width) * ChromaHeight(height);
+  std::vector<uint8_t> frame;
+  bool success = true;
+  // Every frame starts with a "FRAME" line that may carry parameters.
+  while (success && fgets(line, sizeof(line), input)) {
+    if (strncmp(line, "FRAME", 5) != 0) {
+      RTC_LOG(LS_ERROR) << y4m_path << " has a corrupt frame header";
+      success = false;
+      break;
+    }
+    if (!ReadRawFrame(input, frame_size, &frame))
+      break;
+    success = WriteRawFrame(writer.get(), frame, width, height);
+  }
+  fclose(input);
+
+  success &= writer->frames_written() > 0;
+  success &= writer->Close();
+  return success;
+}
+
+}  // namespace test
+}  // namespace webrtc
@@ -0,0 +1,139 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef TEST_TESTSUPPORT_LZ4_FRAME_FILE_H_
+#define TEST_TESTSUPPORT_LZ4_FRAME_FILE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace webrtc {
+namespace test {
+
+// Indexed container of LZ4 compressed I420 frames. It is a cheap alternative
+// to raw .yuv clips (which are I/O bound) and to .ivf clips (which need a
+// full codec decode per frame).
+//
+// All integers are little endian. Layout:
+//   Header (32 bytes):
+//     char     magic[8]      "LZ4I420\0"
+//     uint32_t version       kLz4FrameFileVersion
+//     uint32_t width
+//     uint32_t height
+//     uint32_t frame_count
+//     uint64_t index_offset  Offset of the frame index from file start.
+//   Frame records, one per frame:
+//     uint32_t compressed_size[3]  Sizes of the Y, U and V payloads.
+//     Y, U and V payloads, each an LZ4 block of the tightly packed plane.
+//   Frame index, frame_count entries of:
+//     uint64_t record_offset
+//     uint32_t record_size
+extern const char kLz4FrameFileExtension[];
+constexpr uint32_t kLz4FrameFileVersion = 1;
+
+class Lz4FrameFileWriter {
+ public:
+  // |compression_level| 0 selects the fast LZ4 compressor, values above 0
+  // select LZ4 HC with that level. Returns nullptr on failure.
+  static std::unique_ptr<Lz4FrameFileWriter> Open(const std::string& path,
+                                                  int width,
+                                                  int height,
+                                                  int compression_level);
+  ~Lz4FrameFileWriter();
+
+  bool WriteFrame(const uint8_t* data_y,
+                  int stride_y,
+                  const uint8_t* data_u,
+                  int stride_u,
+                  const uint8_t* data_v,
+                  int stride_v);
+
+  // Writes the index and finalizes the header. Called by the destructor if
+  // not called explicitly.
+  bool Close();
+
+  size_t frames_written() const { return index_.size(); }
+
+ private:
+  struct IndexEntry {
+    uint64_t offset;
+    uint32_t size;
+  };
+
+  Lz4FrameFileWriter(FILE* file, int width, int height, int compression_level);
+
+  FILE* file_;
+  const int width_;
+  const int height_;
+  const int compression_level_;
+  uint64_t offset_;
+  std::vector<IndexEntry> index_;
+  std::vector<uint8_t> packed_;
+  std::vector<uint8_t> compressed_[3];
+};
+
+// Not thread safe; Lz4VideoFrameGenerator uses it from its prefetch thread
+// only.
+class Lz4FrameFileReader {
+ public:
+  // Returns nullptr if the file can't be opened or isn't a valid container.
+  static std::unique_ptr<Lz4FrameFileReader> Open(const std::string& path);
+  ~Lz4FrameFileReader();
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  size_t num_frames() const { return index_.size(); }
+
+  // Decompresses frame |frame_index| into tightly packed planes, i.e. with
+  // strides width and (width + 1) / 2.
+  bool ReadFrame(size_t frame_index,
+                 uint8_t* data_y,
+                 uint8_t* data_u,
+                 uint8_t* data_v);
+
+ private:
+  struct IndexEntry {
+    uint64_t offset;
+    uint32_t size;
+  };
+
+  Lz4FrameFileReader(FILE* file,
+                     int width,
+                     int height,
+                     std::vector<IndexEntry> index);
+
+  FILE* const file_;
+  const int width_;
+  const int height_;
+  const std::vector<IndexEntry> index_;
+  std::vector<uint8_t> record_;
+};
+
+// Converts a raw I420 clip of the given resolution. Returns false on failure.
+bool ConvertYuvToLz4FrameFile(const std::string& yuv_path,
+                              int width,
+                              int height,
+                              const std::string& output_path,
+                              int compression_level);
+
+// Converts a .y4m clip; the resolution is taken from the stream header. Only
+// 8 bit 4:2:0 streams are supported. Returns false on failure.
+bool ConvertY4mToLz4FrameFile(const std::string& y4m_path,
+                              const std::string& output_path,
+                              int compression_level);
+
+}  // namespace test
+}  // namespace webrtc
+
+#endif  // TEST_TESTSUPPORT_LZ4_FRAME_FILE_H_
@@ -0,0 +1,108 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "test/testsupport/lz4_video_frame_generator.h"
+
+#include "api/video/i420_buffer.h"
+#include "api/video/video_frame.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/logging.h"
+
+namespace webrtc {
+namespace test {
+namespace {
+
+constexpr int kMaxNextFrameWaitTimeoutMs = 1000;
+// Frames handed out by NextFrame() may still be referenced downstream (e.g.
+// by the encoder) while the prefetcher fills its queue.
+constexpr size_t kExtraPoolBuffers = 4;
+
+}  // namespace
+
+Lz4VideoFrameGenerator::Lz4VideoFrameGenerator(const std::string& file_name,
+                                               size_t prefetch_frames)
+    : file_reader_(Lz4FrameFileReader::Open(file_name)),
+      frame_index_(0),
+      decompress_pool_(/*zero_initialize=*/false,
+                       prefetch_frames + kExtraPoolBuffers),
+      scale_pool_(/*zero_initialize=*/false,
+                  prefetch_frames + kExtraPoolBuffers) {
+  RTC_CHECK(file_reader_) << "Failed to open LZ4 frame file " << file_name;
+  width_ = file_reader_->width();
+  height_ = file_reader_->height();
+  prefetcher_ = std::make_unique<FramePrefetcher>(
+      [this] { return DecompressNextFrame(); }, prefetch_frames,
+      "Lz4FramePrefetch");
+}
+
+Lz4VideoFrameGenerator::~Lz4VideoFrameGenerator() {
+  prefetcher_.reset();
+}
+
+FrameGeneratorInterface::VideoFrameData Lz4VideoFrameGenerator::NextFrame() {
+  absl::optional<VideoFrameData> frame =
+      prefetcher_->Pop(kMaxNextFrameWaitTimeoutMs);
+  RTC_CHECK(frame) << "Failed to decompress next frame in "
+                   << kMaxNextFrameWaitTimeoutMs << "ms. Can't continue";
+  return *frame;
+}
+
+void Lz4VideoFrameGenerator::ChangeResolution(size_t width, size_t height) {
+  {
+    rtc::CritScope crit(&lock_);
+    width_ = static_cast<int>(width);
+    height_ = static_cast<int>(height);
+  }
+  // Frames already prefetched have the old resolution.
+  prefetcher_->Flush();
+}
+
+absl::optional<FrameGeneratorInterface::VideoFrameData>
+Lz4VideoFrameGenerator::DecompressNextFrame() {
+  const int source_width = file_reader_->width();
+  const int source_height = file_reader_->height();
+  rtc::scoped_refptr<I420Buffer> buffer =
+      decompress_pool_.CreateBuffer(source_width, source_height);
+  if (!buffer)
+    buffer = I420Buffer::Create(source_width, source_height);
+  // The container stores tightly packed planes.
+  RTC_DCHECK_EQ(buffer->StrideY(), source_width);
+  RTC_DCHECK_EQ(buffer->StrideU(), (source_width + 1) / 2);
+  RTC_DCHECK_EQ(buffer->StrideV(), (source_width + 1) / 2);
+
+  if (!file_reader_->ReadFrame(frame_index_, buffer->MutableDataY(),
+                               buffer->MutableDataU(),
+                               buffer->MutableDataV())) {
+    RTC_LOG(LS_ERROR) << "Failed to decompress frame " << frame_index_;
+    return absl::nullopt;
+  }
+  frame_index_ = (frame_index_ + 1) % file_reader_->num_frames();
+
+  int width;
+  int height;
+  {
+    rtc::CritScope crit(&lock_);
+    width = width_;
+    height = height_;
+  }
+  rtc::scoped_refptr<VideoFrameBuffer> output = buffer;
+  if (width != source_width || height != source_height) {
+    rtc::scoped_refptr<I420Buffer> scaled_buffer =
+        scale_pool_.CreateBuffer(width, height);
+    if (!scaled_buffer)
+      scaled_buffer = I420Buffer::Create(width, height);
+    scaled_buffer->ScaleFrom(*buffer);
+    output = scaled_buffer;
+  }
+  return VideoFrameData(output, VideoFrame::UpdateRect{0, 0, width, height});
+}
+
+}  // namespace test
+}  // namespace webrtc
@@ -0,0 +1,59 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef TEST_TESTSUPPORT_LZ4_VIDEO_FRAME_GENERATOR_H_
+#define TEST_TESTSUPPORT_LZ4_VIDEO_FRAME_GENERATOR_H_
+
+#include <memory>
+#include <string>
+
+#include "absl/types/optional.h"
+#include "api/test/frame_generator_interface.h"
+#include "common_video/include/i420_buffer_pool.h"
+#include "rtc_base/critical_section.h"
+#include "test/testsupport/frame_prefetcher.h"
+#include "test/testsupport/lz4_frame_file.h"
+
+namespace webrtc {
+namespace test {
+
+// Plays a LZ4 frame file (see lz4_frame_file.h) in a loop. Frames are
+// decompressed on a prefetch thread, |prefetch_frames| ahead of NextFrame().
+class Lz4VideoFrameGenerator : public FrameGeneratorInterface {
+ public:
+  Lz4VideoFrameGenerator(const std::string& file_name, size_t prefetch_frames);
+  ~Lz4VideoFrameGenerator() override;
+
+  VideoFrameData NextFrame() override;
+  void ChangeResolution(size_t width, size_t height) override;
+
+ private:
+  // Runs on the prefetch thread.
+  absl::optional<VideoFrameData> DecompressNextFrame();
+
+  const std::unique_ptr<Lz4FrameFileReader> file_reader_;
+  // Only accessed on the prefetch thread.
+  size_t frame_index_;
+  I420BufferPool decompress_pool_;
+  I420BufferPool scale_pool_;
+
+  rtc::CriticalSection lock_;
+  int width_ RTC_GUARDED_BY(lock_);
+  int height_ RTC_GUARDED_BY(lock_);
+
+  // Must be the last field, so the prefetch thread is stopped before the
+  // fields it accesses are destroyed.
+  std::unique_ptr<FramePrefetcher> prefetcher_;
+};
+
+}  // namespace test
+}  // namespace webrtc
+
+#endif  // TEST_TESTSUPPORT_LZ4_VIDEO_FRAME_GENERATOR_H_
@@ -0,0 +1,232 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "test/testsupport/ogg_opus_file.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <utility>
+
+#include "absl/types/optional.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/logging.h"
+
+namespace webrtc {
+namespace test {
+namespace {
+
+constexpr size_t kPageHeaderSize = 27;
+constexpr uint8_t kContinuedPacket = 0x01;
+constexpr uint8_t kBeginningOfStream = 0x02;
+constexpr size_t kOpusHeadSize = 19;
+constexpr int kMaxPacketDuration = 5760;  // 120 ms.
+constexpr int kSamplesPer10Ms = 480;
+
+uint16_t GetLe16(const uint8_t* src) {
+  return static_cast<uint16_t>(src[0] | (src[1] << 8));
+}
+
+uint32_t GetLe32(const uint8_t* src) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; ++i)
+    value |= static_cast<uint32_t>(src[i]) << (8 * i);
+  return value;
+}
+
+bool StartsWith(const uint8_t* data, size_t size, const char* magic) {
+  size_t length = strlen(magic);
+  return size >= length && memcmp(data, magic, length) == 0;
+}
+
+bool ReadFile(const std::string& path, std::vector<uint8_t>* contents) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file)
+    return false;
+  uint8_t chunk[64 * 1024];
+  size_t read;
+  while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    contents->insert(contents->end(), chunk, chunk + read);
+  bool ok = !ferror(file);
+  fclose(file);
+  return ok;
+}
+
+}  // namespace
+
+std::unique_ptr<OggOpusFile> OggOpusFile::Open(const std::string& path) {
+  std::vector<uint8_t> file;
+  if (!ReadFile(path, &file)) {
+    RTC_LOG(LS_ERROR) << "Can't read " << path;
+    return nullptr;
+  }
+
+  absl::optional<uint32_t> serial;
+  size_t num_channels = 0;
+  int pre_skip = 0;
+  // Index of the next packet of the stream: 0 is the ID header, 1 the
+  // comment header and the rest is audio.
+  size_t packet_index = 0;
+  // The packet being reassembled is appended to |data| from |packet_start|.
+  std::vector<uint8_t> data;
+  std::vector<Packet> packets;
+  size_t packet_start = 0;
+
+  size_t pos = 0;
+  while (pos + kPageHeaderSize <= file.size()) {
+    const uint8_t* page = file.data() + pos;
+    if (!StartsWith(page, kPageHeaderSize, "OggS")) {
+      // Resynchronize on the next capture pattern.
+      ++pos;
+      continue;
+    }
+    const uint8_t header_type = page[5];
+    const uint32_t page_serial = GetLe32(page + 14);
+    const size_t num_segments = page[26];
+    const uint8_t* segments = page + kPageHeaderSize;
+    if (pos + kPageHeaderSize + num_segments > file.size())
+      break;
+    size_t body_size = 0;
+    for (size_t i = 0; i < num_segments; ++i)
+      body_size += segments[i];
+    const uint8_t* body = segments + num_segments;
+    pos += kPageHeaderSize + num_segments + body_size;
+    if (pos > file.size())
+      break;
+
+    if (!serial) {
+      // The first packet of a stream is alone on its page.
+      if ((header_type & kBeginningOfStream) &&
+          StartsWith(body, body_size, "OpusHead")) {
+        serial = page_serial;
+      } else {
+        continue;
+      }
+    }
+    if (page_serial != *serial)
+      continue;
+    if (!(header_type & kContinuedPacket))
+      data.resize(packet_start);
+
+    for (size_t i = 0; i < num_segments; ++i) {
+      data.insert(data.end(), body, body + segments[i]);
+      body += segments[i];
+      if (segments[i] == 255)
+        continue;
+
+      // A packet is complete.
+      const uint8_t* packet = data.data() + packet_start;
+      const size_t size = data.size() - packet_start;
+      if (packet_index == 0) {
+        if (size < kOpusHeadSize || !StartsWith(packet, size, "OpusHead")) {
+          RTC_LOG(LS_ERROR) << "Invalid Opus ID header in " << path;
+          return nullptr;
+        }
+        num_channels = packet[9];
+        pre_skip = GetLe16(packet + 10);
+        const uint8_t mapping_family = packet[18];
+        if (num_channels < 1 || num_channels > 2 || mapping_family > 1) {
+          RTC_LOG(LS_ERROR) << "Unsupported Opus stream with " << num_channels
+                            << " channels and mapping family "
+                            << static_cast<int>(mapping_family) << " in "
+                            << path;
+          return nullptr;
+        }
+      } else if (packet_index > 1) {
+        const int duration =
+            PacketDuration(rtc::ArrayView<const uint8_t>(packet, size));
+        if (duration % kSamplesPer10Ms != 0) {
+          RTC_LOG(LS_ERROR) << "Unsupported Opus packet of " << duration
+                            << " samples in " << path
+                            << ", packets must be a multiple of 10 ms";
+          return nullptr;
+        }
+        if (duration > 0) {
+          packets.push_back({packet_start, size, duration});
+          packet_start = data.size();
+        }
+      }
+      ++packet_index;
+      data.resize(packet_start);
+    }
+  }
+
+  if (packets.empty()) {
+    RTC_LOG(LS_ERROR) << "No Opus packets in " << path;
+    return nullptr;
+  }
+  data.resize(packet_start);
+  data.shrink_to_fit();
+  return std::unique_ptr<OggOpusFile>(new OggOpusFile(
+      num_channels, pre_skip, std::move(data), std::move(packets)));
+}
+
+OggOpusFile::OggOpusFile(size_t num_channels,
+                         int pre_skip,
+                         std::vector<uint8_t> data,
+                         std::vector<Packet> packets)
+    : num_channels_(num_channels),
+      pre_skip_(pre_skip),
+      data_(std::move(data)),
+      packets_(std::move(packets)) {}
+
+OggOpusFile::~OggOpusFile() = default;
+
+rtc::ArrayView<const uint8_t> OggOpusFile::packet(size_t index) const {
+  RTC_DCHECK_LT(index, packets_.size());
+  return rtc::ArrayView<const uint8_t>(data_.data() + packets_[index].offset,
+                                       packets_[index].size);
+}
+
+int OggOpusFile::average_bitrate_bps() const {
+  int64_t duration = 0;
+  for (const Packet& packet : packets_)
+    duration += packet.duration;
+  return static_cast<int>(data_.size() * 8 * 48000 / duration);
+}
+
+// See RFC 6716, section 3.1.
+int OggOpusFile::PacketDuration(rtc::ArrayView<const uint8_t> data) {
+  if (data.empty())
+    return 0;
+  const int config = data[0] >> 3;
+  int frame_duration;
+  if (config < 12) {
+    // SILK: 10, 20, 40 or 60 ms.
+    static constexpr int kSilkDurations[] = {480, 960, 1920, 2880};
+    frame_duration = kSilkDurations[config % 4];
+  } else if (config < 16) {
+    // Hybrid: 10 or 20 ms.
+    frame_duration = config % 2 == 0 ? 480 : 960;
+  } else {
+    // CELT: 2.5, 5, 10 or 20 ms.
+    frame_duration = 120 << (config % 4);
+  }
+  int num_frames;
+  switch (data[0] & 0x3) {
+    case 0:
+      num_frames = 1;
+      break;
+    case 1:
+    case 2:
+      num_frames = 2;
+      break;
+    default:
+      if (data.size() < 2)
+        return 0;
+      num_frames = data[1] & 0x3f;
+      break;
+  }
+  const int duration = num_frames * frame_duration;
+  return duration > kMaxPacketDuration ? 0 : duration;
+}
+
+}  // namespace test
+}  // namespace webrtc
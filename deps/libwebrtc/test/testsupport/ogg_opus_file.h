@@ -0,0 +1,79 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef TEST_TESTSUPPORT_OGG_OPUS_FILE_H_
+#define TEST_TESTSUPPORT_OGG_OPUS_FILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "api/array_view.h"
+
+namespace webrtc {
+namespace test {
+
+// The Opus packets of an Ogg Opus (.opus) file, as written by opusenc or
+// ffmpeg. The whole file is read on Open() and the packets are kept in one
+// buffer, so a loaded file can be shared by any number of readers.
+//
+// Only the first Opus stream of the file is read, and only mono and stereo
+// streams (channel mapping family 0 or 1) are supported, since those are
+// what a single RTP Opus stream can carry. Page CRCs are not checked.
+class OggOpusFile {
+ public:
+  // Returns nullptr if the file can't be read, has no Opus stream or the
+  // stream has no audio packets. Packets must last a multiple of 10 ms, as
+  // RTP senders send whole 10 ms frames; streams with 2.5 or 5 ms packets
+  // are rejected.
+  static std::unique_ptr<OggOpusFile> Open(const std::string& path);
+  ~OggOpusFile();
+
+  size_t num_channels() const { return num_channels_; }
+  // Samples at 48 kHz to discard at the start of the stream.
+  int pre_skip() const { return pre_skip_; }
+  size_t num_packets() const { return packets_.size(); }
+  rtc::ArrayView<const uint8_t> packet(size_t index) const;
+  // Duration of packet |index| in samples at 48 kHz.
+  int packet_duration(size_t index) const {
+    return packets_[index].duration;
+  }
+  // Average bitrate over the whole stream.
+  int average_bitrate_bps() const;
+
+  // Duration in samples at 48 kHz of the Opus packet in |data|, as signaled
+  // by its TOC byte, or 0 if the packet is malformed.
+  static int PacketDuration(rtc::ArrayView<const uint8_t> data);
+
+ private:
+  struct Packet {
+    size_t offset;
+    size_t size;
+    int duration;
+  };
+
+  OggOpusFile(size_t num_channels,
+              int pre_skip,
+              std::vector<uint8_t> data,
+              std::vector<Packet> packets);
+
+  const size_t num_channels_;
+  const int pre_skip_;
+  const std::vector<uint8_t> data_;
+  const std::vector<Packet> packets_;
+};
+
+}  // namespace test
+}  // namespace webrtc
+
+#endif  // TEST_TESTSUPPORT_OGG_OPUS_FILE_H_
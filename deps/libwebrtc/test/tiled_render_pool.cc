@@ -0,0 +1,135 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "test/tiled_render_pool.h"
+
+#include <algorithm>
+
+#include "rtc_base/checks.h"
+
+namespace webrtc {
+namespace test {
+namespace {
+
+// Several bands per thread even out bands that take longer than others.
+constexpr int kBandsPerThread = 4;
+// Below this, handing out a band costs more than rendering it.
+constexpr int kMinBandHeight = 16;
+
+}  // namespace
+
+TiledRenderPool::TiledRenderPool(int num_threads)
+    : job_(nullptr),
+      generation_(0),
+      band_height_(0),
+      height_(0),
+      next_band_(0),
+      num_bands_(0),
+      pending_bands_(0),
+      quit_(false) {
+  RTC_DCHECK_GE(num_threads, 1);
+  for (int i = 1; i < num_threads; ++i) {
+    auto worker = std::make_unique<Worker>();
+    worker->pool = this;
+    worker->thread = std::make_unique<rtc::PlatformThread>(
+        &TiledRenderPool::Run, worker.get(), "TiledRender");
+    worker->thread->Start();
+    workers_.push_back(std::move(worker));
+  }
+}
+
+TiledRenderPool::~TiledRenderPool() {
+  {
+    rtc::CritScope crit(&crit_);
+    quit_ = true;
+  }
+  for (auto& worker : workers_)
+    worker->wake.Set();
+  for (auto& worker : workers_)
+    worker->thread->Stop();
+}
+
+void TiledRenderPool::Render(int height,
+                             const RenderBandFunction& render_band) {
+  if (workers_.empty() || height < 2 * kMinBandHeight) {
+    render_band(0, height);
+    return;
+  }
+  {
+    rtc::CritScope crit(&crit_);
+    RTC_DCHECK(!job_);
+    const int max_bands = std::max(1, height / kMinBandHeight);
+    const int bands = std::min(num_threads() * kBandsPerThread, max_bands);
+    // Round up to an even height, so chroma rows are not split.
+    band_height_ = ((height + bands - 1) / bands + 1) & ~1;
+    num_bands_ = (height + band_height_ - 1) / band_height_;
+    height_ = height;
+    next_band_ = 0;
+    pending_bands_ = num_bands_;
+    job_ = &render_band;
+    ++generation_;
+  }
+  for (auto& worker : workers_)
+    worker->wake.Set();
+  RenderBands();
+  done_.Wait(rtc::Event::kForever);
+  rtc::CritScope crit(&crit_);
+  job_ = nullptr;
+}
+
+// static
+void TiledRenderPool::Run(void* obj) {
+  Worker* worker = static_cast<Worker*>(obj);
+  worker->pool->WorkerLoop(worker);
+}
+
+void TiledRenderPool::WorkerLoop(Worker* worker) {
+  while (true) {
+    worker->wake.Wait(rtc::Event::kForever);
+    {
+      rtc::CritScope crit(&crit_);
+      if (quit_)
+        return;
+    }
+    RenderBands();
+  }
+}
+
+void TiledRenderPool::RenderBands() {
+  const RenderBandFunction* job;
+  int generation;
+  {
+    rtc::CritScope crit(&crit_);
+    job = job_;
+    generation = generation_;
+  }
+  if (!job)
+    return;
+  while (true) {
+    int row_begin;
+    int row_end;
+    {
+      rtc::CritScope crit(&crit_);
+      // |job| stays valid while a band of its generation is pending, as
+      // Render() waits for all of them.
+      if (generation != generation_ || next_band_ >= num_bands_)
+        return;
+      row_begin = next_band_++ * band_height_;
+      row_end = std::min(height_, row_begin + band_height_);
+    }
+    (*job)(row_begin, row_end);
+    rtc::CritScope crit(&crit_);
+    if (--pending_bands_ == 0)
+      done_.Set();
+  }
+}
+
+}  // namespace test
+}  // namespace webrtc
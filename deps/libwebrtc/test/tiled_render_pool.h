@@ -0,0 +1,77 @@
+/*
+ *  Copyright (c) 2020 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef TEST_TILED_RENDER_POOL_H_
+#define TEST_TILED_RENDER_POOL_H_
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "rtc_base/critical_section.h"
+#include "rtc_base/event.h"
+#include "rtc_base/platform_thread.h"
+#include "rtc_base/thread_annotations.h"
+
+namespace webrtc {
+namespace test {
+
+// Renders a frame in horizontal bands on a fixed set of worker threads, so
+// high resolution generators keep up with the capturer's frame interval.
+// The calling thread renders bands as well, and Render() returns once every
+// band is done.
+class TiledRenderPool {
+ public:
+  // Renders rows [row_begin, row_end) of the frame. Bands never overlap and
+  // start on even rows, so they don't share 4:2:0 chroma rows.
+  using RenderBandFunction = std::function<void(int row_begin, int row_end)>;
+
+  // |num_threads| includes the calling thread; 1 renders inline.
+  explicit TiledRenderPool(int num_threads);
+  ~TiledRenderPool();
+
+  int num_threads() const { return static_cast<int>(workers_.size()) + 1; }
+
+  // Calls |render_band| for bands covering rows [0, height). Must not be
+  // called concurrently.
+  void Render(int height, const RenderBandFunction& render_band);
+
+ private:
+  struct Worker {
+    TiledRenderPool* pool;
+    rtc::Event wake;
+    std::unique_ptr<rtc::PlatformThread> thread;
+  };
+
+  static void Run(void* obj);
+  void WorkerLoop(Worker* worker);
+  // Renders bands of the current job until none are left.
+  void RenderBands();
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  rtc::CriticalSection crit_;
+  const RenderBandFunction* job_ RTC_GUARDED_BY(crit_);
+  // Incremented per Render() call, so a worker waking up late never claims
+  // a band of a later job with a stale |job_|.
+  int generation_ RTC_GUARDED_BY(crit_);
+  int band_height_ RTC_GUARDED_BY(crit_);
+  int height_ RTC_GUARDED_BY(crit_);
+  int next_band_ RTC_GUARDED_BY(crit_);
+  int num_bands_ RTC_GUARDED_BY(crit_);
+  int pending_bands_ RTC_GUARDED_BY(crit_);
+  bool quit_ RTC_GUARDED_BY(crit_);
+  rtc::Event done_;
+};
+
+}  // namespace test
+}  // namespace webrtc
+
+#endif  // TEST_TILED_RENDER_POOL_H_
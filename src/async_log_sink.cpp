@@ -0,0 +1,192 @@
+#include "async_log_sink.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "rtc_base/time_utils.h"
+
+namespace webrtc {
+
+namespace {
+
+const char* const kCategoryNames[] = {"signaling", "ice", "media"};
+// The writer wakes up this often, or when the buffer is half full.
+const int kWriteIntervalMs = 50;
+const int64_t kSuppressedReportIntervalMs = 1000;
+
+}
+
+std::atomic<AsyncLogSink*> AsyncLogSink::installed_(nullptr);
+
+AsyncLogSink::AsyncLogSink(size_t capacity, size_t max_message_size, FILE* out)
+  : capacity_(std::max<size_t>(capacity, 2)),
+    max_message_size_(std::max<size_t>(max_message_size, 16)),
+    out_(out),
+    slots_(new char[capacity_ * max_message_size_]),
+    lengths_(new size_t[capacity_]())
+{
+  thread_ = std::thread(&AsyncLogSink::run, this);
+}
+
+AsyncLogSink::~AsyncLogSink()
+{
+  stop();
+}
+
+void AsyncLogSink::install(rtc::LoggingSeverity min_severity)
+{
+  AsyncLogSink* expected = nullptr;
+  if(!installed_.compare_exchange_strong(expected, this)) {
+    RTC_LOG(LS_WARNING) <<__FUNCTION__<<" another sink is installed";
+    return;
+  }
+  rtc::LogMessage::AddLogToStream(this, min_severity);
+  rtc::LogMessage::LogToDebug(rtc::LS_NONE);
+}
+
+void AsyncLogSink::remove()
+{
+  AsyncLogSink* expected = this;
+  if(!installed_.compare_exchange_strong(expected, nullptr)) {
+    return;
+  }
+  rtc::LogMessage::RemoveLogToStream(this);
+  rtc::LogMessage::LogToDebug(rtc::LS_INFO);
+}
+
+void AsyncLogSink::stop()
+{
+  remove();
+  {
+    std::lock_guard<std::mutex> lock(wake_lock_);
+    running_ = false;
+  }
+  wake_.notify_one();
+  if(thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void AsyncLogSink::set_limits(Category category, const CategoryLimits& limits)
+{
+  categories_[category].sample_every.store(std::max(1, limits.sample_every), std::memory_order_relaxed);
+  categories_[category].max_per_second.store(std::max(0, limits.max_per_second), std::memory_order_relaxed);
+}
+
+bool AsyncLogSink::should_log(Category category)
+{
+  AsyncLogSink* sink = installed_.load(std::memory_order_acquire);
+  return !sink || sink->should_log_category(category);
+}
+
+bool AsyncLogSink::should_log_category(Category category)
+{
+  CategoryState& state = categories_[category];
+  uint64_t seen = state.seen.fetch_add(1, std::memory_order_relaxed);
+  int sample_every = state.sample_every.load(std::memory_order_relaxed);
+  if(sample_every > 1 && seen % sample_every != 0) {
+    state.suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  int max_per_second = state.max_per_second.load(std::memory_order_relaxed);
+  if(max_per_second > 0) {
+    // Approximate under races, which only lets a few more messages through.
+    int64_t now_ms = rtc::TimeMillis();
+    int64_t window_start_ms = state.window_start_ms.load(std::memory_order_relaxed);
+    if(now_ms - window_start_ms >= 1000 &&
+       state.window_start_ms.compare_exchange_strong(window_start_ms, now_ms, std::memory_order_relaxed)) {
+      state.window_count.store(0, std::memory_order_relaxed);
+    }
+    if(state.window_count.fetch_add(1, std::memory_order_relaxed) >= max_per_second) {
+      state.suppressed.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+  }
+  return true;
+}
+
+void AsyncLogSink::OnLogMessage(const std::string& message)
+{
+  std::lock_guard<std::mutex> lock(producer_lock_);
+  uint64_t write = write_.load(std::memory_order_relaxed);
+  uint64_t queued = write - read_.load(std::memory_order_acquire);
+  if(queued >= capacity_) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  size_t slot = write % capacity_;
+  char* data = slots_.get() + slot * max_message_size_;
+  size_t length = std::min(message.size(), max_message_size_);
+  memcpy(data, message.data(), length);
+  if(length < message.size()) {
+    // Truncated; keep the line ending.
+    data[length - 1] = '\n';
+  }
+  lengths_[slot] = length;
+  write_.store(write + 1, std::memory_order_release);
+  if(queued + 1 == capacity_ / 2) {
+    wake_.notify_one();
+  }
+}
+
+void AsyncLogSink::run()
+{
+  int64_t last_report_ms = rtc::TimeMillis();
+  std::unique_lock<std::mutex> lock(wake_lock_);
+  while(running_) {
+    wake_.wait_for(lock, std::chrono::milliseconds(kWriteIntervalMs));
+    lock.unlock();
+    write_pending();
+    int64_t now_ms = rtc::TimeMillis();
+    if(now_ms - last_report_ms >= kSuppressedReportIntervalMs) {
+      write_suppressed();
+      last_report_ms = now_ms;
+    }
+    lock.lock();
+  }
+  lock.unlock();
+  write_pending();
+  write_suppressed();
+}
+
+void AsyncLogSink::write_pending()
+{
+  uint64_t read = read_.load(std::memory_order_relaxed);
+  uint64_t write = write_.load(std::memory_order_acquire);
+  if(read == write && dropped_.load(std::memory_order_relaxed) == dropped_reported_) {
+    return;
+  }
+  for(; read < write; read++) {
+    size_t slot = read % capacity_;
+    fwrite(slots_.get() + slot * max_message_size_, 1, lengths_[slot], out_);
+    // Frees the slot for the loggers.
+    read_.store(read + 1, std::memory_order_release);
+  }
+  uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+  if(dropped != dropped_reported_) {
+    fprintf(out_, "[AsyncLogSink] log buffer full, dropped %llu messages\n",
+            static_cast<unsigned long long>(dropped - dropped_reported_));
+    dropped_reported_ = dropped;
+  }
+  fflush(out_);
+}
+
+void AsyncLogSink::write_suppressed()
+{
+  bool written = false;
+  for(int category = 0; category < kCategories; category++) {
+    uint64_t suppressed = categories_[category].suppressed.exchange(0, std::memory_order_relaxed);
+    if(suppressed > 0) {
+      fprintf(out_, "[AsyncLogSink] sampled or rate limited %llu %s messages\n",
+              static_cast<unsigned long long>(suppressed), kCategoryNames[category]);
+      written = true;
+    }
+  }
+  if(written) {
+    fflush(out_);
+  }
+}
+
+}
@@ -0,0 +1,119 @@
+#ifndef BROADCASTER_ASYNC_LOG_SINK_H
+#define BROADCASTER_ASYNC_LOG_SINK_H
+
+#include <stdio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "rtc_base/logging.h"
+
+// Logs like RTC_LOG(sev), unless the installed AsyncLogSink samples or rate
+// limits |category| (an AsyncLogSink::Category without the prefix). Skipped
+// messages are not even formatted. RTC_LOG() is a bool expression, which
+// the << chain binds into.
+#define BROADCASTER_LOG(category, sev)                                          \
+  webrtc::AsyncLogSink::should_log(webrtc::AsyncLogSink::category) &&           \
+      RTC_LOG(sev)
+
+namespace webrtc {
+
+// Log sink that copies messages into a preallocated ring buffer and writes
+// them out on a background thread, so that threads logging never wait on
+// the output. Messages longer than a slot are truncated; when the buffer is
+// full, messages are dropped and counted.
+//
+// Hot callbacks log through BROADCASTER_LOG(), whose categories are sampled
+// (one message out of |sample_every|) and rate limited (at most
+// |max_per_second| a second, over all sessions) once a sink is installed.
+// Suppressed and dropped messages are reported in the output.
+class AsyncLogSink : public rtc::LogSink {
+public:
+  enum Category {
+    kSignaling = 0,  // Session description and peer connection observers.
+    kIce,            // Candidates and ICE state changes.
+    kMedia,          // Periodic messages from the frame and audio threads.
+    kCategories
+  };
+
+  struct CategoryLimits {
+    // Logs one message out of this many.
+    int sample_every = 1;
+    // 0 for no limit.
+    int max_per_second = 0;
+  };
+
+  // |capacity| messages of up to |max_message_size| bytes are preallocated.
+  // Messages are written to |out|.
+  AsyncLogSink(size_t capacity, size_t max_message_size, FILE* out);
+  // Calls stop(). The sink must not be destroyed while other threads may
+  // still call should_log(), which uses the sink it finds installed without
+  // holding a reference; a process wide sink is stopped and leaked instead.
+  virtual ~AsyncLogSink();
+
+  // Adds the sink to the log streams at |min_severity| and stops logging to
+  // stderr; remove() undoes that. Only one sink may be installed at a time.
+  void install(rtc::LoggingSeverity min_severity);
+  void remove();
+  // Removes the sink, writes out what is left and ends the writer thread.
+  // Later messages go to stderr. May be called more than once.
+  void stop();
+
+  void set_limits(Category category, const CategoryLimits& limits);
+
+  // Whether a message of |category| should be logged now. Always true
+  // without an installed sink.
+  static bool should_log(Category category);
+
+  // rtc::LogSink implementation. Never blocks on the output.
+  virtual void OnLogMessage(const std::string& message) override;
+
+private:
+  struct CategoryState {
+    std::atomic<int> sample_every{1};
+    std::atomic<int> max_per_second{0};
+    std::atomic<uint64_t> seen{0};
+    std::atomic<int64_t> window_start_ms{0};
+    std::atomic<int> window_count{0};
+    std::atomic<uint64_t> suppressed{0};
+  };
+
+  bool should_log_category(Category category);
+  void run();
+  // Writes the messages queued so far. Only called on the writer thread.
+  void write_pending();
+  void write_suppressed();
+
+  static std::atomic<AsyncLogSink*> installed_;
+
+  const size_t capacity_;
+  const size_t max_message_size_;
+  FILE* const out_;
+  // |capacity_| slots of |max_message_size_| bytes, and their lengths.
+  std::unique_ptr<char[]> slots_;
+  std::unique_ptr<size_t[]> lengths_;
+  // Slot indexes increase forever; slot i is at i % capacity_. The writer
+  // owns [read_, write_), the loggers the rest.
+  std::atomic<uint64_t> write_{0};
+  std::atomic<uint64_t> read_{0};
+  // webrtc calls the sinks one message at a time already; this keeps
+  // producers ordered if another caller doesn't.
+  std::mutex producer_lock_;
+  std::atomic<uint64_t> dropped_{0};
+  uint64_t dropped_reported_ = 0;
+
+  CategoryState categories_[kCategories];
+
+  std::mutex wake_lock_;
+  std::condition_variable wake_;
+  bool running_ = true;
+  std::thread thread_;
+};
+
+}
+
+#endif // BROADCASTER_ASYNC_LOG_SINK_H
@@ -0,0 +1,395 @@
+#include "chrome_tracer.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <vector>
+
+#include "rtc_base/event_tracer.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/platform_thread_types.h"
+#include "rtc_base/time_utils.h"
+#include "rtc_base/trace_event.h"
+
+namespace webrtc {
+
+namespace {
+
+const int kFlushIntervalMs = 1000;
+// Per thread, between two flushes. Events beyond are dropped and counted.
+const size_t kMaxBufferedEvents = 100000;
+const size_t kMaxArgs = 2;
+
+struct Category {
+  // First, so that the pointer handed to the macros is the category's.
+  unsigned char enabled;
+  const char* name;
+};
+
+struct Event {
+  char phase;
+  const char* category;
+  const char* name;
+  unsigned long long id;
+  int64_t timestamp_us;
+  int num_args;
+  const char* arg_names[kMaxArgs];
+  unsigned char arg_types[kMaxArgs];
+  unsigned long long arg_values[kMaxArgs];
+  // String arguments are copied; the pointers may not outlive the call.
+  std::string arg_strings[kMaxArgs];
+};
+
+struct ThreadBuffer {
+  // Taken by the thread for each event and by the writer to swap |events|.
+  std::mutex lock;
+  std::vector<Event> events;
+  uint64_t dropped = 0;
+  const int tid = rtc::CurrentThreadId();
+  std::string thread_name;
+  // Only used by the writer thread, and reset when a tracer starts.
+  bool name_written = false;
+  std::atomic<bool> exited{false};
+};
+
+// Never destroyed: threads may trace while the process exits.
+struct TraceState {
+  std::mutex lock;
+  // Guarded by lock. Elements never move.
+  std::deque<Category> categories;
+  std::vector<std::string> filter;
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  ChromeTracer* tracer = nullptr;
+  std::atomic<bool> active{false};
+};
+
+TraceState* state()
+{
+  static TraceState* state = new TraceState();
+  return state;
+}
+
+// Called with the state's lock held.
+bool category_matches(const TraceState* s, const char* name)
+{
+  if(s->filter.empty()) {
+    return strncmp(name, "disabled-by-default-", 20) != 0;
+  }
+  for(const std::string& category : s->filter) {
+    if(category == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+struct ThreadBufferHolder {
+  ~ThreadBufferHolder() {
+    if(buffer) {
+      buffer->exited = true;
+    }
+  }
+  std::shared_ptr<ThreadBuffer> buffer;
+};
+
+ThreadBuffer* current_thread_buffer()
+{
+  thread_local ThreadBufferHolder holder;
+  if(!holder.buffer) {
+    holder.buffer = std::make_shared<ThreadBuffer>();
+    char name[64] = {0};
+    if(pthread_getname_np(pthread_self(), name, sizeof(name)) == 0) {
+      holder.buffer->thread_name = name;
+    }
+    TraceState* s = state();
+    std::lock_guard<std::mutex> lock(s->lock);
+    s->buffers.push_back(holder.buffer);
+  }
+  return holder.buffer.get();
+}
+
+const unsigned char* get_category_enabled(const char* name)
+{
+  TraceState* s = state();
+  std::lock_guard<std::mutex> lock(s->lock);
+  for(Category& category : s->categories) {
+    if(strcmp(category.name, name) == 0) {
+      return &category.enabled;
+    }
+  }
+  // The macros pass string literals.
+  s->categories.push_back({0, name});
+  Category& category = s->categories.back();
+  category.enabled = s->active && category_matches(s, name) ? 1 : 0;
+  return &category.enabled;
+}
+
+void add_trace_event(char phase,
+                     const unsigned char* category_enabled,
+                     const char* name,
+                     unsigned long long id,
+                     int num_args,
+                     const char** arg_names,
+                     const unsigned char* arg_types,
+                     const unsigned long long* arg_values,
+                     unsigned char flags)
+{
+  if(!state()->active.load(std::memory_order_relaxed)) {
+    return;
+  }
+  int64_t timestamp_us = rtc::TimeMicros();
+  ThreadBuffer* buffer = current_thread_buffer();
+  std::lock_guard<std::mutex> lock(buffer->lock);
+  if(buffer->events.size() >= kMaxBufferedEvents) {
+    buffer->dropped++;
+    return;
+  }
+  buffer->events.emplace_back();
+  Event& event = buffer->events.back();
+  event.phase = phase;
+  event.category = reinterpret_cast<const Category*>(category_enabled)->name;
+  event.name = name;
+  event.id = id;
+  event.timestamp_us = timestamp_us;
+  event.num_args = std::min<int>(num_args, kMaxArgs);
+  for(int i = 0; i < event.num_args; i++) {
+    event.arg_names[i] = arg_names[i];
+    event.arg_types[i] = arg_types[i];
+    event.arg_values[i] = arg_values[i];
+    if(arg_types[i] == TRACE_VALUE_TYPE_STRING || arg_types[i] == TRACE_VALUE_TYPE_COPY_STRING) {
+      const char* str = reinterpret_cast<const char*>(static_cast<uintptr_t>(arg_values[i]));
+      event.arg_strings[i] = str ? str : "";
+    }
+  }
+}
+
+void write_json_string(FILE* file, const char* str)
+{
+  fputc('"', file);
+  for(const char* c = str; *c; c++) {
+    switch(*c) {
+      case '"': fputs("\\\"", file); break;
+      case '\\': fputs("\\\\", file); break;
+      case '\n': fputs("\\n", file); break;
+      case '\r': fputs("\\r", file); break;
+      case '\t': fputs("\\t", file); break;
+      default:
+        if(static_cast<unsigned char>(*c) < 0x20) {
+          fprintf(file, "\\u%04x", *c);
+        } else {
+          fputc(*c, file);
+        }
+    }
+  }
+  fputc('"', file);
+}
+
+void write_arg_value(FILE* file, const Event& event, int i)
+{
+  unsigned long long value = event.arg_values[i];
+  switch(event.arg_types[i]) {
+    case TRACE_VALUE_TYPE_BOOL:
+      fputs(value ? "true" : "false", file);
+      break;
+    case TRACE_VALUE_TYPE_UINT:
+      fprintf(file, "%llu", value);
+      break;
+    case TRACE_VALUE_TYPE_INT:
+      fprintf(file, "%lld", static_cast<long long>(value));
+      break;
+    case TRACE_VALUE_TYPE_DOUBLE: {
+      double d;
+      memcpy(&d, &value, sizeof(d));
+      if(d == d && d - d == 0) {
+        fprintf(file, "%.17g", d);
+      } else {
+        fputs("null", file);
+      }
+      break;
+    }
+    case TRACE_VALUE_TYPE_POINTER:
+      fprintf(file, "\"0x%llx\"", value);
+      break;
+    default:
+      write_json_string(file, event.arg_strings[i].c_str());
+  }
+}
+
+bool has_id(char phase)
+{
+  return strchr("STpFben", phase) != nullptr;
+}
+
+}
+
+std::unique_ptr<ChromeTracer> ChromeTracer::start(const std::string& path, const std::string& categories)
+{
+  std::string file_path = path;
+  std::string::size_type pos = file_path.find("%p");
+  if(pos != std::string::npos) {
+    file_path.replace(pos, 2, std::to_string(getpid()));
+  }
+  TraceState* s = state();
+  std::lock_guard<std::mutex> lock(s->lock);
+  if(s->tracer) {
+    RTC_LOG(LS_WARNING) <<__FUNCTION__<<" a tracer is running";
+    return nullptr;
+  }
+  FILE* file = fopen(file_path.c_str(), "w");
+  if(!file) {
+    RTC_LOG(LS_ERROR) <<__FUNCTION__<<" can't open "<<file_path<<": "<<strerror(errno);
+    return nullptr;
+  }
+  RTC_LOG(INFO) <<__FUNCTION__<<" tracing "<<(categories.empty() ? "all categories" : categories)<<" to "<<file_path;
+
+  s->filter.clear();
+  for(std::string::size_type begin = 0; begin <= categories.size();) {
+    std::string::size_type end = categories.find(',', begin);
+    if(end == std::string::npos) {
+      end = categories.size();
+    }
+    if(end > begin) {
+      s->filter.push_back(categories.substr(begin, end - begin));
+    }
+    begin = end + 1;
+  }
+  // Each file names its threads.
+  for(const std::shared_ptr<ThreadBuffer>& buffer : s->buffers) {
+    buffer->name_written = false;
+  }
+  s->active = true;
+  for(Category& category : s->categories) {
+    category.enabled = category_matches(s, category.name) ? 1 : 0;
+  }
+  // Stays installed once set; stopping disables the categories.
+  static bool tracer_set_up = false;
+  if(!tracer_set_up) {
+    SetupEventTracer(&get_category_enabled, &add_trace_event);
+    tracer_set_up = true;
+  }
+  s->tracer = new ChromeTracer(file);
+  return std::unique_ptr<ChromeTracer>(s->tracer);
+}
+
+bool ChromeTracer::active()
+{
+  return state()->active.load(std::memory_order_relaxed);
+}
+
+ChromeTracer::ChromeTracer(FILE* file)
+  : file_(file)
+{
+  fputs("[\n", file_);
+  thread_ = std::thread(&ChromeTracer::run, this);
+}
+
+ChromeTracer::~ChromeTracer()
+{
+  TraceState* s = state();
+  {
+    std::lock_guard<std::mutex> lock(s->lock);
+    s->active = false;
+    for(Category& category : s->categories) {
+      category.enabled = 0;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(wake_lock_);
+    running_ = false;
+  }
+  wake_.notify_one();
+  thread_.join();
+  fputs("\n]\n", file_);
+  fclose(file_);
+  if(dropped_ > 0) {
+    RTC_LOG(LS_WARNING) <<__FUNCTION__<<" dropped "<<dropped_<<" trace events; buffers were full";
+  }
+  std::lock_guard<std::mutex> lock(s->lock);
+  s->tracer = nullptr;
+}
+
+void ChromeTracer::run()
+{
+  std::unique_lock<std::mutex> lock(wake_lock_);
+  while(running_) {
+    wake_.wait_for(lock, std::chrono::milliseconds(kFlushIntervalMs));
+    lock.unlock();
+    write_pending();
+    lock.lock();
+  }
+  lock.unlock();
+  write_pending();
+}
+
+void ChromeTracer::write_pending()
+{
+  TraceState* s = state();
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  {
+    std::lock_guard<std::mutex> lock(s->lock);
+    buffers = s->buffers;
+  }
+  const int pid = getpid();
+  std::vector<Event> events;
+  for(const std::shared_ptr<ThreadBuffer>& buffer : buffers) {
+    // Checked before the swap, so that an exited thread's last events are
+    // written before its buffer is forgotten.
+    bool exited = buffer->exited;
+    {
+      std::lock_guard<std::mutex> lock(buffer->lock);
+      events.swap(buffer->events);
+      dropped_ += buffer->dropped;
+      buffer->dropped = 0;
+    }
+    if(!buffer->name_written && !events.empty()) {
+      fprintf(file_, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+              first_event_ ? "" : ",\n", pid, buffer->tid);
+      write_json_string(file_, buffer->thread_name.c_str());
+      fputs("}}", file_);
+      first_event_ = false;
+      buffer->name_written = true;
+    }
+    for(const Event& event : events) {
+      fprintf(file_, "%s{\"name\":", first_event_ ? "" : ",\n");
+      write_json_string(file_, event.name);
+      fputs(",\"cat\":", file_);
+      write_json_string(file_, event.category);
+      fprintf(file_, ",\"ph\":\"%c\",\"ts\":%lld,\"pid\":%d,\"tid\":%d",
+              event.phase, static_cast<long long>(event.timestamp_us), pid, buffer->tid);
+      if(has_id(event.phase)) {
+        fprintf(file_, ",\"id\":\"0x%llx\"", event.id);
+      }
+      if(event.phase == 'I' || event.phase == 'i') {
+        fputs(",\"s\":\"t\"", file_);
+      }
+      if(event.num_args > 0) {
+        fputs(",\"args\":{", file_);
+        for(int i = 0; i < event.num_args; i++) {
+          if(i > 0) {
+            fputc(',', file_);
+          }
+          write_json_string(file_, event.arg_names[i]);
+          fputc(':', file_);
+          write_arg_value(file_, event, i);
+        }
+        fputc('}', file_);
+      }
+      fputc('}', file_);
+      first_event_ = false;
+    }
+    // Keeps the capacity for the next swap.
+    events.clear();
+    if(exited) {
+      std::lock_guard<std::mutex> lock(s->lock);
+      s->buffers.erase(std::remove(s->buffers.begin(), s->buffers.end(), buffer), s->buffers.end());
+    }
+  }
+  fflush(file_);
+}
+
+}
@@ -0,0 +1,56 @@
+#ifndef BROADCASTER_CHROME_TRACER_H
+#define BROADCASTER_CHROME_TRACER_H
+
+#include <stdio.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace webrtc {
+
+// Records the TRACE_EVENT*() macros of rtc_base/trace_event.h, ours and
+// libwebrtc's, and writes them to a file in the Chrome trace event JSON
+// format, which chrome://tracing and https://ui.perfetto.dev open.
+//
+// Each thread appends its events to a buffer of its own, under a lock that
+// only the writer thread also takes, once a second, to swap the buffer out
+// and write it in bulk. Without a started tracer, the macros only test a
+// disabled category flag.
+class ChromeTracer {
+public:
+  // Starts tracing |categories| (comma separated; empty for all but the
+  // "disabled-by-default-" ones) to |path|, in which "%p" is replaced by
+  // the pid. nullptr if the file can't be opened or a tracer is running.
+  // The macros look their category up once; call sites that ran before the
+  // first start() stay disabled, so start before creating the sessions.
+  static std::unique_ptr<ChromeTracer> start(const std::string& path, const std::string& categories);
+  // Stops tracing and writes out the remaining events.
+  ~ChromeTracer();
+
+  // Whether a tracer is running, for instrumentation that costs more than
+  // the macros, such as wrapping the codecs.
+  static bool active();
+
+private:
+  ChromeTracer(FILE* file);
+
+  void run();
+  // Writes the events buffered so far. Only called on the writer thread.
+  void write_pending();
+
+  FILE* const file_;
+  bool first_event_ = true;
+  uint64_t dropped_ = 0;
+
+  std::mutex wake_lock_;
+  std::condition_variable wake_;
+  bool running_ = true;
+  std::thread thread_;
+};
+
+}
+
+#endif // BROADCASTER_CHROME_TRACER_H
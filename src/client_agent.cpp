@@ -7,11 +7,19 @@
 #include "api/audio_codecs/builtin_audio_decoder_factory.h"
 #include "api/audio_codecs/builtin_audio_encoder_factory.h"
 #include "api/audio_options.h"
+#include "api/call/call_factory_interface.h"
 #include "api/create_peerconnection_factory.h"
+#include "api/rtc_event_log/rtc_event_log_factory.h"
 #include "api/rtp_sender_interface.h"
+#include "api/task_queue/default_task_queue_factory.h"
 #include "api/video_codecs/builtin_video_decoder_factory.h"
 #include "api/video_codecs/builtin_video_encoder_factory.h"
 #include "api/video_codecs/video_decoder_factory.h"
+#include "api/video_codecs/video_encoder.h"
+#include "api/video_codecs/video_encoder_factory.h"
+#include "async_log_sink.h"
+#include "chrome_tracer.h"
+#include "media/engine/webrtc_media_engine.h"
 #include "modules/audio_device/include/audio_device.h"
 #include "modules/video_capture/video_capture.h"
 #include "modules/video_capture/video_capture_factory.h"
@@ -22,6 +30,8 @@
 #include "rtc_base/logging.h"
 #include "rtc_base/ref_counted_object.h"
 #include "rtc_base/rtc_certificate_generator.h"
+#include "rtc_base/trace_event.h"
+#include "stats_collector.h"
 #include "test/vcm_capturer.h"
 
 namespace webrtc {
@@ -32,13 +42,102 @@ public:
   static DummySetSessionDescriptionObserver* Create() {
     return new rtc::RefCountedObject<DummySetSessionDescriptionObserver>();
   }
-  virtual void OnSuccess() { RTC_LOG(INFO) << "DummySetSessionDescriptionObserver::"<<__FUNCTION__; }
+  virtual void OnSuccess() { BROADCASTER_LOG(kSignaling, INFO) << "DummySetSessionDescriptionObserver::"<<__FUNCTION__; }
   virtual void OnFailure(webrtc::RTCError error) {
-    RTC_LOG(INFO) << "DummySetSessionDescriptionObserver::"<<__FUNCTION__ << " " << ToString(error.type()) << ": "
+    BROADCASTER_LOG(kSignaling, INFO) << "DummySetSessionDescriptionObserver::"<<__FUNCTION__ << " " << ToString(error.type()) << ": "
                   << error.message();
   }
 };
 
+// Traces the calls into the encoders of |factory| and, if |stages| is set,
+// reports when frames enter and leave them. Only installed while tracing or
+// with stage metrics, so that sessions don't pay for the extra calls
+// otherwise.
+class InstrumentedVideoEncoderFactory : public webrtc::VideoEncoderFactory {
+public:
+  InstrumentedVideoEncoderFactory(std::unique_ptr<webrtc::VideoEncoderFactory> factory,
+                                  webrtc::VideoSendStageMetrics* stages)
+    : factory_(std::move(factory)), stages_(stages) {}
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override {
+    return factory_->GetSupportedFormats();
+  }
+  std::vector<webrtc::SdpVideoFormat> GetImplementations() const override {
+    return factory_->GetImplementations();
+  }
+  CodecInfo QueryVideoEncoder(const webrtc::SdpVideoFormat& format) const override {
+    return factory_->QueryVideoEncoder(format);
+  }
+  std::unique_ptr<webrtc::VideoEncoder> CreateVideoEncoder(const webrtc::SdpVideoFormat& format) override {
+    std::unique_ptr<webrtc::VideoEncoder> encoder = factory_->CreateVideoEncoder(format);
+    if(!encoder) {
+      return nullptr;
+    }
+    return std::make_unique<InstrumentedVideoEncoder>(std::move(encoder), stages_);
+  }
+  std::unique_ptr<EncoderSelectorInterface> GetEncoderSelector() const override {
+    return factory_->GetEncoderSelector();
+  }
+
+private:
+  class InstrumentedVideoEncoder : public webrtc::VideoEncoder,
+                                   public webrtc::EncodedImageCallback {
+  public:
+    InstrumentedVideoEncoder(std::unique_ptr<webrtc::VideoEncoder> encoder,
+                             webrtc::VideoSendStageMetrics* stages)
+      : encoder_(std::move(encoder)), stages_(stages), callback_(nullptr) {}
+
+    void SetFecControllerOverride(webrtc::FecControllerOverride* fec_controller_override) override {
+      encoder_->SetFecControllerOverride(fec_controller_override);
+    }
+    int32_t InitEncode(const webrtc::VideoCodec* codec_settings, const Settings& settings) override {
+      TRACE_EVENT0("broadcaster", "VideoEncoder::InitEncode");
+      return encoder_->InitEncode(codec_settings, settings);
+    }
+    int32_t RegisterEncodeCompleteCallback(webrtc::EncodedImageCallback* callback) override {
+      // Set on the encoder queue, like the calls to the callback.
+      callback_ = callback;
+      return encoder_->RegisterEncodeCompleteCallback(callback && stages_ ? this : callback);
+    }
+    int32_t Release() override { return encoder_->Release(); }
+    int32_t Encode(const webrtc::VideoFrame& frame, const std::vector<webrtc::VideoFrameType>* frame_types) override {
+      TRACE_EVENT1("broadcaster", "VideoEncoder::Encode", "timestamp", frame.timestamp());
+      if(stages_) {
+        stages_->OnEncoderInput(frame.timestamp(), frame.timestamp_us());
+      }
+      return encoder_->Encode(frame, frame_types);
+    }
+    void SetRates(const RateControlParameters& parameters) override {
+      encoder_->SetRates(parameters);
+    }
+    void OnPacketLossRateUpdate(float packet_loss_rate) override {
+      encoder_->OnPacketLossRateUpdate(packet_loss_rate);
+    }
+    void OnRttUpdate(int64_t rtt_ms) override { encoder_->OnRttUpdate(rtt_ms); }
+    void OnLossNotification(const LossNotification& loss_notification) override {
+      encoder_->OnLossNotification(loss_notification);
+    }
+    EncoderInfo GetEncoderInfo() const override { return encoder_->GetEncoderInfo(); }
+
+    // EncodedImageCallback implementation, only registered with |stages_|.
+    Result OnEncodedImage(const webrtc::EncodedImage& encoded_image,
+                          const webrtc::CodecSpecificInfo* codec_specific_info,
+                          const webrtc::RTPFragmentationHeader* fragmentation) override {
+      stages_->OnEncodedImage(encoded_image.Timestamp());
+      return callback_->OnEncodedImage(encoded_image, codec_specific_info, fragmentation);
+    }
+    void OnDroppedFrame(DropReason reason) override { callback_->OnDroppedFrame(reason); }
+
+  private:
+    std::unique_ptr<webrtc::VideoEncoder> encoder_;
+    webrtc::VideoSendStageMetrics* const stages_;
+    webrtc::EncodedImageCallback* callback_;
+  };
+
+  std::unique_ptr<webrtc::VideoEncoderFactory> factory_;
+  webrtc::VideoSendStageMetrics* const stages_;
+};
+
 class CapturerTrackSource : public webrtc::VideoTrackSource {
 public:
   static rtc::scoped_refptr<CapturerTrackSource> Create() {
@@ -90,9 +189,17 @@ ClientAgent::ClientAgent()
   RTC_LOG(INFO) <<__FUNCTION__;
 }
 
+ClientAgent::ClientAgent(absl::optional<double> capture_phase)
+:pc_(nullptr), signal_thread_(nullptr), srflx_count_(0), capture_phase_(capture_phase)
+{
+  RTC_LOG(INFO) <<__FUNCTION__;
+}
+
 ClientAgent::~ClientAgent()
 {
   RTC_LOG(INFO) <<__FUNCTION__<<" >>>";
+  // Before the signaling thread stops.
+  StatsCollector::instance()->remove_session(pc_.get());
 	pc_->Close();
 
   RTC_LOG(INFO) <<__FUNCTION__<<" free pc_";
@@ -128,6 +235,7 @@ ClientAgent::~ClientAgent()
 bool ClientAgent::init()
 {
   RTC_LOG(INFO) <<__FUNCTION__;
+  TRACE_EVENT0("broadcaster", "ClientAgent::init");
 	if(!factory_.get()) {
     factory_ = this->get_factory();
     if(!factory_.get()) {
@@ -142,25 +250,38 @@ bool ClientAgent::init()
 	server.uri = "stun:stun.l.google.com:19302";
   config.servers.push_back(server);
 
-  pc_ = factory_->CreatePeerConnection(config, nullptr, nullptr, this);
+  {
+    TRACE_EVENT0("broadcaster", "CreatePeerConnection");
+    pc_ = factory_->CreatePeerConnection(config, nullptr, nullptr, this);
+  }
+  if(pc_) {
+    StatsCollector::instance()->add_session(pc_.get(), &metrics_);
+  }
 	return true;
 }
 
 std::string ClientAgent::create_offer()
 {
   RTC_LOG(INFO) <<__FUNCTION__;
+  TRACE_EVENT0("broadcaster", "ClientAgent::create_offer");
+  TRACE_EVENT_BEGIN0("broadcaster", "create_tracks");
 	auto audio_track = create_audio_track();
 	pc_->AddTrack(audio_track, {"audio"});
   auto video_track = create_video_track();
 	pc_->AddTrack(video_track, {"video"});
+  TRACE_EVENT_END0("broadcaster", "create_tracks");
   PeerConnectionInterface::RTCOfferAnswerOptions answer_opts;
 	auto f = sdp_promise_.get_future();
+  TRACE_EVENT_BEGIN0("broadcaster", "CreateOffer");
   pc_->CreateOffer(this,answer_opts);
   srflx_count_ = 0;
   auto ice_f = ice_promise_.get_future();
 	auto sdp = f.get();
+  TRACE_EVENT_END0("broadcaster", "CreateOffer");
   RTC_LOG(INFO) <<__FUNCTION__<<" offer sdp: "<<sdp;
+  TRACE_EVENT_BEGIN0("broadcaster", "ice_gathering");
   auto result = ice_f.get();
+  TRACE_EVENT_END0("broadcaster", "ice_gathering");
 	return merge_ice(sdp);
 }
 
@@ -217,6 +338,7 @@ int ClientAgent::get_local_tracks()
 
 bool ClientAgent::start_stream(std::string &remote_sdp)
 {
+  TRACE_EVENT0("broadcaster", "ClientAgent::start_stream");
   webrtc::SdpType type = webrtc::SdpType::kAnswer;
   webrtc::SdpParseError error;
   std::unique_ptr<webrtc::SessionDescriptionInterface> session_description =
@@ -273,6 +395,7 @@ bool ClientAgent::enable_stream(StreamType stype, bool enabled)
 
 rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> ClientAgent::get_factory()
 {
+  TRACE_EVENT0("broadcaster", "ClientAgent::get_factory");
 	if(!signal_thread_) {
     signal_thread_   = rtc::Thread::Create().release();
     signal_thread_->SetName("signaling_thread", nullptr);
@@ -287,23 +410,58 @@ rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> ClientAgent::create_f
 {
   webrtc::PeerConnectionInterface::RTCConfiguration config;
 
-  auto fakeAudioCaptureModule = FakeAudioCaptureModule::Create();
+  if (send_stage_metrics_enabled())
+  {
+    send_stages_ = std::make_unique<webrtc::VideoSendStageMetrics>(&metrics_);
+  }
+
+  auto fakeAudioCaptureModule = FakeAudioCaptureModule::Create(create_audio_source());
   if (!fakeAudioCaptureModule)
   {
     RTC_LOG(INFO) <<__FUNCTION__<<" audio capture module creation errored";
   }
+  else
+  {
+    fakeAudioCaptureModule->SetMetricsRegistry(&metrics_);
+    if (capture_phase_)
+    {
+      fakeAudioCaptureModule->SetProcessPhase(*capture_phase_);
+    }
+  }
+
+  // As CreatePeerConnectionFactory(), with the encoders and the event log
+  // reporting the send stages of the video frames if enabled.
+  webrtc::PeerConnectionFactoryDependencies dependencies;
+  dependencies.signaling_thread = signal_thread_;
+  dependencies.task_queue_factory = webrtc::CreateDefaultTaskQueueFactory();
+  dependencies.call_factory = webrtc::CreateCallFactory();
+  dependencies.event_log_factory = std::make_unique<webrtc::RtcEventLogFactory>(dependencies.task_queue_factory.get());
+  if (send_stages_)
+  {
+    dependencies.event_log_factory = send_stages_->CreateEventLogFactory(std::move(dependencies.event_log_factory));
+  }
 
-  rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory = webrtc::CreatePeerConnectionFactory(
-    nullptr,
-    nullptr,
-    signal_thread_,
-    fakeAudioCaptureModule,
-    webrtc::CreateBuiltinAudioEncoderFactory(),
-    webrtc::CreateBuiltinAudioDecoderFactory(),
-    webrtc::CreateBuiltinVideoEncoderFactory(),
-    webrtc::CreateBuiltinVideoDecoderFactory(),
-    nullptr /*audio_mixer*/,
-    nullptr /*audio_processing*/);
+  cricket::MediaEngineDependencies media_dependencies;
+  media_dependencies.task_queue_factory = dependencies.task_queue_factory.get();
+  media_dependencies.adm = fakeAudioCaptureModule;
+  media_dependencies.audio_encoder_factory = create_audio_encoder_factory();
+  media_dependencies.audio_decoder_factory = webrtc::CreateBuiltinAudioDecoderFactory();
+  media_dependencies.audio_processing = create_audio_processing();
+  if (!media_dependencies.audio_processing)
+  {
+    media_dependencies.audio_processing = webrtc::AudioProcessingBuilder().Create();
+  }
+  media_dependencies.video_encoder_factory = webrtc::CreateBuiltinVideoEncoderFactory();
+  if (send_stages_ || ChromeTracer::active())
+  {
+    media_dependencies.video_encoder_factory = std::make_unique<InstrumentedVideoEncoderFactory>(
+      std::move(media_dependencies.video_encoder_factory), send_stages_.get());
+  }
+  media_dependencies.video_decoder_factory = webrtc::CreateBuiltinVideoDecoderFactory();
+  dependencies.media_engine = cricket::CreateMediaEngine(std::move(media_dependencies));
+
+  rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory =
+    webrtc::CreateModularPeerConnectionFactory(std::move(dependencies));
 
   if (!factory){
     RTC_LOG(INFO) <<__FUNCTION__<<" error ocurred creating peerconnection factory";
@@ -311,17 +469,50 @@ rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> ClientAgent::create_f
   return factory;
 }
 
+rtc::scoped_refptr<webrtc::AudioProcessing> ClientAgent::create_audio_processing()
+{
+  if (audio_processing_enabled())
+  {
+    return nullptr;
+  }
+  rtc::scoped_refptr<webrtc::AudioProcessing> audio_processing = webrtc::AudioProcessingBuilder().Create();
+  webrtc::AudioProcessing::Config apm_config;
+  apm_config.pre_amplifier.enabled = false;
+  apm_config.high_pass_filter.enabled = false;
+  apm_config.echo_canceller.enabled = false;
+  apm_config.residual_echo_detector.enabled = false;
+  apm_config.noise_suppression.enabled = false;
+  apm_config.transient_suppression.enabled = false;
+  apm_config.voice_detection.enabled = false;
+  apm_config.gain_controller1.enabled = false;
+  apm_config.gain_controller2.enabled = false;
+  apm_config.level_estimation.enabled = false;
+  audio_processing->ApplyConfig(apm_config);
+  return audio_processing;
+}
+
+rtc::scoped_refptr<webrtc::AudioEncoderFactory> ClientAgent::create_audio_encoder_factory()
+{
+  return webrtc::CreateBuiltinAudioEncoderFactory();
+}
+
 rtc::scoped_refptr<webrtc::AudioTrackInterface> ClientAgent::create_audio_track()
 {
+  // The voice engine turns the processing stages on by default, whatever the
+  // module's config, unless the track's options turn them off.
+  cricket::AudioOptions options;
+  if (!audio_processing_enabled())
+  {
+    options.echo_cancellation = false;
+    options.auto_gain_control = false;
+    options.noise_suppression = false;
+    options.highpass_filter = false;
+    options.typing_detection = false;
+    options.residual_echo_detector = false;
+  }
   rtc::scoped_refptr<webrtc::AudioTrackInterface> audio_track(
-    factory_->CreateAudioTrack("audio",factory_->CreateAudioSource(
-        cricket::AudioOptions())));
+    factory_->CreateAudioTrack("audio",factory_->CreateAudioSource(options)));
 	return audio_track;
-
-//  cricket::AudioOptions options;
-//  options.highpass_filter = false;
-//  rtc::scoped_refptr<webrtc::AudioSourceInterface> source = factory_->CreateAudioSource(options);
-//  return factory_->CreateAudioTrack("audio", source);
 }
 
 rtc::scoped_refptr<webrtc::VideoTrackInterface> ClientAgent::create_video_track()
@@ -342,38 +533,38 @@ rtc::scoped_refptr<webrtc::VideoTrackInterface> ClientAgent::create_video_track(
 
 void ClientAgent::OnSignalingChange(webrtc::PeerConnectionInterface::SignalingState new_state)
 {
-  RTC_LOG(INFO) <<__FUNCTION__;
+  BROADCASTER_LOG(kSignaling, INFO) <<__FUNCTION__;
 }
 
 void ClientAgent::OnAddTrack(rtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver,
                 const std::vector<rtc::scoped_refptr<webrtc::MediaStreamInterface>>& streams)
 {
-  RTC_LOG(INFO) <<__FUNCTION__;
+  BROADCASTER_LOG(kSignaling, INFO) <<__FUNCTION__;
 }
 
 void ClientAgent::OnRemoveTrack(rtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver)
 {
-  RTC_LOG(INFO) <<__FUNCTION__;
+  BROADCASTER_LOG(kSignaling, INFO) <<__FUNCTION__;
 }
 
 void ClientAgent::OnDataChannel(rtc::scoped_refptr<webrtc::DataChannelInterface> channel)
 {
-  RTC_LOG(INFO) <<__FUNCTION__;
+  BROADCASTER_LOG(kSignaling, INFO) <<__FUNCTION__;
 }
 
 void ClientAgent::OnRenegotiationNeeded()
 {
-  RTC_LOG(INFO) <<__FUNCTION__;
+  BROADCASTER_LOG(kSignaling, INFO) <<__FUNCTION__;
 }
 
 void ClientAgent::OnIceConnectionChange(webrtc::PeerConnectionInterface::IceConnectionState new_state)
 {
-  RTC_LOG(INFO) <<__FUNCTION__;
+  BROADCASTER_LOG(kIce, INFO) <<__FUNCTION__;
 }
 
 void ClientAgent::OnIceGatheringChange(webrtc::PeerConnectionInterface::IceGatheringState new_state)
 {
-  RTC_LOG(INFO) <<__FUNCTION__<<" new_state "<<new_state;
+  BROADCASTER_LOG(kIce, INFO) <<__FUNCTION__<<" new_state "<<new_state;
   if(new_state == PeerConnectionInterface::kIceGatheringNew) {
     ice_.clear();
   } else if (new_state == PeerConnectionInterface::kIceGatheringComplete) {
@@ -388,7 +579,7 @@ void ClientAgent::OnIceCandidate(const webrtc::IceCandidateInterface* candidate)
 {
   std::string candidateStr;
   candidate->ToString(&candidateStr);
-  RTC_LOG(INFO) <<__FUNCTION__<<" candidate "<<candidate->sdp_mline_index()<<":"<<candidateStr;
+  BROADCASTER_LOG(kIce, INFO) <<__FUNCTION__<<" candidate "<<candidate->sdp_mline_index()<<":"<<candidateStr;
 	std::string sdp = std::string("a=")+ candidateStr + "\r\n";
 	std::map<int, std::string>::iterator it = ice_.find(candidate->sdp_mline_index());
 	if(it != ice_.end()) {
@@ -398,7 +589,7 @@ void ClientAgent::OnIceCandidate(const webrtc::IceCandidateInterface* candidate)
 	}
 	if(srflx_count_ >=0 && candidate->candidate().type() == "stun") {
 		srflx_count_ ++;
-    RTC_LOG(INFO) <<__FUNCTION__<<" stun address "<<srflx_count_;
+    BROADCASTER_LOG(kIce, INFO) <<__FUNCTION__<<" stun address "<<srflx_count_;
 	}
 	if(srflx_count_ >= get_local_tracks()) {
     ice_promise_.set_value(true);
@@ -408,7 +599,7 @@ void ClientAgent::OnIceCandidate(const webrtc::IceCandidateInterface* candidate)
 
 void ClientAgent::OnIceConnectionReceivingChange(bool receiving)
 {
-  RTC_LOG(INFO) <<__FUNCTION__;
+  BROADCASTER_LOG(kIce, INFO) <<__FUNCTION__;
 }
 
 // CreateSessionDescriptionObserver implementation.
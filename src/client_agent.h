@@ -8,10 +8,16 @@
 #include <vector>
 #include <future>
 
+#include "absl/types/optional.h"
+#include "api/audio_codecs/audio_encoder_factory.h"
 #include "api/media_stream_interface.h"
 #include "api/peer_connection_interface.h"
 #include "api/create_peerconnection_factory.h"
 #include "api/scoped_refptr.h"
+#include "modules/audio_processing/include/audio_processing.h"
+#include "pc/test/fake_audio_source.h"
+#include "pc/test/video_send_stage_metrics.h"
+#include "test/metrics_registry.h"
 
 namespace webrtc {
 
@@ -33,14 +39,35 @@ public:
   virtual bool start_stream(std::string &remote_sdp);
   virtual bool enable_stream(StreamType stype, bool enabled);
 
+  // Counters, gauges and histograms updated on the session's media threads,
+  // exported with the stats of the session.
+  webrtc::test::MetricsRegistry* metrics() { return &metrics_; }
+
 protected:
 	ClientAgent();
+  // |capture_phase| (in [0, 1)) offsets the fake audio device's 10 ms ticks
+  // so that sessions started together don't process audio at the same time.
+  explicit ClientAgent(absl::optional<double> capture_phase);
 
 	bool init();
   virtual rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> get_factory();
 	virtual rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> create_factory();
   virtual rtc::scoped_refptr<webrtc::AudioTrackInterface> create_audio_track();
   virtual rtc::scoped_refptr<webrtc::VideoTrackInterface> create_video_track();
+  // Audio recorded by the fake audio device. nullptr records a constant
+  // mono signal.
+  virtual std::unique_ptr<webrtc::FakeAudioSource> create_audio_source() { return nullptr; }
+  virtual rtc::scoped_refptr<webrtc::AudioEncoderFactory> create_audio_encoder_factory();
+  // If false, the factory's audio processing module and the audio track's
+  // options have echo cancellation, noise suppression, gain control and
+  // every other processing stage turned off.
+  virtual bool audio_processing_enabled() const { return true; }
+  // The module passed to the peer connection factory, following
+  // audio_processing_enabled(). nullptr lets the factory create its default.
+  rtc::scoped_refptr<webrtc::AudioProcessing> create_audio_processing();
+  // If true, the factory's encoders and event logs measure the send stages
+  // of each video frame (webrtc::VideoSendStageMetrics) into metrics().
+  virtual bool send_stage_metrics_enabled() const { return false; }
 
 	std::string merge_ice(std::string &sdp);
 	int get_local_tracks();
@@ -78,6 +105,11 @@ protected:
   virtual void OnData(const void* audio_data, int bits_per_sample, int sample_rate, size_t number_of_channels, size_t number_of_frames) override {}
 
 private:
+  // First, so that it outlives everything that updates it.
+  webrtc::test::MetricsRegistry metrics_;
+  // Set by create_factory() if send_stage_metrics_enabled(). Outlives the
+  // factory, its encoders and event logs.
+  std::unique_ptr<webrtc::VideoSendStageMetrics> send_stages_;
   rtc::scoped_refptr<webrtc::PeerConnectionInterface> pc_;
   rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory_;
   rtc::Thread* signal_thread_;
@@ -86,6 +118,7 @@ private:
   std::promise<bool> ice_promise_;
 	std::map<int, std::string> ice_;
 	int srflx_count_;
+  absl::optional<double> capture_phase_;
 };
 
 }
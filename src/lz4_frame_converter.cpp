@@ -0,0 +1,46 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "test/testsupport/lz4_frame_file.h"
+
+using namespace webrtc;
+
+static bool ends_with(const std::string &str, const std::string &suffix)
+{
+  return str.size() >= suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+  if(argc < 3) {
+    std::cerr << "usage: " << argv[0] << " <input.y4m> <output."
+              << test::kLz4FrameFileExtension << "> [hc_level]" << std::endl;
+    std::cerr << "       " << argv[0] << " <input.yuv> <output."
+              << test::kLz4FrameFileExtension << "> <width> <height> [hc_level]" << std::endl;
+    return 1;
+  }
+
+  std::string input = argv[1];
+  std::string output = argv[2];
+  bool ok = false;
+  if(ends_with(input, ".y4m")) {
+    int level = argc > 3 ? atoi(argv[3]) : 0;
+    ok = test::ConvertY4mToLz4FrameFile(input, output, level);
+  } else {
+    if(argc < 5) {
+      std::cerr << "[ERROR] width and height are required for raw .yuv input" << std::endl;
+      return 1;
+    }
+    int level = argc > 5 ? atoi(argv[5]) : 0;
+    ok = test::ConvertYuvToLz4FrameFile(input, atoi(argv[3]), atoi(argv[4]), output, level);
+  }
+
+  if(!ok) {
+    std::cerr << "[ERROR] converting " << input << " failed" << std::endl;
+    return 1;
+  }
+  std::cout << "[INFO] wrote " << output << std::endl;
+  return 0;
+}
@@ -1,29 +1,152 @@
 ﻿#include <cpr/cpr.h>
-#include <csignal> // sigsuspend()
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal> // sigwait()
+#include <cstdio>
 #include <cstdlib>
 #include <iostream>
 #include <rtc_base/ssl_adapter.h>
+#include <rtc_base/trace_event.h>
 #include <string>
+#include <thread>
 
+#include <pthread.h> // pthread_sigmask()
 #include <stdlib.h>
+#include <unistd.h> // getpid()
 #include <json.hpp>
 
+#include "async_log_sink.h"
+#include "chrome_tracer.h"
+#include "metrics_server.h"
 #include "publisher.h"
 #include "player.h"
+#include "stats_collector.h"
 
 using json = nlohmann::json;
 using namespace webrtc;
 
-void signalHandler(int signum)
+// Never destroyed, as threads still logging during exit() may be using it.
+// stop_log_sink() writes out the messages still queued on exit().
+static AsyncLogSink* log_sink = nullptr;
+// Destroyed on exit(), which writes out the events still buffered.
+static std::unique_ptr<ChromeTracer> tracer;
+
+// SIGINT is blocked in all threads and taken here, so that exit() runs
+// stop_log_sink() and the tracer's destructor on a thread of its own rather
+// than in a signal handler.
+void wait_for_signal(sigset_t signals)
 {
+	int signum = 0;
+	if(sigwait(&signals, &signum) != 0) {
+		return;
+	}
 	std::cout << "[INFO] interrupt signal (" << signum << ") received" << std::endl;
 	std::cout << "[INFO] leaving!" << std::endl;
 	std::exit(signum);
 }
 
-void start_publish(std::string &server_url, std::string &stream_id)
+void stop_log_sink()
+{
+  log_sink->stop();
+}
+
+PublisherOptions publisher_options_from_env()
+{
+  PublisherOptions options;
+  const char* env_video_source  = std::getenv("VIDEO_SOURCE");
+  const char* env_video_file    = std::getenv("VIDEO_FILE");
+  const char* env_video_width   = std::getenv("VIDEO_WIDTH");
+  const char* env_video_height  = std::getenv("VIDEO_HEIGHT");
+  const char* env_video_fps     = std::getenv("VIDEO_FPS");
+  const char* env_video_bitrate = std::getenv("VIDEO_BITRATE");
+  const char* env_video_qp      = std::getenv("VIDEO_QP");
+  const char* env_render_threads = std::getenv("VIDEO_RENDER_THREADS");
+  const char* env_session_index = std::getenv("SESSION_INDEX");
+  const char* env_audio_source  = std::getenv("AUDIO_SOURCE");
+  const char* env_audio_file    = std::getenv("AUDIO_FILE");
+  const char* env_audio_rate    = std::getenv("AUDIO_SAMPLE_RATE");
+  const char* env_audio_channels = std::getenv("AUDIO_CHANNELS");
+  const char* env_audio_tone_hz = std::getenv("AUDIO_TONE_HZ");
+  const char* env_audio_processing = std::getenv("AUDIO_PROCESSING");
+  const char* env_opus_ptime    = std::getenv("OPUS_PTIME");
+  const char* env_opus_dtx      = std::getenv("OPUS_DTX");
+  const char* env_opus_fec      = std::getenv("OPUS_FEC");
+  const char* env_opus_stereo   = std::getenv("OPUS_STEREO");
+  const char* env_opus_bitrate  = std::getenv("OPUS_MAX_BITRATE");
+  const char* env_send_stage_metrics = std::getenv("SEND_STAGE_METRICS");
+
+  if(env_video_source)  options.video_source = env_video_source;
+  if(env_video_file)    options.video_file = env_video_file;
+  if(env_video_width)   options.width = atoi(env_video_width);
+  if(env_video_height)  options.height = atoi(env_video_height);
+  if(env_video_fps)     options.fps = atoi(env_video_fps);
+  if(env_video_bitrate) options.target_bitrate_bps = atoll(env_video_bitrate);
+  if(env_video_qp)      options.qp = atoi(env_video_qp);
+  if(env_render_threads) options.render_threads = std::max(1, atoi(env_render_threads));
+  if(env_audio_source)  options.audio_source = env_audio_source;
+  if(env_audio_file)    options.audio_file = env_audio_file;
+  if(env_audio_rate)    options.audio_sample_rate = atoi(env_audio_rate);
+  if(env_audio_channels) options.audio_channels = std::min(2, std::max(1, atoi(env_audio_channels)));
+  if(env_audio_tone_hz) options.tone_hz = atof(env_audio_tone_hz);
+  if(env_audio_processing) options.audio_processing = atoi(env_audio_processing) != 0;
+  if(env_opus_ptime) {
+    int ptime_ms = atoi(env_opus_ptime);
+    if(ptime_ms == 20 || ptime_ms == 40 || ptime_ms == 60) {
+      options.opus_ptime_ms = ptime_ms;
+    } else {
+      std::cerr << "[WARN] ignoring OPUS_PTIME " << env_opus_ptime << ", use 20, 40 or 60" << std::endl;
+    }
+  }
+  if(env_opus_dtx)      options.opus_dtx = atoi(env_opus_dtx) != 0;
+  if(env_opus_fec)      options.opus_fec = atoi(env_opus_fec) != 0;
+  if(env_opus_stereo)   options.opus_stereo = atoi(env_opus_stereo) != 0;
+  if(env_opus_bitrate)  options.opus_max_bitrate_bps = atoi(env_opus_bitrate);
+  if(env_send_stage_metrics) options.send_stage_metrics = atoi(env_send_stage_metrics) != 0;
+  // Without an explicit index, processes started together still get distinct
+  // phases from their pids.
+  options.session_index = env_session_index ? atoi(env_session_index) : static_cast<int>(getpid());
+  return options;
+}
+
+PlayerOptions player_options_from_env()
+{
+  PlayerOptions options;
+  const char* env_audio_levels_only = std::getenv("AUDIO_LEVELS_ONLY");
+  const char* env_audio_buffer_frames = std::getenv("AUDIO_BUFFER_FRAMES");
+  const char* env_audio_output_file = std::getenv("AUDIO_OUTPUT_FILE");
+
+  if(env_audio_levels_only) options.audio_levels_only = atoi(env_audio_levels_only) != 0;
+  if(env_audio_buffer_frames) {
+    options.audio_buffer_frames = static_cast<size_t>(std::max(0, atoi(env_audio_buffer_frames)));
+  } else if(env_audio_output_file) {
+    // Half a second.
+    options.audio_buffer_frames = 50;
+  }
+  return options;
+}
+
+// Writes the frames of |buffer| to |file|, if any, until |running| is
+// cleared. Without a file they are only taken off the buffer.
+void drain_audio_buffer(PcmRingBuffer* buffer, FILE* file, const std::atomic<bool>* running)
+{
+  PcmRingBuffer::Frame frame;
+  while(*running) {
+    if(!buffer->Read(&frame)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      continue;
+    }
+    if(file) {
+      fwrite(frame.data.data(), sizeof(int16_t), frame.samples_per_channel * frame.num_channels, file);
+    }
+  }
+}
+
+void start_publish(std::string &server_url, std::string &stream_id, const PublisherOptions &options)
 {
-  rtc::scoped_refptr<Publisher> pub = Publisher::create();
+  TRACE_EVENT_BEGIN0("broadcaster", "Publisher::create");
+  rtc::scoped_refptr<Publisher> pub = Publisher::create(options);
+  TRACE_EVENT_END0("broadcaster", "Publisher::create");
   do {
     if(!pub) {
       std::cout<<"create publisher failed"<<std::endl;
@@ -40,11 +163,13 @@ void start_publish(std::string &server_url, std::string &stream_id)
     };
 
     //send to server to get answer
+    TRACE_EVENT_BEGIN1("broadcaster", "http_signaling", "url", server_url);
     auto r = cpr::PostAsync(
       cpr::Url{ server_url },
       cpr::Body{ body.dump() },
       cpr::Header{ { "Content-Type", "application/json" } })
       .get();
+    TRACE_EVENT_END1("broadcaster", "http_signaling", "status", static_cast<int>(r.status_code));
 
     if (r.status_code != 200) {
       std::cerr << "[ERROR] unable to create mediasoup recv WebRtcTransport"
@@ -72,14 +197,29 @@ void start_publish(std::string &server_url, std::string &stream_id)
   } while(false);
 }
 
-void start_player(std::string &server_url, std::string &stream_id)
+void start_player(std::string &server_url, std::string &stream_id, const PlayerOptions &options)
 {
-  rtc::scoped_refptr<Player> client = Player::create();
+  TRACE_EVENT_BEGIN0("broadcaster", "Player::create");
+  rtc::scoped_refptr<Player> client = Player::create(options);
+  TRACE_EVENT_END0("broadcaster", "Player::create");
+  std::atomic<bool> draining(true);
+  std::thread drain_thread;
+  FILE* audio_output = nullptr;
   do {
     if(!client) {
       std::cout<<"create player failed"<<std::endl;
       break;
     }
+    if(client->audio_buffer()) {
+      const char* env_audio_output_file = std::getenv("AUDIO_OUTPUT_FILE");
+      if(env_audio_output_file) {
+        audio_output = fopen(env_audio_output_file, "wb");
+        if(!audio_output) {
+          std::cerr << "[ERROR] can't open " << env_audio_output_file << std::endl;
+        }
+      }
+      drain_thread = std::thread(drain_audio_buffer, client->audio_buffer(), audio_output, &draining);
+    }
     auto sdp = client->create_offer();
     std::cout<<"sdp: \n"<< sdp << std::endl;
 
@@ -91,11 +231,13 @@ void start_player(std::string &server_url, std::string &stream_id)
     };
 
     //send to server to get answer
+    TRACE_EVENT_BEGIN1("broadcaster", "http_signaling", "url", server_url);
     auto r = cpr::PostAsync(
       cpr::Url{ server_url },
       cpr::Body{ body.dump() },
       cpr::Header{ { "Content-Type", "application/json" } })
       .get();
+    TRACE_EVENT_END1("broadcaster", "http_signaling", "status", static_cast<int>(r.status_code));
 
     if (r.status_code != 200) {
       std::cerr << "[ERROR] unable to create mediasoup recv WebRtcTransport"
@@ -128,19 +270,51 @@ void start_player(std::string &server_url, std::string &stream_id)
     }
 #endif
   } while(false);
+  draining = false;
+  if(drain_thread.joinable()) {
+    drain_thread.join();
+  }
+  if(audio_output) {
+    fclose(audio_output);
+  }
 }
 
 int main(int /*argc*/, char* /*argv*/[])
 {
-	// Register signal SIGINT and signal handler.
-	signal(SIGINT, signalHandler);
+	// Blocked before any thread starts, so that all of them inherit the mask.
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+	std::thread(wait_for_signal, signals).detach();
+
+  const char* env_async_log = std::getenv("ASYNC_LOG");
+  const char* env_log_max_per_second = std::getenv("LOG_MAX_PER_SECOND");
+  const char* env_log_sample_every = std::getenv("LOG_SAMPLE_EVERY");
+  if(env_async_log && atoi(env_async_log) != 0) {
+    // 4096 messages of up to 512 bytes.
+    log_sink = new AsyncLogSink(4096, 512, stderr);
+    AsyncLogSink::CategoryLimits limits;
+    limits.max_per_second = env_log_max_per_second ? atoi(env_log_max_per_second) : 20;
+    log_sink->set_limits(AsyncLogSink::kIce, limits);
+    limits.sample_every = env_log_sample_every ? atoi(env_log_sample_every) : 1;
+    log_sink->set_limits(AsyncLogSink::kMedia, limits);
+    log_sink->install(rtc::LS_INFO);
+    std::atexit(stop_log_sink);
+  }
+
+  const char* env_trace_file = std::getenv("TRACE_FILE");
+  const char* env_trace_categories = std::getenv("TRACE_CATEGORIES");
+  if(env_trace_file) {
+    tracer = ChromeTracer::start(env_trace_file, env_trace_categories ? env_trace_categories : "");
+  }
 
 	// Retrieve configuration from environment variables.
 	const char* env_server_url    = std::getenv("SERVER_URL");
 	const char* env_stream_id       = std::getenv("STREAM_ID");
 	const char* env_mode = std::getenv("MODE");
 
-  int mode = mode ? atoi(env_mode) : 0;
+  int mode = env_mode ? atoi(env_mode) : 0;
   mode = mode == 1 ? 1 : 0;
   std::string server_url = env_server_url ? env_server_url : std::string("http://d.ossrs.net:1985/rtc/v1/") + (mode == 0 ? "publish/" : "play/");
   std::string stream_id = env_stream_id ? env_stream_id : "broadcaster";
@@ -151,12 +325,25 @@ int main(int /*argc*/, char* /*argv*/[])
   rtc::InitializeSSL();
   rtc::InitRandom(rtc::Time());
 	std::cout << "[INFO] welcome to mediasoup broadcaster app!\n" << std::endl;
+
+  const char* env_stats_interval = std::getenv("STATS_INTERVAL_MS");
+  const char* env_metrics_port = std::getenv("METRICS_PORT");
+  int metrics_port = env_metrics_port ? atoi(env_metrics_port) : 0;
+  std::unique_ptr<MetricsServer> metrics_server;
+  if(metrics_port > 0) {
+    StatsCollector::instance()->start(env_stats_interval ? atoi(env_stats_interval) : 5000);
+    metrics_server = MetricsServer::create(metrics_port, [] { return StatsCollector::instance()->prometheus_text(); });
+  }
 	if(mode == 1) {
-		start_player(server_url, stream_id);
+		start_player(server_url, stream_id, player_options_from_env());
 	} else {
-		start_publish(server_url, stream_id);
+		PublisherOptions options = publisher_options_from_env();
+		std::cout<<"video     :"<<options.video_source<<" "<<options.width<<"x"<<options.height<<"@"<<options.fps<< std::endl;
+		start_publish(server_url, stream_id, options);
 	}
 
+  metrics_server.reset();
+  StatsCollector::instance()->stop();
 	std::cout <<"done" << std::endl;
 	return 0;
 }
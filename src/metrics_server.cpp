@@ -0,0 +1,124 @@
+#include "metrics_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "rtc_base/logging.h"
+
+namespace webrtc {
+
+namespace {
+
+// How often the server thread checks whether it should stop.
+const int kPollTimeoutMs = 200;
+const size_t kMaxRequestSize = 8192;
+
+void send_all(int fd, const std::string& data)
+{
+  size_t sent = 0;
+  while(sent < data.size()) {
+    ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if(n <= 0) {
+      return;
+    }
+    sent += n;
+  }
+}
+
+std::string response(const char* status, const std::string& body)
+{
+  std::string res = std::string("HTTP/1.1 ") + status + "\r\n";
+  res += "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n";
+  res += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+  res += "Connection: close\r\n\r\n";
+  return res + body;
+}
+
+}
+
+std::unique_ptr<MetricsServer> MetricsServer::create(int port, std::function<std::string()> metrics)
+{
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if(fd < 0) {
+    RTC_LOG(LS_ERROR) <<__FUNCTION__<<" socket failed: "<<strerror(errno);
+    return nullptr;
+  }
+  int reuse = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if(::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || ::listen(fd, 8) < 0) {
+    RTC_LOG(LS_ERROR) <<__FUNCTION__<<" can't listen on port "<<port<<": "<<strerror(errno);
+    ::close(fd);
+    return nullptr;
+  }
+  RTC_LOG(INFO) <<__FUNCTION__<<" serving metrics on http://127.0.0.1:"<<port<<"/metrics";
+  return std::unique_ptr<MetricsServer>(new MetricsServer(fd, std::move(metrics)));
+}
+
+MetricsServer::MetricsServer(int fd, std::function<std::string()> metrics)
+  : fd_(fd), metrics_(std::move(metrics)), running_(true)
+{
+  thread_ = std::thread(&MetricsServer::run, this);
+}
+
+MetricsServer::~MetricsServer()
+{
+  running_ = false;
+  if(thread_.joinable()) {
+    thread_.join();
+  }
+  ::close(fd_);
+}
+
+void MetricsServer::run()
+{
+  while(running_) {
+    pollfd pfd = {fd_, POLLIN, 0};
+    if(::poll(&pfd, 1, kPollTimeoutMs) <= 0) {
+      continue;
+    }
+    int client_fd = ::accept(fd_, nullptr, nullptr);
+    if(client_fd < 0) {
+      continue;
+    }
+    serve(client_fd);
+    ::close(client_fd);
+  }
+}
+
+void MetricsServer::serve(int client_fd)
+{
+  // A scraper that doesn't send its request doesn't hold the server.
+  timeval timeout = {1, 0};
+  setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  std::string request;
+  char buf[1024];
+  while(request.find("\r\n\r\n") == std::string::npos && request.size() < kMaxRequestSize) {
+    ssize_t n = ::recv(client_fd, buf, sizeof(buf), 0);
+    if(n <= 0) {
+      return;
+    }
+    request.append(buf, n);
+  }
+  if(request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0) {
+    send_all(client_fd, response("200 OK", metrics_()));
+  } else if(request.compare(0, 4, "GET ") == 0) {
+    send_all(client_fd, response("404 Not Found", "not found\n"));
+  } else {
+    send_all(client_fd, response("405 Method Not Allowed", "only GET is supported\n"));
+  }
+}
+
+}
@@ -0,0 +1,35 @@
+#ifndef BROADCASTER_METRICS_SERVER_H
+#define BROADCASTER_METRICS_SERVER_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace webrtc {
+
+// Minimal HTTP server on a loopback port, answering GET /metrics with the
+// text of |metrics| for a Prometheus scraper. Requests are served one at a
+// time on the server's own thread.
+class MetricsServer {
+public:
+  // nullptr if the port can't be bound.
+  static std::unique_ptr<MetricsServer> create(int port, std::function<std::string()> metrics);
+  ~MetricsServer();
+
+private:
+  MetricsServer(int fd, std::function<std::string()> metrics);
+
+  void run();
+  void serve(int client_fd);
+
+  const int fd_;
+  const std::function<std::string()> metrics_;
+  std::atomic<bool> running_;
+  std::thread thread_;
+};
+
+}
+
+#endif // BROADCASTER_METRICS_SERVER_H
@@ -1,6 +1,11 @@
 #include "player.h"
 
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
 #include <memory>
+#include <string>
 
 #include <absl/strings/match.h>
 #include <api/audio_codecs/builtin_audio_decoder_factory.h>
@@ -10,25 +15,83 @@
 #include <modules/video_coding/codecs/vp8/include/vp8.h>
 #include <modules/video_coding/codecs/vp9/include/vp9.h>
 
+#include "api/audio_codecs/audio_decoder.h"
+#include "api/audio_codecs/audio_decoder_factory.h"
+#include "api/transport/rtp/rtp_source.h"
 #include "api/video_codecs/sdp_video_format.h"
 #include "api/video_codecs/video_decoder.h"
 #include "api/video_codecs/video_decoder_factory.h"
+#include "async_log_sink.h"
+#include "chrome_tracer.h"
+#include "pc/test/fake_audio_capture_module.h"
 #include "rtc_base/ref_counted_object.h"
 #include "rtc_base/system/rtc_export.h"
+#include "rtc_base/trace_event.h"
+#include "test/testsupport/ogg_opus_file.h"
 
 namespace webrtc {
 
+// Stands in for Opus when only the packets' audio levels are of interest:
+// NetEq still buffers the packets and tracks their sources, but decoding is
+// a memset of silence.
+class DummyAudioDecoder : public webrtc::AudioDecoder {
+public:
+  static const int kSampleRateHz = 48000;
+
+  void Reset() override {}
+  int SampleRateHz() const override { return kSampleRateHz; }
+  size_t Channels() const override { return 1; }
+
+  int PacketDuration(const uint8_t* encoded, size_t encoded_len) const override {
+    int duration = test::OggOpusFile::PacketDuration(rtc::ArrayView<const uint8_t>(encoded, encoded_len));
+    return duration > 0 ? duration : kSampleRateHz / 50;
+  }
+
+protected:
+  int DecodeInternal(const uint8_t* encoded, size_t encoded_len, int sample_rate_hz,
+                     int16_t* decoded, SpeechType* speech_type) override {
+    int samples = PacketDuration(encoded, encoded_len);
+    memset(decoded, 0, samples * sizeof(int16_t));
+    *speech_type = kSpeech;
+    return samples;
+  }
+};
+
 class AudioDecoderFactoryForPlayer{
 public:
-	static rtc::scoped_refptr<AudioDecoderFactory> create() {
+  class DummyDecoderFactory : public AudioDecoderFactory {
+  public:
+    std::vector<AudioCodecSpec> GetSupportedDecoders() override {
+      return {{SdpAudioFormat("opus", DummyAudioDecoder::kSampleRateHz, 2,
+                              {{"minptime", "10"}, {"useinbandfec", "1"}}),
+               AudioCodecInfo(DummyAudioDecoder::kSampleRateHz, 1, 64000)}};
+    }
+
+    bool IsSupportedDecoder(const SdpAudioFormat& format) override {
+      return absl::EqualsIgnoreCase(format.name, "opus");
+    }
+
+    std::unique_ptr<AudioDecoder> MakeAudioDecoder(const SdpAudioFormat& format,
+                                                   absl::optional<AudioCodecPairId> codec_pair_id) override {
+      if(!IsSupportedDecoder(format)) {
+        return nullptr;
+      }
+      return std::make_unique<DummyAudioDecoder>();
+    }
+  };
+
+	static rtc::scoped_refptr<AudioDecoderFactory> create(bool decode = true) {
+    if(!decode) {
+      return new rtc::RefCountedObject<DummyDecoderFactory>();
+    }
     return webrtc::CreateBuiltinAudioDecoderFactory();
 	}
 };
 
 class H264VideoBuffer : public webrtc::VideoFrameBuffer {
 public:
-  H264VideoBuffer(const uint8_t *data, int len)
-	: width_(640), height_(480), data_len_(len){
+  H264VideoBuffer(const uint8_t *data, int len, int width, int height)
+	: data_len_(len), width_(width), height_(height) {
     data_ = new uint8_t[len];
 		memcpy(data_, data, len);
 	}
@@ -84,7 +147,13 @@ private:
 class DummyVideoDecoder : public webrtc::VideoDecoder {
 
 public:
-  DummyVideoDecoder() : callback_(nullptr) {
+  explicit DummyVideoDecoder(test::MetricsRegistry* metrics)
+    : callback_(nullptr),
+      frames_(metrics->GetCounter("decoder_frames_total")),
+      bytes_(metrics->GetCounter("decoder_bytes_total")),
+      frame_size_(metrics->GetHistogram("decoder_frame_bytes", {1000, 5000, 10000, 50000, 100000, 500000})),
+      width_(640),
+      height_(480) {
 
 	}
 	virtual ~DummyVideoDecoder() {
@@ -92,14 +161,26 @@ public:
 	}
   int32_t InitDecode(const webrtc::VideoCodec* codec_settings, int32_t number_of_cores) override {
     RTC_LOG(LS_WARNING) << "Can't initialize DummyVideoDecoder.";
+    if(codec_settings && codec_settings->width > 0 && codec_settings->height > 0) {
+      width_ = codec_settings->width;
+      height_ = codec_settings->height;
+    }
     return WEBRTC_VIDEO_CODEC_OK;
   }
 
   int32_t Decode(const webrtc::EncodedImage& input_image, bool missing_frames,int64_t render_time_ms) override {
 //    RTC_LOG(LS_WARNING) << "The DummyVideoDecoder doesn't support decoding.";
+    frames_->Add();
+    bytes_->Add(input_image.size());
+    frame_size_->Add(input_image.size());
+    // The resolution comes with key frames only; delta frames keep the last.
+    if(input_image._encodedWidth > 0 && input_image._encodedHeight > 0) {
+      width_ = input_image._encodedWidth;
+      height_ = input_image._encodedHeight;
+    }
 		if(callback_) {
       rtc::scoped_refptr<H264VideoBuffer> img_buffer = rtc::scoped_refptr<H264VideoBuffer>(
-        new rtc::RefCountedObject<H264VideoBuffer>(input_image.data(), input_image.size()));
+        new rtc::RefCountedObject<H264VideoBuffer>(input_image.data(), input_image.size(), width_, height_));
 
       auto builder = VideoFrame::Builder()
         .set_video_frame_buffer(img_buffer)
@@ -124,11 +205,44 @@ public:
 
 private:
   webrtc::DecodedImageCallback* callback_;
+  test::MetricsRegistry::Counter* const frames_;
+  test::MetricsRegistry::Counter* const bytes_;
+  test::MetricsRegistry::Histogram* const frame_size_;
+  // Of the last frame that had one. Only used on the decoder thread.
+  int width_;
+  int height_;
+};
+
+// Traces the calls into |decoder|; only used while tracing.
+class TracingVideoDecoder : public webrtc::VideoDecoder {
+public:
+  explicit TracingVideoDecoder(std::unique_ptr<webrtc::VideoDecoder> decoder)
+    : decoder_(std::move(decoder)) {}
+
+  int32_t InitDecode(const webrtc::VideoCodec* codec_settings, int32_t number_of_cores) override {
+    TRACE_EVENT0("broadcaster", "VideoDecoder::InitDecode");
+    return decoder_->InitDecode(codec_settings, number_of_cores);
+  }
+  int32_t Decode(const webrtc::EncodedImage& input_image, bool missing_frames, int64_t render_time_ms) override {
+    TRACE_EVENT2("broadcaster", "VideoDecoder::Decode", "timestamp", input_image.Timestamp(), "size", static_cast<int>(input_image.size()));
+    return decoder_->Decode(input_image, missing_frames, render_time_ms);
+  }
+  int32_t RegisterDecodeCompleteCallback(webrtc::DecodedImageCallback* callback) override {
+    return decoder_->RegisterDecodeCompleteCallback(callback);
+  }
+  int32_t Release() override { return decoder_->Release(); }
+  bool PrefersLateDecoding() const override { return decoder_->PrefersLateDecoding(); }
+  const char* ImplementationName() const override { return decoder_->ImplementationName(); }
+
+private:
+  std::unique_ptr<webrtc::VideoDecoder> decoder_;
 };
 
 class VideoDecoderFactoryForPlayer : public VideoDecoderFactory {
 
 public:
+  explicit VideoDecoderFactoryForPlayer(test::MetricsRegistry* metrics) : metrics_(metrics) {}
+
   std::vector<SdpVideoFormat> GetSupportedFormats() const override {
     std::vector<SdpVideoFormat> formats;
     formats.push_back(SdpVideoFormat(cricket::kVp8CodecName));
@@ -140,6 +254,20 @@ public:
 	}
 
   std::unique_ptr<VideoDecoder> CreateVideoDecoder(const SdpVideoFormat& format) override {
+    std::unique_ptr<VideoDecoder> decoder = create_decoder(format);
+    if(decoder && ChromeTracer::active()) {
+      return std::make_unique<TracingVideoDecoder>(std::move(decoder));
+    }
+    return decoder;
+	}
+
+  // |metrics| must outlive the factory and its decoders.
+  static std::unique_ptr<VideoDecoderFactory> create(test::MetricsRegistry* metrics) {
+    return std::make_unique<VideoDecoderFactoryForPlayer>(metrics);
+	}
+
+protected:
+  std::unique_ptr<VideoDecoder> create_decoder(const SdpVideoFormat& format) {
     if (!IsFormatSupported(GetSupportedFormats(), format)) {
       RTC_LOG(LS_ERROR) << "Trying to create decoder for unsupported format";
       return nullptr;
@@ -158,13 +286,8 @@ public:
     return nullptr;
 	}
 
-  static std::unique_ptr<VideoDecoderFactory> create() {
-    return std::make_unique<VideoDecoderFactoryForPlayer>();
-	}
-
-protected:
   std::unique_ptr<VideoDecoder> create_h264_decoder() {
-    return std::make_unique<DummyVideoDecoder>();
+    return std::make_unique<DummyVideoDecoder>(metrics_);
 	}
 
   static bool IsFormatSupported(
@@ -177,26 +300,58 @@ protected:
     }
     return false;
   }
+
+private:
+  test::MetricsRegistry* const metrics_;
 };
 
-rtc::scoped_refptr<Player> Player::create()
+// 10 ms of stereo audio at 48 kHz.
+static const size_t kMaxSamplesPerAudioFrame = 960;
+
+rtc::scoped_refptr<Player> Player::create(const PlayerOptions &options)
 {
-  rtc::scoped_refptr<Player> pub(new rtc::RefCountedObject<Player>());
+  rtc::scoped_refptr<Player> pub(new rtc::RefCountedObject<Player>(options));
   if(!pub->init()) {
     pub = rtc::scoped_refptr<Player>();
   }
   return pub;
 }
 
-Player::Player()
-  : ClientAgent(), video_frames_(0), audio_frames_(0)
+Player::Player(const PlayerOptions &options)
+  : ClientAgent(),
+    video_metrics_(metrics(), "player_video_"),
+    video_freezes_(metrics(), "player_video_"),
+    audio_freezes_(metrics(), "player_audio_"),
+    audio_frames_(metrics()->GetCounter("player_audio_frames_total")),
+    audio_level_meter_(metrics(), "player_audio_"),
+    audio_levels_only_(options.audio_levels_only)
 {
-
+  if(options.audio_buffer_frames > 0) {
+    audio_buffer_.reset(new PcmRingBuffer(options.audio_buffer_frames, kMaxSamplesPerAudioFrame,
+                                          options.audio_overflow_policy));
+  }
+  if(audio_levels_only_) {
+    for(int i = 0; i < kAudioSourceSlots; i++) {
+      const std::string prefix = "player_audio_source" + std::to_string(i) + "_";
+      source_gauges_[i].ssrc = metrics()->GetGauge(prefix + "ssrc");
+      source_gauges_[i].level_dbov = metrics()->GetGauge(prefix + "level_dbov");
+      source_gauges_[i].voice_active = metrics()->GetGauge(prefix + "voice_active");
+      source_gauges_[i].level_dbov->Set(-1);
+    }
+  }
 }
 
 Player::~Player()
 {
-
+  // Before the peer connection is closed.
+  {
+    std::lock_guard<std::mutex> lock(levels_lock_);
+    levels_running_ = false;
+  }
+  levels_wake_.notify_all();
+  if(levels_thread_.joinable()) {
+    levels_thread_.join();
+  }
 }
 
 std::string Player::create_offer()
@@ -224,24 +379,113 @@ std::string Player::create_offer()
 
 bool Player::start_stream(std::string &remote_sdp)
 {
-	return ClientAgent::start_stream(remote_sdp);
+  // The voice engine offers the extension; the SFU has to keep it.
+  if(audio_levels_only_ && remote_sdp.find("urn:ietf:params:rtp-hdrext:ssrc-audio-level") == std::string::npos) {
+    RTC_LOG(WARNING) <<__FUNCTION__<<" answer has no ssrc-audio-level extension, audio levels won't be reported";
+  }
+	if(!ClientAgent::start_stream(remote_sdp)) {
+    return false;
+  }
+  if(audio_levels_only_ && !levels_thread_.joinable()) {
+    levels_running_ = true;
+    levels_thread_ = std::thread(&Player::run_audio_source_levels, this);
+  }
+  return true;
+}
+
+void Player::run_audio_source_levels()
+{
+  const std::chrono::seconds kInterval(1);
+  std::unique_lock<std::mutex> lock(levels_lock_);
+  while(!levels_wake_.wait_for(lock, kInterval, [this] { return !levels_running_; })) {
+    update_audio_source_gauges();
+  }
+}
+
+void Player::update_audio_source_gauges()
+{
+  std::vector<AudioSourceLevel> levels = audio_source_levels();
+  // Sources keep their slot while they are heard from; the slots of those
+  // gone are freed first, so that new sources can take them.
+  for(int i = 0; i < kAudioSourceSlots; i++) {
+    const uint32_t ssrc = source_ssrcs_[i];
+    if(ssrc && std::none_of(levels.begin(), levels.end(),
+                            [ssrc](const AudioSourceLevel &level) { return level.ssrc == ssrc; })) {
+      source_ssrcs_[i] = 0;
+      source_gauges_[i].ssrc->Set(0);
+      source_gauges_[i].level_dbov->Set(-1);
+      source_gauges_[i].voice_active->Set(0);
+    }
+  }
+  for(const AudioSourceLevel &level : levels) {
+    auto slot = std::find(source_ssrcs_.begin(), source_ssrcs_.end(), level.ssrc);
+    if(slot == source_ssrcs_.end()) {
+      slot = std::find(source_ssrcs_.begin(), source_ssrcs_.end(), 0u);
+      if(slot == source_ssrcs_.end()) {
+        continue;
+      }
+      *slot = level.ssrc;
+    }
+    const AudioSourceGauges &gauges = source_gauges_[slot - source_ssrcs_.begin()];
+    gauges.ssrc->Set(level.ssrc);
+    gauges.level_dbov->Set(level.level_dbov ? *level.level_dbov : -1);
+    gauges.voice_active->Set(level.voice_active ? 1 : 0);
+  }
+}
+
+std::vector<AudioSourceLevel> Player::audio_source_levels() const
+{
+  // Levels louder than this count as voice; comfort noise is around
+  // -60 dBov or quieter.
+  const uint8_t kVoiceLevelDbov = 50;
+  std::vector<AudioSourceLevel> levels;
+  for(const auto &receiver : pc()->GetReceivers()) {
+    if(receiver->media_type() != cricket::MEDIA_TYPE_AUDIO) {
+      continue;
+    }
+    for(const RtpSource &source : receiver->GetSources()) {
+      if(source.source_type() != RtpSourceType::SSRC) {
+        continue;
+      }
+      AudioSourceLevel level;
+      level.ssrc = source.source_id();
+      level.level_dbov = source.audio_level();
+      level.voice_active = level.level_dbov && *level.level_dbov < kVoiceLevelDbov;
+      level.timestamp_ms = source.timestamp_ms();
+      levels.push_back(level);
+    }
+  }
+  return levels;
 }
 
 rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> Player::create_factory()
 {
   webrtc::PeerConnectionInterface::RTCConfiguration config;
 
+  // Without sound hardware: received audio is only decoded when playout
+  // pulls it, which the fake device does every 10 ms on the shared audio
+  // pacer. That also feeds the remote tracks' sinks, i.e. OnData().
+  auto playoutModule = FakeAudioCaptureModule::Create();
+  if (!playoutModule)
+  {
+    RTC_LOG(INFO) <<__FUNCTION__<<" audio playout module creation errored";
+  }
+  else
+  {
+    playoutModule->SetMetricsRegistry(metrics());
+  }
+
   rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory = webrtc::CreatePeerConnectionFactory(
     nullptr,
     nullptr,
     signal_thread(),
-    nullptr,
+    playoutModule,
     webrtc::CreateBuiltinAudioEncoderFactory(),
-    AudioDecoderFactoryForPlayer::create(),
+    AudioDecoderFactoryForPlayer::create(!audio_levels_only_),
     webrtc::CreateBuiltinVideoEncoderFactory(),
-    VideoDecoderFactoryForPlayer::create(),
+    VideoDecoderFactoryForPlayer::create(metrics()),
     nullptr /*audio_mixer*/,
-    nullptr /*audio_processing*/);
+    create_audio_processing());
 
   if (!factory){
     RTC_LOG(INFO) <<__FUNCTION__<<" error ocurred creating peerconnection factory";
@@ -253,13 +497,15 @@ rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> Player::create_factor
 void Player::OnAddTrack(rtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver,
                              const std::vector<rtc::scoped_refptr<webrtc::MediaStreamInterface>>& streams)
 {
-  RTC_LOG(INFO) <<__FUNCTION__;
+  BROADCASTER_LOG(kSignaling, INFO) <<__FUNCTION__;
 	if(receiver->media_type() == cricket::MEDIA_TYPE_AUDIO) {
-    RTC_LOG(INFO) <<__FUNCTION__<<" add audio";
+    BROADCASTER_LOG(kSignaling, INFO) <<__FUNCTION__<<" add audio";
     auto* audio_track = static_cast<webrtc::AudioTrackInterface*>(receiver->track().release());
-    audio_track->AddSink(this);
+    if(!audio_levels_only_) {
+      audio_track->AddSink(this);
+    }
 	} else if(receiver->media_type() == cricket::MEDIA_TYPE_VIDEO) {
-    RTC_LOG(INFO) <<__FUNCTION__<<" add video";
+    BROADCASTER_LOG(kSignaling, INFO) <<__FUNCTION__<<" add video";
     auto* video_track = static_cast<webrtc::VideoTrackInterface*>(receiver->track().release());
     video_track->AddOrUpdateSink(this, rtc::VideoSinkWants());
 	}
@@ -267,45 +513,72 @@ void Player::OnAddTrack(rtc::scoped_refptr<webrtc::RtpReceiverInterface> receive
 
 void Player::OnRemoveTrack(rtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver)
 {
-  RTC_LOG(INFO) <<__FUNCTION__;
+  BROADCASTER_LOG(kSignaling, INFO) <<__FUNCTION__;
 }
 
 void Player::OnDataChannel(rtc::scoped_refptr<webrtc::DataChannelInterface> channel)
 {
-  RTC_LOG(INFO) <<__FUNCTION__;
+  BROADCASTER_LOG(kSignaling, INFO) <<__FUNCTION__;
 }
 
 void Player::OnFrame(const webrtc::VideoFrame& video_frame)
 {
+  TRACE_EVENT1("broadcaster", "Player::OnFrame", "timestamp", video_frame.timestamp());
   rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer = video_frame.video_frame_buffer();
 //  RTC_LOG(INFO) <<__FUNCTION__<<" type "<<buffer->type()<<" size "<<video_frame.size();
+  // Only passthrough (H.264) frames still have their encoded size.
+  size_t encoded_size = 0;
 	if(buffer->type() == VideoFrameBuffer::Type::kNative) {
     H264VideoBuffer *vb = static_cast<H264VideoBuffer*>(buffer.get());
-		const uint8_t* data = vb->data();
+    encoded_size = vb->size();
 #if 0
+		const uint8_t* data = vb->data();
 		static FILE *f = nullptr;
 		if(!f) {
 			f = fopen("/tmp/a.h264", "wb");
 		}
-    if(f && video_frames_ < 25 * 100 ) {
-      RTC_LOG(INFO) <<__FUNCTION__<<" type "<<buffer->type()<<" frame size "<<video_frame.size()<<" buffer size "<<vb->size()<<" frames "<<video_frames_;
+    if(f && video_metrics_.GetMetrics().frames < 25 * 100 ) {
+      BROADCASTER_LOG(kMedia, INFO) <<__FUNCTION__<<" type "<<buffer->type()<<" frame size "<<video_frame.size()<<" buffer size "<<vb->size()<<" frames "<<video_metrics_.GetMetrics().frames;
       fwrite(data, 1, vb->size(), f);
     }
 #endif
 	}
-	if(video_frames_ % 25*1 == 0) {
-    RTC_LOG(INFO) <<__FUNCTION__<<" type "<<buffer->type()<<" width "<<video_frame.width()<<" height "<<video_frame.height();
-	}
-  video_frames_++;
+  video_metrics_.OnFrame(video_frame.width(), video_frame.height(), encoded_size);
+  int64_t freeze_ms = video_freezes_.OnFrame();
+  if(freeze_ms > 0) {
+    BROADCASTER_LOG(kMedia, WARNING) <<__FUNCTION__<<" video froze for "<<freeze_ms<<" ms";
+  }
 }
 
 void Player::OnData(const void* audio_data, int bits_per_sample, int sample_rate,
                          size_t number_of_channels, size_t number_of_frames) {
 //  RTC_LOG(INFO) <<__FUNCTION__;
-  if(audio_frames_ % 50*1 == 0) {
+  if(sample_rate > 0) {
+    int64_t freeze_ms = audio_freezes_.OnFrame(number_of_frames * 1000 / sample_rate);
+    if(freeze_ms > 0) {
+      BROADCASTER_LOG(kMedia, WARNING) <<__FUNCTION__<<" audio stalled for "<<freeze_ms<<" ms";
+    }
+  }
+  // A single copy; consumers do their work on their own thread.
+  if(bits_per_sample == 16) {
+    const int16_t* samples = static_cast<const int16_t*>(audio_data);
+    audio_level_meter_.Process(samples, number_of_frames, number_of_channels, sample_rate);
+    if(audio_buffer_) {
+      audio_buffer_->Write(samples, number_of_frames, number_of_channels, sample_rate);
+    }
+  }
+  if(audio_frames_->value() % 50 == 0 && AsyncLogSink::should_log(AsyncLogSink::kMedia)) {
     RTC_LOG(INFO) <<__FUNCTION__<<" bits "<<bits_per_sample<<" sample rate "<<sample_rate<<" channels "<<number_of_channels<<" number of frames "<<number_of_frames;
+    AudioLevelMeter::Levels levels = audio_level_meter_.GetLevels();
+    RTC_LOG(INFO) <<__FUNCTION__<<" level "<<levels.rms_dbfs<<" dBFS peak "<<levels.peak_dbfs<<" dBFS loudness "
+                  <<levels.short_term_lufs<<" LUFS audible "<<levels.audible_frames<<"/"<<levels.frames;
+    if(audio_buffer_) {
+      PcmRingBuffer::Stats stats = audio_buffer_->GetStats();
+      RTC_LOG(INFO) <<__FUNCTION__<<" audio buffer written "<<stats.frames_written<<" read "<<stats.frames_read
+                    <<" dropped "<<stats.frames_dropped<<" too large "<<stats.frames_too_large;
+    }
 	}
-  audio_frames_++;
+  audio_frames_->Add();
 }
 
 }
\ No newline at end of file
@@ -1,23 +1,86 @@
 #ifndef BROADCASTER_PLAYER_H
 #define BROADCASTER_PLAYER_H
 
+#include <array>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include "client_agent.h"
+#include "pc/test/audio_level_meter.h"
+#include "pc/test/freeze_detector.h"
+#include "pc/test/pcm_ring_buffer.h"
+#include "pc/test/video_receive_metrics.h"
 
 namespace webrtc {
 
+struct PlayerOptions {
+  // Received audio frames (10 ms each) queued for audio_buffer() consumers.
+  // 0 queues nothing.
+  size_t audio_buffer_frames = 0;
+  PcmRingBuffer::OverflowPolicy audio_overflow_policy = PcmRingBuffer::OverflowPolicy::kDropOldest;
+  // Monitors audio through the levels senders put in the ssrc-audio-level
+  // RTP header extension, see audio_source_levels(). Opus packets are not
+  // decoded and OnData() gets nothing, so audio_buffer() and audio_levels()
+  // stay empty. The levels are also polled every second into the metrics()
+  // gauges player_audio_source<N>_ssrc, _level_dbov and _voice_active, for
+  // up to Player::kAudioSourceSlots sources.
+  bool audio_levels_only = false;
+};
+
+struct AudioSourceLevel {
+  uint32_t ssrc = 0;
+  // 0 (loudest) to 127 (silence) -dBov, from the last packet.
+  absl::optional<uint8_t> level_dbov;
+  // The header's voice activity bit isn't kept by the receiver, so this is
+  // derived from the level.
+  bool voice_active = false;
+  // rtc::TimeMillis() of the last packet.
+  int64_t timestamp_ms = 0;
+};
+
 class Player: public ClientAgent {
 public:
-  static rtc::scoped_refptr<Player> create();
+  // Sources whose levels are exported as gauges with audio_levels_only.
+  static const int kAudioSourceSlots = 4;
+
+  static rtc::scoped_refptr<Player> create(const PlayerOptions &options = PlayerOptions());
   virtual ~Player();
 
   virtual std::string create_offer();
   virtual bool start_stream(std::string &remote_sdp);
 
+  // Received audio, written on the audio thread by OnData(), for one
+  // consumer to read on its own thread. nullptr unless enabled in the
+  // options.
+  PcmRingBuffer* audio_buffer() const { return audio_buffer_.get(); }
+  // Level, loudness and audible frame counts of the received audio. May be
+  // read on any thread.
+  AudioLevelMeter::Levels audio_levels() const { return audio_level_meter_.GetLevels(); }
+  // Levels of the audio streams from their RTP header extensions, one per
+  // SSRC heard from in the last 10 seconds. May be called on any thread.
+  std::vector<AudioSourceLevel> audio_source_levels() const;
+  // Frame rate, bitrate and resolution of the received video. They and the
+  // inter-arrival and bitrate histograms are in metrics() as well. May be
+  // called on any thread.
+  VideoReceiveMetrics::Metrics video_metrics() const { return video_metrics_.GetMetrics(); }
+  // Freezes of the received video, and gaps in the audio played out. Audio
+  // is played out every 10 ms with or without packets (missing ones are
+  // concealed), so audio gaps are stalls of the audio thread. May be called
+  // on any thread.
+  FreezeDetector::Stats video_freeze_stats() const { return video_freezes_.GetStats(); }
+  FreezeDetector::Stats audio_freeze_stats() const { return audio_freezes_.GetStats(); }
+
 protected:
-  Player();
+  Player(const PlayerOptions &options);
 
 protected:
   virtual rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> create_factory() override;
+  // Nothing is captured, so processing would only analyze the playout for
+  // echo cancellation.
+  virtual bool audio_processing_enabled() const override { return false; }
 
 protected:
   // PeerConnectionObserver implementation.
@@ -33,8 +96,32 @@ protected:
   virtual void OnData(const void* audio_data, int bits_per_sample, int sample_rate, size_t number_of_channels, size_t number_of_frames) override;
 
 private:
-	unsigned long video_frames_;
-  unsigned long audio_frames_;
+  struct AudioSourceGauges {
+    test::MetricsRegistry::Gauge* ssrc;
+    test::MetricsRegistry::Gauge* level_dbov;
+    test::MetricsRegistry::Gauge* voice_active;
+  };
+
+  // Copies audio_source_levels() into the gauges every second until the
+  // player is destroyed.
+  void run_audio_source_levels();
+  void update_audio_source_gauges();
+
+  VideoReceiveMetrics video_metrics_;
+  FreezeDetector video_freezes_;
+  FreezeDetector audio_freezes_;
+  test::MetricsRegistry::Counter* const audio_frames_;
+  std::unique_ptr<PcmRingBuffer> audio_buffer_;
+  AudioLevelMeter audio_level_meter_;
+  const bool audio_levels_only_;
+  // Registered with audio_levels_only only.
+  std::array<AudioSourceGauges, kAudioSourceSlots> source_gauges_ = {};
+  // The SSRC of each slot, 0 when free. Only used by |levels_thread_|.
+  std::array<uint32_t, kAudioSourceSlots> source_ssrcs_ = {};
+  std::mutex levels_lock_;
+  std::condition_variable levels_wake_;
+  bool levels_running_ = false;
+  std::thread levels_thread_;
 };
 
 }
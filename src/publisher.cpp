@@ -1,25 +1,255 @@
 #include "publisher.h"
 
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "api/rtp_parameters.h"
+#include "api/stats/rtcstats_objects.h"
+#include "api/task_queue/default_task_queue_factory.h"
+#include "pc/test/frame_generator_capturer_video_track_source.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "system_wrappers/include/clock.h"
+#include "test/complexity_frame_generator.h"
+#include "test/frame_generator_capturer.h"
+#include "test/passthrough_audio_encoder_factory.h"
+#include "test/testsupport/lz4_frame_file.h"
+
 namespace webrtc {
 
-rtc::scoped_refptr<Publisher> Publisher::create()
+// Phase (in [0, 1)) of session |index|: the fractional part of index times
+// the golden ratio. Any number of consecutive indexes are spread almost
+// evenly over [0, 1), without having to know the number of sessions.
+static absl::optional<double> session_phase(absl::optional<int> index)
+{
+  if(!index) {
+    return absl::nullopt;
+  }
+  const double kGoldenRatioConjugate = 0.6180339887498949;
+  double phase = std::fmod(*index * kGoldenRatioConjugate, 1.0);
+  return phase < 0 ? phase + 1.0 : phase;
+}
+
+// Feeds the bitrate and QP the video encoder produced between two reports
+// back to the complexity generator. The reports are delivered one at a time
+// on the signaling thread. Keeps the source, and so the generator, alive.
+class ComplexityBitrateFeedback : public webrtc::RTCStatsCollectorCallback {
+public:
+  ComplexityBitrateFeedback(rtc::scoped_refptr<webrtc::VideoTrackSourceInterface> source, test::ComplexityFrameGenerator* generator)
+  : source_(source), generator_(generator)
+  {
+  }
+
+  void OnStatsDelivered(const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) override
+  {
+    uint64_t bytes_sent = 0;
+    uint64_t qp_sum = 0;
+    uint64_t frames_encoded = 0;
+    for(const auto* stats : report->GetStatsOfType<webrtc::RTCOutboundRTPStreamStats>()) {
+      if(!stats->kind.is_defined() || *stats->kind != "video") {
+        continue;
+      }
+      bytes_sent += stats->bytes_sent.is_defined() ? *stats->bytes_sent : 0;
+      qp_sum += stats->qp_sum.is_defined() ? *stats->qp_sum : 0;
+      frames_encoded += stats->frames_encoded.is_defined() ? *stats->frames_encoded : 0;
+    }
+    const int64_t timestamp_us = report->timestamp_us();
+    if(last_timestamp_us_ >= 0 && timestamp_us > last_timestamp_us_ &&
+       bytes_sent >= last_bytes_sent_ && frames_encoded > last_frames_encoded_) {
+      const int64_t bitrate_bps = static_cast<int64_t>((bytes_sent - last_bytes_sent_) * 8 * rtc::kNumMicrosecsPerSec /
+                                                       (timestamp_us - last_timestamp_us_));
+      // 0, for unknown, without QPs.
+      const double qp = qp_sum >= last_qp_sum_ ?
+                        static_cast<double>(qp_sum - last_qp_sum_) / (frames_encoded - last_frames_encoded_) : 0;
+      generator_->OnEncodedBitrate(bitrate_bps, qp);
+    }
+    last_timestamp_us_ = timestamp_us;
+    last_bytes_sent_ = bytes_sent;
+    last_qp_sum_ = qp_sum;
+    last_frames_encoded_ = frames_encoded;
+  }
+
+private:
+  const rtc::scoped_refptr<webrtc::VideoTrackSourceInterface> source_;
+  test::ComplexityFrameGenerator* const generator_;
+  int64_t last_timestamp_us_ = -1;
+  uint64_t last_bytes_sent_ = 0;
+  uint64_t last_qp_sum_ = 0;
+  uint64_t last_frames_encoded_ = 0;
+};
+
+// Ogg Opus files are loaded once per process, however many sessions send
+// them.
+static std::shared_ptr<const test::OggOpusFile> load_ogg_opus_file(const std::string &path)
+{
+  static std::mutex mutex;
+  static std::map<std::string, std::weak_ptr<const test::OggOpusFile>> files;
+  std::lock_guard<std::mutex> lock(mutex);
+  std::shared_ptr<const test::OggOpusFile> file = files[path].lock();
+  if(!file) {
+    file = test::OggOpusFile::Open(path);
+    files[path] = file;
+  }
+  return file;
+}
+
+// Rewrites the Opus fmtp line and the ptime of the audio section of |sdp|
+// with the Opus settings of |options|. The encoder is configured from the
+// remote description's fmtp, so this is applied to the answer only; the
+// offer is already the local description once it is returned.
+static std::string munge_opus_sdp(const std::string &sdp, const PublisherOptions &options)
+{
+  std::vector<std::string> lines;
+  for(std::string::size_type pos = 0; pos < sdp.size();) {
+    std::string::size_type end = sdp.find("\r\n", pos);
+    if(end == std::string::npos) {
+      end = sdp.size();
+    }
+    lines.push_back(sdp.substr(pos, end - pos));
+    pos = end + 2;
+  }
+
+  // Payload type of Opus in the audio section.
+  std::string payload_type;
+  bool in_audio = false;
+  for(const std::string &line : lines) {
+    if(line.compare(0, 2, "m=") == 0) {
+      in_audio = line.compare(0, 8, "m=audio ") == 0;
+    } else if(in_audio && line.compare(0, 9, "a=rtpmap:") == 0) {
+      std::string::size_type space = line.find(' ');
+      if(space != std::string::npos && absl::StartsWithIgnoreCase(line.substr(space + 1), "opus/")) {
+        payload_type = line.substr(9, space - 9);
+        break;
+      }
+    }
+  }
+  if(payload_type.empty()) {
+    return sdp;
+  }
+
+  std::vector<std::pair<std::string, std::string>> settings;
+  if(options.opus_fec) {
+    settings.emplace_back("useinbandfec", *options.opus_fec ? "1" : "0");
+  }
+  if(options.opus_dtx) {
+    settings.emplace_back("usedtx", *options.opus_dtx ? "1" : "0");
+  }
+  if(options.opus_stereo) {
+    settings.emplace_back("stereo", *options.opus_stereo ? "1" : "0");
+    settings.emplace_back("sprop-stereo", *options.opus_stereo ? "1" : "0");
+  }
+  if(options.opus_max_bitrate_bps > 0) {
+    settings.emplace_back("maxaveragebitrate", std::to_string(options.opus_max_bitrate_bps));
+  }
+  if(settings.empty() && options.opus_ptime_ms <= 0) {
+    return sdp;
+  }
+
+  const std::string rtpmap = "a=rtpmap:" + payload_type + " ";
+  const std::string fmtp = "a=fmtp:" + payload_type + " ";
+  std::string res;
+  bool has_fmtp = false;
+  in_audio = false;
+  for(const std::string &line : lines) {
+    if(line.empty()) {
+      continue;
+    }
+    if(line.compare(0, 2, "m=") == 0) {
+      in_audio = line.compare(0, 8, "m=audio ") == 0;
+    }
+    if(in_audio && options.opus_ptime_ms > 0 && line.compare(0, 7, "a=ptime") == 0) {
+      continue;
+    }
+    if(in_audio && line.compare(0, fmtp.size(), fmtp) == 0) {
+      // Keeps the parameters we don't set, in their order.
+      std::vector<std::pair<std::string, std::string>> params;
+      const std::string fmtp_params = line.substr(fmtp.size());
+      for(absl::string_view param : absl::StrSplit(fmtp_params, ';', absl::SkipEmpty())) {
+        absl::string_view::size_type eq = param.find('=');
+        std::string key(absl::StripAsciiWhitespace(param.substr(0, eq)));
+        std::string value = eq == absl::string_view::npos ? "" : std::string(param.substr(eq + 1));
+        auto it = std::find_if(settings.begin(), settings.end(),
+          [&key](const std::pair<std::string, std::string> &s) { return s.first == key; });
+        if(it != settings.end()) {
+          value = it->second;
+          settings.erase(it);
+        }
+        params.emplace_back(key, value);
+      }
+      params.insert(params.end(), settings.begin(), settings.end());
+      std::vector<std::string> joined;
+      for(const auto &param : params) {
+        joined.push_back(param.first + "=" + param.second);
+      }
+      res += fmtp + absl::StrJoin(joined, ";") + "\r\n";
+      has_fmtp = true;
+    } else {
+      res += line + "\r\n";
+    }
+    if(in_audio && line.compare(0, rtpmap.size(), rtpmap) == 0) {
+      if(options.opus_ptime_ms > 0) {
+        res += "a=ptime:" + std::to_string(options.opus_ptime_ms) + "\r\n";
+      }
+    }
+  }
+  if(!has_fmtp && !settings.empty()) {
+    // Adds the fmtp line right after the rtpmap line.
+    std::vector<std::string> joined;
+    for(const auto &setting : settings) {
+      joined.push_back(setting.first + "=" + setting.second);
+    }
+    std::string::size_type pos = res.find(rtpmap, res.find("m=audio "));
+    pos = res.find("\r\n", pos) + 2;
+    res.insert(pos, fmtp + absl::StrJoin(joined, ";") + "\r\n");
+  }
+  return res;
+}
+
+rtc::scoped_refptr<Publisher> Publisher::create(const PublisherOptions &options)
 {
-  rtc::scoped_refptr<Publisher> pub(new rtc::RefCountedObject<Publisher>());
+  rtc::scoped_refptr<Publisher> pub(new rtc::RefCountedObject<Publisher>(options));
   if(!pub->init()) {
     pub = rtc::scoped_refptr<Publisher>();
   }
   return pub;
 }
 
-Publisher::Publisher()
-: ClientAgent()
+Publisher::Publisher(const PublisherOptions &options)
+: ClientAgent(session_phase(options.session_index)), options_(options), task_queue_factory_(CreateDefaultTaskQueueFactory())
 {
 
 }
 
 Publisher::~Publisher()
 {
+  // Before the peer connection is closed.
+  {
+    std::lock_guard<std::mutex> lock(feedback_lock_);
+    feedback_running_ = false;
+  }
+  feedback_wake_.notify_all();
+  if(feedback_thread_.joinable()) {
+    feedback_thread_.join();
+  }
+}
 
+void Publisher::run_bitrate_feedback()
+{
+  // The rate is measured over a few seconds, long enough to span some key
+  // frames' worth of rate control.
+  const std::chrono::seconds kInterval(2);
+  std::unique_lock<std::mutex> lock(feedback_lock_);
+  while(!feedback_wake_.wait_for(lock, kInterval, [this] { return !feedback_running_; })) {
+    pc()->GetStats(bitrate_feedback_.get());
+  }
 }
 
 std::string Publisher::create_offer()
@@ -29,7 +259,146 @@ std::string Publisher::create_offer()
 
 bool Publisher::start_stream(std::string &remote_sdp)
 {
-  return ClientAgent::start_stream(remote_sdp);
+  std::string answer = munge_opus_sdp(remote_sdp, options_);
+  if(!ClientAgent::start_stream(answer)) {
+    return false;
+  }
+  if(bitrate_feedback_ && !feedback_thread_.joinable()) {
+    feedback_running_ = true;
+    feedback_thread_ = std::thread(&Publisher::run_bitrate_feedback, this);
+  }
+  if(options_.opus_max_bitrate_bps > 0) {
+    for(const auto &sender : pc()->GetSenders()) {
+      if(sender->media_type() != cricket::MEDIA_TYPE_AUDIO) {
+        continue;
+      }
+      RtpParameters parameters = sender->GetParameters();
+      for(RtpEncodingParameters &encoding : parameters.encodings) {
+        encoding.max_bitrate_bps = options_.opus_max_bitrate_bps;
+      }
+      RTCError error = sender->SetParameters(parameters);
+      if(!error.ok()) {
+        RTC_LOG(INFO) <<__FUNCTION__<<" audio max bitrate not set: "<<error.message();
+      }
+    }
+  }
+  return true;
+}
+
+rtc::scoped_refptr<webrtc::VideoTrackInterface> Publisher::create_video_track()
+{
+  std::unique_ptr<test::FrameGeneratorCapturer> capturer;
+  test::ComplexityFrameGenerator* complexity_generator = nullptr;
+  if(options_.video_source == "complexity") {
+    test::FrameGeneratorCapturerConfig::ComplexityVideo config;
+    config.width = options_.width;
+    config.height = options_.height;
+    config.generator.framerate = options_.fps;
+    config.generator.target_qp = options_.qp;
+    config.generator.render_threads = options_.render_threads;
+    if(options_.target_bitrate_bps > 0) {
+      config.generator.target_bitrate_bps = options_.target_bitrate_bps;
+    }
+    RTC_LOG(INFO) <<__FUNCTION__<<" complexity video "<<config.width<<"x"<<config.height
+                  <<"@"<<options_.fps<<" target "<<options_.target_bitrate_bps<<"bps qp "<<options_.qp;
+    auto generator = std::make_unique<test::ComplexityFrameGenerator>(config.width, config.height, config.generator);
+    complexity_generator = generator.get();
+    capturer = std::make_unique<test::FrameGeneratorCapturer>(
+      Clock::GetRealTimeClock(), std::move(generator), config.generator.framerate, *task_queue_factory_);
+  } else if(options_.video_source == "lz4") {
+    // The generator can't fail, so the file is checked first.
+    std::unique_ptr<test::Lz4FrameFileReader> reader = test::Lz4FrameFileReader::Open(options_.video_file);
+    if(!reader) {
+      RTC_LOG(INFO) <<__FUNCTION__<<" can't read "<<options_.video_file<<", publishing the camera";
+      return ClientAgent::create_video_track();
+    }
+    RTC_LOG(INFO) <<__FUNCTION__<<" lz4 video "<<options_.video_file<<" "<<reader->width()<<"x"<<reader->height()
+                  <<"@"<<options_.fps<<" "<<reader->num_frames()<<" frames";
+    test::FrameGeneratorCapturerConfig::Lz4File config;
+    config.framerate = options_.fps;
+    config.name = options_.video_file;
+    capturer = test::FrameGeneratorCapturer::Create(
+      Clock::GetRealTimeClock(), *task_queue_factory_, config);
+  } else {
+    return ClientAgent::create_video_track();
+  }
+  absl::optional<double> phase = session_phase(options_.session_index);
+  if(phase) {
+    capturer->SetPhase(*phase);
+  }
+  capturer->SetMetricsRegistry(metrics());
+  if(!capturer->Init()) {
+    RTC_LOG(INFO) <<__FUNCTION__<<" frame generator capturer init failed";
+    return nullptr;
+  }
+  rtc::scoped_refptr<FrameGeneratorCapturerVideoTrackSource> source(
+    new rtc::RefCountedObject<FrameGeneratorCapturerVideoTrackSource>(std::move(capturer), false /* is_screencast */));
+  source->Start();
+  if(complexity_generator && options_.target_bitrate_bps > 0) {
+    bitrate_feedback_ = new rtc::RefCountedObject<ComplexityBitrateFeedback>(source, complexity_generator);
+  }
+  return factory()->CreateVideoTrack("video", source);
+}
+
+std::unique_ptr<webrtc::FakeAudioSource> Publisher::create_audio_source()
+{
+  const int rate = options_.audio_sample_rate;
+  const size_t channels = options_.audio_channels;
+  RTC_LOG(INFO) <<__FUNCTION__<<" "<<options_.audio_source<<" "<<rate<<"Hz "<<channels<<"ch";
+  std::unique_ptr<webrtc::FakeAudioSource> source;
+  if(options_.audio_source == "tone") {
+    source = CreateToneAudioSource(rate, channels, options_.tone_hz);
+  } else if(options_.audio_source == "speech") {
+    source = CreateSpeechLikeAudioSource(rate, channels,
+      options_.session_index ? static_cast<uint32_t>(*options_.session_index) + 1 : 1);
+  } else if(options_.audio_source == "wav") {
+    source = CreateWavFileAudioSource(options_.audio_file);
+  } else if(options_.audio_source == "raw") {
+    source = CreateRawFileAudioSource(options_.audio_file, rate, channels);
+  } else if(options_.audio_source == "push") {
+    auto push = PushAudioSource::Create(rate, channels);
+    push_audio_source_ = push.get();
+    source = std::move(push);
+  } else {
+    return nullptr;
+  }
+  if(!source) {
+    RTC_LOG(INFO) <<__FUNCTION__<<" can't create the "<<options_.audio_source<<" source, recording a constant signal";
+  }
+  return source;
 }
 
-}
\ No newline at end of file
+rtc::scoped_refptr<webrtc::AudioEncoderFactory> Publisher::create_audio_encoder_factory()
+{
+  if(options_.audio_source != "opus") {
+    return ClientAgent::create_audio_encoder_factory();
+  }
+  std::shared_ptr<const test::OggOpusFile> file = load_ogg_opus_file(options_.audio_file);
+  if(!file) {
+    RTC_LOG(INFO) <<__FUNCTION__<<" can't read "<<options_.audio_file<<", encoding the recorded audio";
+    return ClientAgent::create_audio_encoder_factory();
+  }
+  RTC_LOG(INFO) <<__FUNCTION__<<" passthrough opus "<<options_.audio_file<<" "<<file->num_channels()
+                <<"ch "<<file->num_packets()<<" packets "<<file->average_bitrate_bps()<<"bps";
+  return test::CreatePassthroughAudioEncoderFactory(std::move(file));
+}
+
+bool Publisher::audio_processing_enabled() const
+{
+  // Passthrough Opus discards the processed audio.
+  return options_.audio_processing && options_.audio_source != "opus";
+}
+
+bool Publisher::send_stage_metrics_enabled() const
+{
+  return options_.send_stage_metrics;
+}
+
+void Publisher::push_audio(const int16_t* data, size_t samples_per_channel)
+{
+  if(push_audio_source_) {
+    push_audio_source_->Push(data, samples_per_channel);
+  }
+}
+
+}
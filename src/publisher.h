@@ -1,21 +1,105 @@
 #ifndef BROADCASTER_PUBLISHER_H
 #define BROADCASTER_PUBLISHER_H
 
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "api/task_queue/task_queue_factory.h"
 #include "client_agent.h"
 
 namespace webrtc {
 
+struct PublisherOptions {
+  // "camera" publishes the first capture device, "complexity" publishes
+  // synthetic video with camera-like detail and motion, and "lz4" loops the
+  // LZ4 frame file |video_file| at its own resolution.
+  std::string video_source = "camera";
+  std::string video_file;
+  int width = 640;
+  int height = 480;
+  int fps = 30;
+  // complexity source only: bitrate the content is tuned to produce at |qp|
+  // (H.264 scale). 0 keeps the generator's default detail. The generator is
+  // steered towards it with the bitrate and QP the encoder reports.
+  int64_t target_bitrate_bps = 0;
+  int qp = 32;
+  // complexity source only: threads rendering each frame.
+  int render_threads = 1;
+  // Sessions with different indexes offset their video frames and audio
+  // ticks from each other, so that many sessions started together spread
+  // their load over time. Unset keeps the ticks relative to the start time.
+  absl::optional<int> session_index;
+  // "constant" records a constant mono signal, "tone" a sine of |tone_hz|,
+  // "speech" synthetic speech with pauses, "wav" and "raw" loop
+  // |audio_file| (16 bit PCM, raw files are read at |audio_sample_rate| and
+  // |audio_channels|), and "push" records what is passed to
+  // Publisher::push_audio(). "opus" sends the packets of the Ogg Opus
+  // |audio_file| as they are, without encoding.
+  std::string audio_source = "constant";
+  std::string audio_file;
+  int audio_sample_rate = 48000;
+  int audio_channels = 1;
+  double tone_hz = 440;
+  // false skips echo cancellation, noise suppression, gain control and the
+  // other audio processing, which only cost CPU with synthetic or file
+  // audio. The "opus" source never processes audio.
+  bool audio_processing = true;
+  // Opus settings, applied through the fmtp and ptime of the answer. Unset
+  // or 0 keeps what the SFU answers. The ptime is 20, 40 or 60. Longer packets and DTX (which
+  // sends a packet every 400 ms during silence) cut the packet rate.
+  int opus_ptime_ms = 0;
+  absl::optional<bool> opus_dtx;
+  absl::optional<bool> opus_fec;
+  absl::optional<bool> opus_stereo;
+  // Also caps the audio sender's encoding.
+  int opus_max_bitrate_bps = 0;
+  // Measures the latency of each sent video frame through the encoder
+  // queue, the encoder, packetization and pacing, into the session's
+  // metrics. Costs a wrapper around the encoder and a look at every packet
+  // sent.
+  bool send_stage_metrics = false;
+};
+
 class Publisher: public ClientAgent {
 public:
-  static rtc::scoped_refptr<Publisher> create();
+  static rtc::scoped_refptr<Publisher> create(const PublisherOptions &options = PublisherOptions());
   virtual ~Publisher();
 
   virtual std::string create_offer();
   virtual bool start_stream(std::string &remote_sdp);
 
+  // With audio_source "push": queues |samples_per_channel| interleaved
+  // samples at the configured rate and channel count. May be called on any
+  // thread; does nothing with other sources.
+  void push_audio(const int16_t* data, size_t samples_per_channel);
+
 protected:
-  Publisher();
+  Publisher(const PublisherOptions &options);
+
+  virtual rtc::scoped_refptr<webrtc::VideoTrackInterface> create_video_track() override;
+  virtual std::unique_ptr<webrtc::FakeAudioSource> create_audio_source() override;
+  virtual rtc::scoped_refptr<webrtc::AudioEncoderFactory> create_audio_encoder_factory() override;
+  virtual bool audio_processing_enabled() const override;
+  virtual bool send_stage_metrics_enabled() const override;
+
+private:
+  // Polls the stats for |bitrate_feedback_| until the publisher is destroyed.
+  void run_bitrate_feedback();
 
+  PublisherOptions options_;
+  // Owned by the audio device, which outlives the publisher's streams.
+  webrtc::PushAudioSource* push_audio_source_ = nullptr;
+  std::unique_ptr<webrtc::TaskQueueFactory> task_queue_factory_;
+  // Set by create_video_track() for the complexity source with a target
+  // bitrate.
+  rtc::scoped_refptr<webrtc::RTCStatsCollectorCallback> bitrate_feedback_;
+  std::mutex feedback_lock_;
+  std::condition_variable feedback_wake_;
+  bool feedback_running_ = false;
+  std::thread feedback_thread_;
 };
 
 }
@@ -0,0 +1,434 @@
+#include "stats_collector.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <vector>
+
+#include "api/stats/rtc_stats_collector_callback.h"
+#include "api/stats/rtcstats_objects.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/ref_counted_object.h"
+
+namespace webrtc {
+
+namespace {
+
+const char* const kKindNames[] = {"audio", "video"};
+
+struct CounterInfo {
+  const char* name;
+  const char* help;
+};
+
+// Indexed by StatsCollector::Counter.
+const CounterInfo kCounterInfos[] = {
+  {"broadcaster_bytes_sent_total", "RTP payload bytes sent."},
+  {"broadcaster_packets_sent_total", "RTP packets sent."},
+  {"broadcaster_bytes_received_total", "RTP payload bytes received."},
+  {"broadcaster_packets_received_total", "RTP packets received."},
+  {"broadcaster_packets_lost_total", "Packets of received streams that were lost."},
+  {"broadcaster_remote_packets_lost_total", "Packets of sent streams that the remote side reported lost."},
+  {"broadcaster_frames_encoded_total", "Video frames encoded."},
+  {"broadcaster_frames_decoded_total", "Video frames decoded."},
+  {"broadcaster_nacks_received_total", "NACKs received for sent streams."},
+  {"broadcaster_plis_received_total", "PLIs received for sent streams."},
+  {"broadcaster_nacks_sent_total", "NACKs sent for received streams."},
+  {"broadcaster_plis_sent_total", "PLIs sent for received streams."},
+};
+
+template <typename T>
+uint64_t value_or_zero(const webrtc::RTCStatsMember<T>& member)
+{
+  return member.is_defined() && *member > 0 ? static_cast<uint64_t>(*member) : 0;
+}
+
+void write_metric_header(std::ostringstream& out, const char* name, const char* type, const char* help)
+{
+  out<<"# HELP "<<name<<" "<<help<<"\n";
+  out<<"# TYPE "<<name<<" "<<type<<"\n";
+}
+
+}
+
+class StatsCollector::Callback : public webrtc::RTCStatsCollectorCallback {
+public:
+  Callback(StatsCollector* collector, std::shared_ptr<Session> session)
+    : collector_(collector), session_(std::move(session)) {}
+
+  // Called on the session's signaling thread.
+  virtual void OnStatsDelivered(const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) override {
+    collector_->deliver(session_, report);
+  }
+
+private:
+  StatsCollector* const collector_;
+  const std::shared_ptr<Session> session_;
+};
+
+StatsCollector* StatsCollector::instance()
+{
+  // Never destroyed, so that sessions may remove themselves during exit.
+  static StatsCollector* collector = new StatsCollector();
+  return collector;
+}
+
+StatsCollector::StatsCollector()
+{
+  sums_.round_trip_time_s = 0;
+  sums_.jitter_s = 0;
+  sums_.available_outgoing_bitrate_bps = 0;
+}
+
+StatsCollector::~StatsCollector()
+{
+  stop();
+}
+
+void StatsCollector::start(int interval_ms)
+{
+  std::lock_guard<std::mutex> lock(lock_);
+  if(running_ || interval_ms <= 0) {
+    return;
+  }
+  RTC_LOG(INFO) <<__FUNCTION__<<" polling stats every "<<interval_ms<<" ms";
+  running_ = true;
+  thread_ = std::thread(&StatsCollector::run, this, interval_ms);
+}
+
+void StatsCollector::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    running_ = false;
+  }
+  wake_.notify_all();
+  if(thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void StatsCollector::add_session(webrtc::PeerConnectionInterface* pc, const webrtc::test::MetricsRegistry* metrics)
+{
+  std::shared_ptr<Session> session = std::make_shared<Session>();
+  session->pc = pc;
+  session->metrics = metrics;
+  std::lock_guard<std::mutex> lock(lock_);
+  session->id = next_session_id_++;
+  sessions_[pc] = session;
+}
+
+void StatsCollector::remove_session(webrtc::PeerConnectionInterface* pc)
+{
+  std::shared_ptr<Session> session;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    auto it = sessions_.find(pc);
+    if(it == sessions_.end()) {
+      return;
+    }
+    session = it->second;
+    sessions_.erase(it);
+    // Its counters and histograms stay in the totals, so that they don't go
+    // back when it ends. Its gauges go.
+    if(session->metrics) {
+      webrtc::test::MetricsRegistry::Snapshot snapshot = session->metrics->GetSnapshot();
+      for(const auto& counter : snapshot.counters) {
+        removed_counters_[counter.name] += counter.value;
+      }
+      for(const auto& histogram : snapshot.histograms) {
+        add_histogram(removed_histograms_, histogram);
+      }
+      session->metrics = nullptr;
+    }
+  }
+  // The RTP counters it added stay in the totals as well.
+  std::lock_guard<std::mutex> call(call_lock_);
+  session->pc = nullptr;
+}
+
+void StatsCollector::run(int interval_ms)
+{
+  std::unique_lock<std::mutex> lock(lock_);
+  while(running_) {
+    std::vector<std::shared_ptr<Session>> sessions;
+    sessions.reserve(sessions_.size());
+    for(const auto& it : sessions_) {
+      sessions.push_back(it.second);
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto interval = std::chrono::milliseconds(interval_ms);
+    for(size_t i = 0; i < sessions.size() && running_; i++) {
+      wake_.wait_until(lock, start + interval * i / sessions.size(), [this] { return !running_; });
+      if(!running_) {
+        break;
+      }
+      lock.unlock();
+      {
+        std::lock_guard<std::mutex> call(call_lock_);
+        if(sessions[i]->pc) {
+          // Only posts the collection to the session's threads.
+          rtc::scoped_refptr<Callback> callback(new rtc::RefCountedObject<Callback>(this, sessions[i]));
+          sessions[i]->pc->GetStats(callback.get());
+        }
+      }
+      lock.lock();
+    }
+    wake_.wait_until(lock, start + interval, [this] { return !running_; });
+    if(running_) {
+      lock.unlock();
+      process_reports();
+      lock.lock();
+    }
+  }
+}
+
+void StatsCollector::deliver(const std::shared_ptr<Session>& session,
+                             const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report)
+{
+  std::lock_guard<std::mutex> lock(lock_);
+  session->pending = report;
+}
+
+void StatsCollector::process_reports()
+{
+  std::vector<std::pair<std::shared_ptr<Session>, rtc::scoped_refptr<const webrtc::RTCStatsReport>>> reports;
+  std::vector<std::shared_ptr<Session>> sessions;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    for(const auto& it : sessions_) {
+      sessions.push_back(it.second);
+      if(it.second->pending) {
+        reports.emplace_back(it.second, it.second->pending);
+        it.second->pending = nullptr;
+      }
+    }
+  }
+
+  Counters increments[kKinds] = {};
+  for(const auto& it : reports) {
+    Session* session = it.first.get();
+    const webrtc::RTCStatsReport& report = *it.second;
+    Counters counters[kKinds] = {};
+    Gauges gauges;
+    parse_report(report, counters, &gauges);
+    // A new session's counters start from 0.
+    for(int kind = 0; kind < kKinds; kind++) {
+      const Counters& last = session->counters[kind];
+      for(int counter = 0; counter < kCounters; counter++) {
+        // Counters go down when a stream goes away.
+        if(counters[kind][counter] > last[counter]) {
+          increments[kind][counter] += counters[kind][counter] - last[counter];
+        }
+      }
+    }
+    if(session->timestamp_us >= 0 && report.timestamp_us() > session->timestamp_us) {
+      double elapsed_s = (report.timestamp_us() - session->timestamp_us) / 1e6;
+      for(int kind = 0; kind < kKinds; kind++) {
+        const Counters& last = session->counters[kind];
+        if(counters[kind][kBytesSent] > last[kBytesSent]) {
+          gauges.send_bitrate_bps[kind] = (counters[kind][kBytesSent] - last[kBytesSent]) * 8 / elapsed_s;
+        }
+        if(counters[kind][kBytesReceived] > last[kBytesReceived]) {
+          gauges.receive_bitrate_bps[kind] = (counters[kind][kBytesReceived] - last[kBytesReceived]) * 8 / elapsed_s;
+        }
+      }
+    }
+    session->timestamp_us = report.timestamp_us();
+    std::copy(counters, counters + kKinds, session->counters);
+    session->gauges = gauges;
+  }
+
+  Gauges sums;
+  sums.round_trip_time_s = 0;
+  sums.jitter_s = 0;
+  sums.available_outgoing_bitrate_bps = 0;
+  double max_round_trip_time_s = 0;
+  double max_jitter_s = 0;
+  size_t round_trip_time_count = 0;
+  size_t jitter_count = 0;
+  for(const auto& session : sessions) {
+    const Gauges& gauges = session->gauges;
+    for(int kind = 0; kind < kKinds; kind++) {
+      sums.send_bitrate_bps[kind] += gauges.send_bitrate_bps[kind];
+      sums.receive_bitrate_bps[kind] += gauges.receive_bitrate_bps[kind];
+    }
+    if(gauges.round_trip_time_s >= 0) {
+      sums.round_trip_time_s += gauges.round_trip_time_s;
+      max_round_trip_time_s = std::max(max_round_trip_time_s, gauges.round_trip_time_s);
+      round_trip_time_count++;
+    }
+    if(gauges.jitter_s >= 0) {
+      sums.jitter_s += gauges.jitter_s;
+      max_jitter_s = std::max(max_jitter_s, gauges.jitter_s);
+      jitter_count++;
+    }
+    if(gauges.available_outgoing_bitrate_bps >= 0) {
+      sums.available_outgoing_bitrate_bps += gauges.available_outgoing_bitrate_bps;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(lock_);
+  for(int kind = 0; kind < kKinds; kind++) {
+    for(int counter = 0; counter < kCounters; counter++) {
+      totals_[kind][counter] += increments[kind][counter];
+    }
+  }
+  sums_ = sums;
+  max_round_trip_time_s_ = max_round_trip_time_s;
+  max_jitter_s_ = max_jitter_s;
+  round_trip_time_count_ = round_trip_time_count;
+  jitter_count_ = jitter_count;
+}
+
+void StatsCollector::parse_report(const webrtc::RTCStatsReport& report, Counters counters[kKinds], Gauges* gauges)
+{
+  auto kind_of = [](const webrtc::RTCStatsMember<std::string>& kind) {
+    return kind.is_defined() && *kind == "video" ? kVideo : kAudio;
+  };
+  for(const auto* stats : report.GetStatsOfType<webrtc::RTCOutboundRTPStreamStats>()) {
+    Counters& c = counters[kind_of(stats->kind)];
+    c[kBytesSent] += value_or_zero(stats->bytes_sent);
+    c[kPacketsSent] += value_or_zero(stats->packets_sent);
+    c[kFramesEncoded] += value_or_zero(stats->frames_encoded);
+    c[kNacksReceived] += value_or_zero(stats->nack_count);
+    c[kPlisReceived] += value_or_zero(stats->pli_count);
+  }
+  for(const auto* stats : report.GetStatsOfType<webrtc::RTCRemoteInboundRtpStreamStats>()) {
+    counters[kind_of(stats->kind)][kRemotePacketsLost] += value_or_zero(stats->packets_lost);
+  }
+  for(const auto* stats : report.GetStatsOfType<webrtc::RTCInboundRTPStreamStats>()) {
+    Counters& c = counters[kind_of(stats->kind)];
+    c[kBytesReceived] += value_or_zero(stats->bytes_received);
+    c[kPacketsReceived] += value_or_zero(stats->packets_received);
+    c[kPacketsLost] += value_or_zero(stats->packets_lost);
+    c[kFramesDecoded] += value_or_zero(stats->frames_decoded);
+    c[kNacksSent] += value_or_zero(stats->nack_count);
+    c[kPlisSent] += value_or_zero(stats->pli_count);
+    if(stats->jitter.is_defined()) {
+      gauges->jitter_s = std::max(gauges->jitter_s, *stats->jitter);
+    }
+  }
+  // RTT and estimated bandwidth of the candidate pair in use.
+  for(const auto* transport : report.GetStatsOfType<webrtc::RTCTransportStats>()) {
+    if(!transport->selected_candidate_pair_id.is_defined()) {
+      continue;
+    }
+    const webrtc::RTCStats* stats = report.Get(*transport->selected_candidate_pair_id);
+    if(!stats || stats->type() != std::string(webrtc::RTCIceCandidatePairStats::kType)) {
+      continue;
+    }
+    const auto& pair = stats->cast_to<webrtc::RTCIceCandidatePairStats>();
+    if(pair.current_round_trip_time.is_defined()) {
+      gauges->round_trip_time_s = std::max(gauges->round_trip_time_s, *pair.current_round_trip_time);
+    }
+    if(pair.available_outgoing_bitrate.is_defined()) {
+      gauges->available_outgoing_bitrate_bps = std::max(0.0, gauges->available_outgoing_bitrate_bps)
+                                               + *pair.available_outgoing_bitrate;
+    }
+  }
+}
+
+std::string StatsCollector::prometheus_text() const
+{
+  std::lock_guard<std::mutex> lock(lock_);
+  std::ostringstream out;
+  write_metric_header(out, "broadcaster_sessions", "gauge", "Sessions whose stats are polled.");
+  out<<"broadcaster_sessions "<<sessions_.size()<<"\n";
+  for(int counter = 0; counter < kCounters; counter++) {
+    write_metric_header(out, kCounterInfos[counter].name, "counter", kCounterInfos[counter].help);
+    for(int kind = 0; kind < kKinds; kind++) {
+      out<<kCounterInfos[counter].name<<"{kind=\""<<kKindNames[kind]<<"\"} "<<totals_[kind][counter]<<"\n";
+    }
+  }
+  write_metric_header(out, "broadcaster_send_bitrate_bps", "gauge", "Bitrate sent over the last poll interval.");
+  for(int kind = 0; kind < kKinds; kind++) {
+    out<<"broadcaster_send_bitrate_bps{kind=\""<<kKindNames[kind]<<"\"} "<<sums_.send_bitrate_bps[kind]<<"\n";
+  }
+  write_metric_header(out, "broadcaster_receive_bitrate_bps", "gauge", "Bitrate received over the last poll interval.");
+  for(int kind = 0; kind < kKinds; kind++) {
+    out<<"broadcaster_receive_bitrate_bps{kind=\""<<kKindNames[kind]<<"\"} "<<sums_.receive_bitrate_bps[kind]<<"\n";
+  }
+  write_metric_header(out, "broadcaster_available_outgoing_bitrate_bps", "gauge",
+                      "Sum of the sessions' estimated available send bandwidth.");
+  out<<"broadcaster_available_outgoing_bitrate_bps "<<sums_.available_outgoing_bitrate_bps<<"\n";
+  write_metric_header(out, "broadcaster_round_trip_time_seconds", "gauge",
+                      "Round trip time of the sessions' candidate pairs, mean and max.");
+  out<<"broadcaster_round_trip_time_seconds{stat=\"mean\"} "
+     <<(round_trip_time_count_ ? sums_.round_trip_time_s / round_trip_time_count_ : 0)<<"\n";
+  out<<"broadcaster_round_trip_time_seconds{stat=\"max\"} "<<max_round_trip_time_s_<<"\n";
+  write_metric_header(out, "broadcaster_jitter_seconds", "gauge",
+                      "Interarrival jitter of received streams (worst per session), mean and max.");
+  out<<"broadcaster_jitter_seconds{stat=\"mean\"} "<<(jitter_count_ ? sums_.jitter_s / jitter_count_ : 0)<<"\n";
+  out<<"broadcaster_jitter_seconds{stat=\"max\"} "<<max_jitter_s_<<"\n";
+  write_registry_metrics(out);
+  return out.str();
+}
+
+void StatsCollector::add_histogram(Histograms& histograms, const webrtc::test::MetricsRegistry::Snapshot::HistogramValue& histogram)
+{
+  auto res = histograms.insert(std::make_pair(histogram.name, histogram));
+  auto& sum = res.first->second;
+  if(res.second || sum.upper_bounds != histogram.upper_bounds) {
+    return;
+  }
+  for(size_t i = 0; i < sum.counts.size(); i++) {
+    sum.counts[i] += histogram.counts[i];
+  }
+  sum.sum += histogram.sum;
+}
+
+void StatsCollector::write_registry_metrics(std::ostringstream& out) const
+{
+  std::map<std::string, int64_t> counters = removed_counters_;
+  // By name, then by session id.
+  std::map<std::string, std::map<int, int64_t>> gauges;
+  Histograms histograms = removed_histograms_;
+  for(const auto& it : sessions_) {
+    if(!it.second->metrics) {
+      continue;
+    }
+    // Lock-free; the session's media threads keep updating while it's read.
+    webrtc::test::MetricsRegistry::Snapshot snapshot = it.second->metrics->GetSnapshot();
+    for(const auto& counter : snapshot.counters) {
+      counters[counter.name] += counter.value;
+    }
+    for(const auto& gauge : snapshot.gauges) {
+      gauges[gauge.name][it.second->id] = gauge.value;
+    }
+    for(const auto& histogram : snapshot.histograms) {
+      add_histogram(histograms, histogram);
+    }
+  }
+  for(const auto& it : counters) {
+    std::string name = "broadcaster_" + it.first;
+    out<<"# TYPE "<<name<<" counter\n"<<name<<" "<<it.second<<"\n";
+  }
+  for(const auto& it : gauges) {
+    std::string name = "broadcaster_" + it.first;
+    out<<"# TYPE "<<name<<" gauge\n";
+    for(const auto& session : it.second) {
+      out<<name<<"{session=\""<<session.first<<"\"} "<<session.second<<"\n";
+    }
+  }
+  for(const auto& it : histograms) {
+    std::string name = "broadcaster_" + it.first;
+    const auto& histogram = it.second;
+    out<<"# TYPE "<<name<<" histogram\n";
+    uint64_t count = 0;
+    for(size_t i = 0; i < histogram.counts.size(); i++) {
+      count += histogram.counts[i];
+      out<<name<<"_bucket{le=\"";
+      if(i < histogram.upper_bounds.size()) {
+        out<<histogram.upper_bounds[i];
+      } else {
+        out<<"+Inf";
+      }
+      out<<"\"} "<<count<<"\n";
+    }
+    out<<name<<"_sum "<<histogram.sum<<"\n";
+    out<<name<<"_count "<<count<<"\n";
+  }
+}
+
+}
@@ -0,0 +1,136 @@
+#ifndef BROADCASTER_STATS_COLLECTOR_H
+#define BROADCASTER_STATS_COLLECTOR_H
+
+#include <array>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "api/peer_connection_interface.h"
+#include "api/stats/rtc_stats_report.h"
+#include "test/metrics_registry.h"
+
+namespace webrtc {
+
+// Polls the RTCStatsReport of every session of the process and aggregates
+// them into process-wide metrics, rendered in the Prometheus text format.
+//
+// Sessions are polled one at a time, spread over the interval, so that with
+// many sessions each signaling thread only starts a stats collection now
+// and then. The report callback only stores the report; it is parsed and
+// aggregated on the collector's thread.
+class StatsCollector {
+public:
+  // The process-wide collector. Sessions are added even if it is not
+  // started, which costs nothing.
+  static StatsCollector* instance();
+
+  void start(int interval_ms);
+  void stop();
+
+  // Sessions are polled until removed. remove_session() waits for a
+  // GetStats() call in progress, so the session may stop its signaling
+  // thread once it returns. The counters and histograms in |metrics|, if
+  // given, are summed over the sessions by name and exported as they are
+  // when rendered, and the counters and histograms of removed sessions stay
+  // in the sums. Gauges don't add up across sessions, so each session's are
+  // exported with a session label, numbered in the order sessions are added.
+  // The registry must stay alive until the session is removed.
+  void add_session(webrtc::PeerConnectionInterface* pc, const webrtc::test::MetricsRegistry* metrics = nullptr);
+  void remove_session(webrtc::PeerConnectionInterface* pc);
+
+  // Metrics as of the last poll of each session, in the Prometheus text
+  // exposition format. May be called on any thread.
+  std::string prometheus_text() const;
+
+private:
+  enum Kind { kAudio = 0, kVideo, kKinds };
+  // Cumulative counters of the RTP streams. Sent streams count the NACKs
+  // and PLIs they received and lost packets as reported by the remote side
+  // in RTCP; received streams count the NACKs and PLIs they sent.
+  enum Counter {
+    kBytesSent = 0,
+    kPacketsSent,
+    kBytesReceived,
+    kPacketsReceived,
+    kPacketsLost,
+    kRemotePacketsLost,
+    kFramesEncoded,
+    kFramesDecoded,
+    kNacksReceived,
+    kPlisReceived,
+    kNacksSent,
+    kPlisSent,
+    kCounters
+  };
+  typedef std::array<uint64_t, kCounters> Counters;
+
+  // Of one session, or summed over the sessions.
+  struct Gauges {
+    double send_bitrate_bps[kKinds] = {0, 0};
+    double receive_bitrate_bps[kKinds] = {0, 0};
+    // Negative until reported.
+    double round_trip_time_s = -1;
+    double jitter_s = -1;
+    double available_outgoing_bitrate_bps = -1;
+  };
+
+  class Callback;
+  struct Session {
+    rtc::scoped_refptr<webrtc::PeerConnectionInterface> pc;
+    const webrtc::test::MetricsRegistry* metrics = nullptr;
+    // The session label of the registry's gauges.
+    int id = 0;
+    // Set by the callback, taken by the collector thread. Guarded by lock_.
+    rtc::scoped_refptr<const webrtc::RTCStatsReport> pending;
+    // Only used by the collector thread.
+    int64_t timestamp_us = -1;
+    Counters counters[kKinds] = {};
+    Gauges gauges;
+  };
+
+  StatsCollector();
+  ~StatsCollector();
+
+  void run(int interval_ms);
+  void deliver(const std::shared_ptr<Session>& session,
+               const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report);
+  // Parses the pending reports, adds the counters' increments to the totals
+  // and sums up the gauges.
+  void process_reports();
+  static void parse_report(const webrtc::RTCStatsReport& report, Counters counters[kKinds], Gauges* gauges);
+  typedef std::map<std::string, webrtc::test::MetricsRegistry::Snapshot::HistogramValue> Histograms;
+  // Adds |histogram| to the one of its name, unless their bounds differ.
+  static void add_histogram(Histograms& histograms, const webrtc::test::MetricsRegistry::Snapshot::HistogramValue& histogram);
+  // The sessions' registries, summed by name but for the gauges. Called
+  // with lock_ held.
+  void write_registry_metrics(std::ostringstream& out) const;
+
+  mutable std::mutex lock_;
+  std::condition_variable wake_;
+  bool running_ = false;
+  std::thread thread_;
+  std::map<webrtc::PeerConnectionInterface*, std::shared_ptr<Session>> sessions_;
+  int next_session_id_ = 0;
+  // Held during a GetStats() call, so that remove_session() can wait for it.
+  std::mutex call_lock_;
+
+  // Guarded by lock_.
+  Counters totals_[kKinds] = {};
+  Gauges sums_;
+  double max_round_trip_time_s_ = 0;
+  double max_jitter_s_ = 0;
+  size_t round_trip_time_count_ = 0;
+  size_t jitter_count_ = 0;
+  // The registries' counters and histograms of the removed sessions.
+  std::map<std::string, int64_t> removed_counters_;
+  Histograms removed_histograms_;
+};
+
+}
+
+#endif // BROADCASTER_STATS_COLLECTOR_H